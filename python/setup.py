@@ -0,0 +1,71 @@
+# setup.py : Builds the ttmtags module from the acquisition sources
+#
+#   pip install pybind11 numpy
+#   python setup.py build_ext --inplace
+#
+# HDF5 is found in HDF5_DIR (include and lib below it) if set, otherwise in the default install location used by the
+# Visual Studio project on Windows and the distribution's serial HDF5 on Linux.
+#
+#   import ttmtags
+#   times, edges = ttmtags.decode(words)               # TimetagI64Pack words from a packet
+#   store = ttmtags.WindowStore(clock_line=3, windows_per_shot=100)
+#   store.feed_packet(packet)                            # raw TTMDataPacket_t bytes, e.g. from a capture
+#   windows = store.take()
+#   windows.times[windows.offsets[i]:windows.offsets[i + 1]]
+#   shot = ttmtags.read_shot_file("blackhole.h5")
+#   index = ttmtags.WindowIndex("blackhole.idx")          # written with --index=blackhole.idx
+#   times, edges = index.read(run=0, shot=1204, window=3, channel=2)
+
+import os
+import sys
+from setuptools import setup, Extension
+import pybind11
+
+here = os.path.dirname(os.path.abspath(__file__))
+acquisition = os.path.join(here, "..", "timeTaggerODMeasurement")
+vendor = os.path.join(here, "..", "include")
+sources = ["ttmtags.cpp"] + [os.path.join(acquisition, name) for name in ("tagDecoder.cpp", "windowManager.cpp", "coincidenceCounter.cpp", "shotPublisher.cpp", "windowIndex.cpp", "pipelineMetrics.cpp", "latencyHistogram.cpp")]
+
+hdf5 = os.environ.get("HDF5_DIR")
+if sys.platform == "win32":
+	if hdf5 is None:
+		hdf5 = "C:\\Program Files (x86)\\HDF_Group\\HDF5\\1.10.0"
+	includeDirs = [os.path.join(hdf5, "include")]
+	libraryDirs = [os.path.join(hdf5, "lib")]
+	libraries = ["hdf5", "hdf5_cpp", "ws2_32", "psapi"]
+	defines = [("HDF5CPP_USEDLL", None), ("_HDF5USEDLL_", None), ("H5_BUILT_AS_DYNAMIC_LIB", None)]
+	compileArgs = ["/O2", "/EHsc"]
+elif hdf5 is not None:
+	includeDirs = [os.path.join(hdf5, "include")]
+	libraryDirs = [os.path.join(hdf5, "lib")]
+	libraries = ["hdf5_cpp", "hdf5", "pthread"]
+	defines = []
+	compileArgs = ["-std=c++14", "-O3"]
+else:
+	includeDirs = ["/usr/include/hdf5/serial"]
+	libraryDirs = ["/usr/lib/x86_64-linux-gnu/hdf5/serial"]
+	libraries = ["hdf5_serial_cpp", "hdf5_serial", "pthread"]
+	defines = []
+	compileArgs = ["-std=c++14", "-O3"]
+
+#The vendor headers stand in for system ones on Windows only, elsewhere they go after the system include paths
+if sys.platform == "win32":
+	includeDirs.append(vendor)
+else:
+	compileArgs += ["-idirafter", vendor]
+
+setup(
+	name="ttmtags",
+	version="1.0",
+	description="Tag decoding and gate windowing from the timeTaggerODMeasurement acquisition",
+	ext_modules=[Extension(
+		"ttmtags",
+		sources=sources,
+		include_dirs=[acquisition, pybind11.get_include()] + includeDirs,
+		library_dirs=libraryDirs,
+		libraries=libraries,
+		define_macros=defines,
+		extra_compile_args=compileArgs,
+		language="c++",
+	)],
+)
@@ -0,0 +1,371 @@
+// ttmtags.cpp : Python module exposing the tag decoder, window store, shot file reader and window index
+//
+// Columns come back as NumPy arrays that view the native storage directly; each array keeps the object owning
+// that storage alive, so nothing is copied on the way out and nothing dangles once the source is dropped.
+
+#include "stdafx.h"
+#include "tagDecoder.h"
+#include "windowManager.h"
+#include "windowIndex.h"
+#include "H5Cpp.h"
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+namespace py = pybind11;
+
+//NumPy view of a vector owned by base
+template <typename T>
+static py::array_t<T> columnView(const std::vector<T> &column, py::handle base)
+{
+	return py::array_t<T>({ (py::ssize_t)column.size() }, { (py::ssize_t)sizeof(T) }, column.data(), base);
+}
+
+//Hand freshly decoded columns to NumPy, a capsule owns them from then on
+static py::tuple columnsToArrays(tagColumns *tags)
+{
+	py::capsule owner(tags, [](void *p) { delete (tagColumns *)p; });
+	return py::make_tuple(columnView(tags->times, owner), columnView(tags->edges, owner));
+}
+
+//A raw TTMDataPacket_t from Python, its DataSize cut down to the bytes actually passed so decodeTags stays inside them
+static TTMDataPacket_t *packetFromBytes(std::string *raw)
+{
+	if (raw->size() < offsetof(TTMDataPacket_t, Data)) {
+		throw std::invalid_argument("packet shorter than its header");
+	}
+	TTMDataPacket_t *tagBuffer = (TTMDataPacket_t *)&(*raw)[0];
+	size_t available = raw->size() - offsetof(TTMDataPacket_t, Data);
+	if (tagBuffer->Header.DataSize > available) {
+		tagBuffer->Header.DataSize = (uint16_t)available;
+	}
+	return tagBuffer;
+}
+
+//Decoder keeping the high word from one buffer to the next, as the acquisition does from packet to packet
+struct pyDecoder {
+	decoderState state;
+	pyDecoder(uint32_t highWord) {
+		initDecoderState(&state);
+		state.highWord = highWord;
+	}
+	//Words as they arrive from the tagger (TimetagI64Pack, high/low flag in bit 31)
+	py::tuple decodeWords(py::array_t<uint32_t, py::array::c_style | py::array::forcecast> words) {
+		tagColumns *tags = new tagColumns;
+		py::buffer_info info = words.request();
+		{
+			py::gil_scoped_release release;
+			decodeTagWords((const TimetagI64Pack *)info.ptr, (size_t)info.size, &state, tags);
+		}
+		return columnsToArrays(tags);
+	}
+	//A whole TTMDataPacket_t in any I-Mode continuous format, decoded as its Header.DataFormat says. Only the DataSize
+	//bytes after the header are decoded
+	py::tuple decodePacket(py::bytes packet) {
+		std::string raw = packet;
+		TTMDataPacket_t *tagBuffer = packetFromBytes(&raw);
+		tagColumns *tags = new tagColumns;
+		decodeTags(tagBuffer, &state, tags);
+		return columnsToArrays(tags);
+	}
+	//Words as written to the HDF5 files (high/low flag in bit 0)
+	py::tuple decodeStored(py::array_t<uint32_t, py::array::c_style | py::array::forcecast> words) {
+		tagColumns *tags = new tagColumns;
+		py::buffer_info info = words.request();
+		{
+			py::gil_scoped_release release;
+			decodeStoredWords((const uint32_t *)info.ptr, (size_t)info.size, &state, tags);
+		}
+		return columnsToArrays(tags);
+	}
+};
+
+//Windows of a run held column-wise, window i owns tags offsets[i]..offsets[i + 1]
+struct windowSet {
+	std::vector<uint64_t> times;
+	std::vector<uint8_t> edges;
+	std::vector<uint64_t> offsets;
+	std::vector<uint64_t> clockTimes;
+	std::vector<uint8_t> clockEdges;
+	std::vector<uint64_t> clockOffsets;
+	std::vector<uint64_t> shotNums;
+	std::vector<uint32_t> windowNums;
+	std::vector<uint64_t> startTimes;
+	std::vector<uint64_t> endTimes;
+	std::vector<uint8_t> complete;
+	windowSet() {
+		offsets.push_back(0);
+		clockOffsets.push_back(0);
+	}
+	void addWindow(uint64_t shotNum, uint32_t windowNum, uint64_t startTime, uint64_t endTime, bool isComplete) {
+		shotNums.push_back(shotNum);
+		windowNums.push_back(windowNum);
+		startTimes.push_back(startTime);
+		endTimes.push_back(endTime);
+		complete.push_back(isComplete);
+		offsets.push_back(times.size());
+		clockOffsets.push_back(clockTimes.size());
+	}
+	void append(const tagColumns *tags, bool clock) {
+		std::vector<uint64_t> &toTimes = clock ? clockTimes : times;
+		std::vector<uint8_t> &toEdges = clock ? clockEdges : edges;
+		toTimes.insert(toTimes.end(), tags->times.begin(), tags->times.end());
+		toEdges.insert(toEdges.end(), tags->edges.begin(), tags->edges.end());
+	}
+	size_t size() const {
+		return shotNums.size();
+	}
+};
+
+//Windows are routed by the same window manager as the acquisition, closed windows are gathered into a windowSet
+struct pyWindowStore {
+	acquisitionOptions options;
+	windowQueue closed;
+	windowManager manager;
+	decoderState decoder;
+	tagColumns block;
+	std::unique_ptr<windowSet> windows;
+	pyWindowStore(uint16_t clockLine, uint16_t windowsPerShot) : closed(std::numeric_limits<size_t>::max()), windows(new windowSet) {
+		options.numWindows = windowsPerShot;
+		options.clockLine = clockLine;
+		//Offline there is no clock to time gaps by, shots end on the window count or, without one, only when asked to
+		options.shotBoundary = windowsPerShot != 0 ? shotRuleCount : shotRuleGap;
+		options.shotGapMillis = 0;
+		options.digitalIOMask = 0;
+		options.maxInFlightWindows = 0;
+		options.memoryBudget = 0;
+		options.metricsPort = 0;
+		options.shmRingBytes = 0;
+		options.countsOnly = false;
+		options.coincWindowTicks = 0;
+		options.coincMin = 2;
+		options.coincMax = 128;
+		options.coincChannelMask = 0;
+		options.coincTags = false;
+		initWindowManager(&manager, &options, &closed);
+		initDecoderState(&decoder);
+	}
+	//Move whatever the window manager closed into the window set
+	void gather() {
+		while (closed.size() != 0) {
+			tagWindow *window = closed.pop();
+			if (!window->shotEnd) {
+				for (size_t b = 0; b < window->spilled.size(); b++) {
+					tagColumns spilled;
+					if (readSpilledBlock(window, &window->spilled[b], &spilled)) {
+						windows->append(&spilled, window->spilled[b].clock);
+					}
+				}
+				windows->append(&window->windowedTags, false);
+				windows->append(&window->clockTags, true);
+				windows->addWindow(window->shotNum, window->windowNum, window->startTime, window->endTime, window->complete);
+			}
+			releaseWindow(window, &manager.memory);
+		}
+	}
+	void feedTags(py::array_t<uint64_t, py::array::c_style | py::array::forcecast> times, py::array_t<uint8_t, py::array::c_style | py::array::forcecast> edges) {
+		if (times.size() != edges.size()) {
+			throw std::invalid_argument("times and edges differ in length");
+		}
+		block.times.assign(times.data(), times.data() + times.size());
+		block.edges.assign(edges.data(), edges.data() + edges.size());
+		processTagBlock(&block, &manager);
+		gather();
+	}
+	void feedPacket(py::bytes packet) {
+		std::string raw = packet;
+		decodeTags(packetFromBytes(&raw), &decoder, &block);
+		processTagBlock(&block, &manager);
+		gather();
+	}
+	void endShot() {
+		::endShot(&manager);
+		gather();
+	}
+	//Hand over the windows gathered so far, the store starts again empty
+	windowSet *take() {
+		windowSet *taken = windows.release();
+		windows.reset(new windowSet);
+		return taken;
+	}
+};
+
+//Read one shot file as written by the acquisition back into a window set
+static windowSet *readShotFile(const std::string &filename)
+{
+	std::unique_ptr<windowSet> windows(new windowSet);
+	H5::H5File file(&filename[0u], H5F_ACC_RDONLY);
+	std::vector<uint32_t> startTags;
+	std::vector<uint32_t> endTags;
+	std::vector<uint32_t> words;
+	//Read a whole one dimensional dataset of words
+	auto readWords = [&file](const std::string &datasetName, std::vector<uint32_t> *wordsOut) {
+		H5::DataSet dset = file.openDataSet(&datasetName[0u]);
+		hsize_t dims[1];
+		dset.getSpace().getSimpleExtentDims(dims);
+		wordsOut->resize((size_t)dims[0]);
+		if (dims[0] != 0) {
+			dset.read(&(*wordsOut)[0], H5::PredType::NATIVE_UINT32);
+		}
+	};
+	readWords("/Tags/StartTag", &startTags);
+	readWords("/Tags/EndTag", &endTags);
+	size_t numWindows = startTags.size() / 2;
+	//Windows cut short by the end of a shot still have an end tag, only the Complete flags tell them apart. Files
+	//written before there were flags are left to go by whether the end tag decodes
+	std::vector<uint8_t> flags;
+	if (H5Lexists(file.getId(), "/Tags/Complete", H5P_DEFAULT) > 0) {
+		H5::DataSet dset = file.openDataSet("/Tags/Complete");
+		hsize_t dims[1];
+		dset.getSpace().getSimpleExtentDims(dims);
+		if ((size_t)dims[0] != numWindows) {
+			throw std::runtime_error(filename + " has " + std::to_string(dims[0]) + " Complete flags for " + std::to_string(numWindows) + " windows");
+		}
+		flags.resize(numWindows);
+		if (numWindows != 0) {
+			dset.read(&flags[0], H5::PredType::NATIVE_UINT8);
+		}
+	}
+	decoderState state;
+	initDecoderState(&state);
+	tagColumns tags;
+	for (size_t w = 0; w < numWindows; w++) {
+		//Start and end tags are a high word followed by a low word
+		tags.times.clear();
+		tags.edges.clear();
+		decodeStoredWords(&startTags[2 * w], 2, &state, &tags);
+		decodeStoredWords(&endTags[2 * w], 2, &state, &tags);
+		uint64_t startTime = tags.times.size() > 0 ? tags.times[0] : 0;
+		uint64_t endTime = tags.times.size() > 1 ? tags.times[1] : 0;
+		bool complete = flags.empty() ? tags.times.size() > 1 : flags[w] != 0;
+		for (int clock = 0; clock < 2; clock++) {
+			std::string datasetName = std::string("/Tags/") + (clock ? "ClockTags" : "TagWindow") + std::to_string(w);
+			if (!H5Lexists(file.getId(), datasetName.c_str(), H5P_DEFAULT)) {
+				continue;
+			}
+			readWords(datasetName, &words);
+			//Tag words of a window pick up from the high word of its start
+			state.highWord = windowHighWord(startTime);
+			tags.times.clear();
+			tags.edges.clear();
+			decodeStoredWords(words.data(), words.size(), &state, &tags);
+			windows->append(&tags, clock != 0);
+		}
+		//The files do not record shot numbers
+		windows->addWindow(0, (uint32_t)w, startTime, endTime, complete);
+	}
+	return windows.release();
+}
+
+//Window index written with --index, any window is read straight from its dataset after one lookup
+struct pyWindowIndex {
+	indexedWindows indexed;
+	pyWindowIndex(const std::string &path) {
+		if (!loadWindowIndex(&indexed, path)) {
+			throw std::invalid_argument(path + " is not a window index");
+		}
+	}
+	const windowIndexEntry *find(uint32_t run, uint32_t shot, uint32_t window, uint32_t gate, indexStream stream) const {
+		const windowIndexEntry *entry = findIndexedWindow(&indexed, run, shot, gate, window, stream);
+		if (entry == NULL) {
+			throw py::key_error("window " + std::to_string(window) + " of gate " + std::to_string(gate) + " in shot " + std::to_string(shot) + " of run " + std::to_string(run) + " is not in the index");
+		}
+		return entry;
+	}
+	py::tuple readTags(uint32_t run, uint32_t shot, uint32_t window, uint32_t gate, int channel, const std::string &stream) {
+		indexStream kind = indexTags;
+		if (stream == "clock") {
+			kind = indexClockTags;
+		}
+		else if (stream == "coincidences") {
+			kind = indexCoincTags;
+		}
+		else if (stream != "tags") {
+			throw std::invalid_argument("stream is tags, clock or coincidences");
+		}
+		const windowIndexEntry *entry = find(run, shot, window, gate, kind);
+		tagColumns *tags = new tagColumns;
+		try {
+			readIndexedTags(&indexed, entry, channel, tags);
+		}
+		catch (...) {
+			delete tags;
+			throw;
+		}
+		return columnsToArrays(tags);
+	}
+	py::array_t<uint32_t> readCounts(uint32_t run, uint32_t shot, uint32_t window, uint32_t gate) {
+		const windowIndexEntry *entry = find(run, shot, window, gate, indexCounts);
+		std::vector<uint32_t> counts;
+		readIndexedCounts(&indexed, entry, &counts);
+		return py::array_t<uint32_t>((py::ssize_t)counts.size(), counts.data());
+	}
+	py::tuple location(uint32_t run, uint32_t shot, uint32_t window, uint32_t gate) const {
+		const windowIndexEntry *entry = find(run, shot, window, gate, indexTags);
+		return py::make_tuple(indexed.files[entry->fileNum], std::string(entry->dataset), entry->first, entry->first + entry->count);
+	}
+};
+
+PYBIND11_MODULE(ttmtags, module)
+{
+	module.doc() = "Tag decoding and gate windowing from the timeTaggerODMeasurement acquisition";
+
+	//HDF5 errors are not std::exceptions, pass them on as IOError rather than an unknown error
+	py::register_exception_translator([](std::exception_ptr error) {
+		try {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+		catch (const H5::Exception &exception) {
+			PyErr_SetString(PyExc_IOError, exception.getCDetailMsg());
+		}
+	});
+
+	py::class_<pyDecoder>(module, "Decoder", "Packed word decoder, the high word carries over between calls")
+		.def(py::init<uint32_t>(), py::arg("high_word") = 0)
+		.def("decode", &pyDecoder::decodeWords, py::arg("words"), "Decode TimetagI64Pack words into (times, edges)")
+		.def("decode_packet", &pyDecoder::decodePacket, py::arg("packet"), "Decode a raw TTMDataPacket_t in any I-Mode continuous format into (times, edges)")
+		.def("decode_stored", &pyDecoder::decodeStored, py::arg("words"), "Decode words from an HDF5 shot file into (times, edges)")
+		.def_property("high_word", [](const pyDecoder &d) { return d.state.highWord; }, [](pyDecoder &d, uint32_t highWord) { d.state.highWord = highWord; });
+
+	module.def("decode", [](py::array_t<uint32_t, py::array::c_style | py::array::forcecast> words, uint32_t highWord) {
+		pyDecoder decoder(highWord);
+		return decoder.decodeWords(words);
+	}, py::arg("words"), py::arg("high_word") = 0, "Decode TimetagI64Pack words into (times, edges), edges hold channel << 1 | slope");
+
+	//Every column is a view onto the set, which stays alive as long as any view does
+	py::class_<windowSet>(module, "Windows", "Gate windows held column-wise, window i owns tags offsets[i]:offsets[i + 1]")
+		.def("__len__", &windowSet::size)
+		.def_property_readonly("times", [](py::object self) { return columnView(self.cast<windowSet &>().times, self); })
+		.def_property_readonly("edges", [](py::object self) { return columnView(self.cast<windowSet &>().edges, self); })
+		.def_property_readonly("offsets", [](py::object self) { return columnView(self.cast<windowSet &>().offsets, self); })
+		.def_property_readonly("clock_times", [](py::object self) { return columnView(self.cast<windowSet &>().clockTimes, self); })
+		.def_property_readonly("clock_edges", [](py::object self) { return columnView(self.cast<windowSet &>().clockEdges, self); })
+		.def_property_readonly("clock_offsets", [](py::object self) { return columnView(self.cast<windowSet &>().clockOffsets, self); })
+		.def_property_readonly("shot", [](py::object self) { return columnView(self.cast<windowSet &>().shotNums, self); })
+		.def_property_readonly("window", [](py::object self) { return columnView(self.cast<windowSet &>().windowNums, self); })
+		.def_property_readonly("start_time", [](py::object self) { return columnView(self.cast<windowSet &>().startTimes, self); })
+		.def_property_readonly("end_time", [](py::object self) { return columnView(self.cast<windowSet &>().endTimes, self); })
+		.def_property_readonly("complete", [](py::object self) { return columnView(self.cast<windowSet &>().complete, self); });
+
+	py::class_<pyWindowStore>(module, "WindowStore", "Routes tags into gate windows the way the acquisition does")
+		.def(py::init<uint16_t, uint16_t>(), py::arg("clock_line"), py::arg("windows_per_shot") = 0)
+		.def("feed_packet", &pyWindowStore::feedPacket, py::arg("packet"), "Decode and window a raw TTMDataPacket_t, for replaying captured packets")
+		.def("feed_tags", &pyWindowStore::feedTags, py::arg("times"), py::arg("edges"), "Window already decoded tags")
+		.def("end_shot", &pyWindowStore::endShot, "Close any open window and end the shot")
+		.def("take", &pyWindowStore::take, py::return_value_policy::take_ownership, "Windows closed so far, the store starts again empty");
+
+	module.def("read_shot_file", &readShotFile, py::arg("filename"), py::return_value_policy::take_ownership, "Read a shot file written by the acquisition");
+
+	py::class_<pyWindowIndex>(module, "WindowIndex", "Index of where each window of each shot is stored, as written with --index")
+		.def(py::init<const std::string &>(), py::arg("path"))
+		.def("__len__", [](const pyWindowIndex &index) { return index.indexed.entries.size(); })
+		.def("read", &pyWindowIndex::readTags, py::arg("run"), py::arg("shot"), py::arg("window"), py::arg("gate") = 0, py::arg("channel") = allChannels, py::arg("stream") = "tags", "(times, edges) of a window, of one tag channel unless channel is -1. stream is tags, clock or coincidences")
+		.def("read_counts", &pyWindowIndex::readCounts, py::arg("run"), py::arg("shot"), py::arg("window"), py::arg("gate") = 0, "Counts (rows x bins, flattened) of a window written in counts only mode")
+		.def("location", &pyWindowIndex::location, py::arg("run"), py::arg("shot"), py::arg("window"), py::arg("gate") = 0, "(file, dataset, first, end) the tags of a window are stored in");
+}
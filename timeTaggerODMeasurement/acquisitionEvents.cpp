@@ -0,0 +1,141 @@
+// acquisitionEvents.cpp : Single wait point of the acquisition loop for packets, wake-ups and the stop file
+//
+
+#include "stdafx.h"
+#include "acquisitionEvents.h"
+#include <cstring>
+#if !defined(_WIN32)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+#if defined(_WIN32)
+bool initAcquisitionEvents(acquisitionEvents *events, SOCKET dataSocket, const std::string &stopFileName)
+{
+	events->dataSocket = dataSocket;
+	events->stopFileName = stopFileName;
+	events->dataEvent = WSACreateEvent();
+	//Manual reset so a wake-up is not lost if it comes in while the loop is busy
+	events->wakeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	events->stopFileChange = FindFirstChangeNotificationA(".", FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (events->dataEvent == WSA_INVALID_EVENT || events->wakeEvent == NULL || events->stopFileChange == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	return WSAEventSelect(dataSocket, events->dataEvent, FD_READ) == 0;
+}
+
+int waitForEvents(acquisitionEvents *events, int timeoutMillis)
+{
+	HANDLE handles[3] = { events->dataEvent, events->wakeEvent, events->stopFileChange };
+	DWORD waited = WaitForMultipleObjects(3, handles, FALSE, timeoutMillis < 0 ? INFINITE : (DWORD)timeoutMillis);
+	if (waited == WAIT_TIMEOUT || waited == WAIT_FAILED) {
+		return 0;
+	}
+	//Collect everything that is signalled, not just the first handle
+	int fired = 0;
+	WSANETWORKEVENTS networkEvents;
+	if (WaitForSingleObject(events->dataEvent, 0) == WAIT_OBJECT_0) {
+		WSAEnumNetworkEvents(events->dataSocket, events->dataEvent, &networkEvents);
+		fired |= eventData;
+	}
+	if (WaitForSingleObject(events->wakeEvent, 0) == WAIT_OBJECT_0) {
+		ResetEvent(events->wakeEvent);
+		fired |= eventWake;
+	}
+	if (WaitForSingleObject(events->stopFileChange, 0) == WAIT_OBJECT_0) {
+		FindNextChangeNotification(events->stopFileChange);
+		fired |= eventStopFile;
+	}
+	return fired;
+}
+
+void wakeAcquisition(acquisitionEvents *events)
+{
+	SetEvent(events->wakeEvent);
+}
+
+void closeAcquisitionEvents(acquisitionEvents *events)
+{
+	WSAEventSelect(events->dataSocket, NULL, 0);
+	WSACloseEvent(events->dataEvent);
+	CloseHandle(events->wakeEvent);
+	FindCloseChangeNotification(events->stopFileChange);
+}
+#else
+bool initAcquisitionEvents(acquisitionEvents *events, SOCKET dataSocket, const std::string &stopFileName)
+{
+	events->dataSocket = dataSocket;
+	events->stopFileName = stopFileName;
+	events->pollFd = epoll_create1(EPOLL_CLOEXEC);
+	events->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	events->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (events->pollFd < 0 || events->wakeFd < 0 || events->watchFd < 0) {
+		return false;
+	}
+	//The stop file is usually rewritten in place, but editors like to write a new file and move it over
+	if (inotify_add_watch(events->watchFd, ".", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+		return false;
+	}
+	int fds[3] = { dataSocket, events->wakeFd, events->watchFd };
+	int kinds[3] = { eventData, eventWake, eventStopFile };
+	for (int i = 0; i < 3; i++) {
+		epoll_event watch;
+		memset(&watch, 0, sizeof(watch));
+		watch.events = EPOLLIN;
+		watch.data.u32 = kinds[i];
+		if (epoll_ctl(events->pollFd, EPOLL_CTL_ADD, fds[i], &watch) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Drain the inotify queue, true if any of it was about the stop file
+static bool stopFileTouched(acquisitionEvents *events)
+{
+	bool touched = false;
+	char buffer[4096] __attribute__((aligned(__alignof__(inotify_event))));
+	ssize_t length;
+	while ((length = read(events->watchFd, buffer, sizeof(buffer))) > 0) {
+		for (char *next = buffer; next < buffer + length;) {
+			const inotify_event *change = (const inotify_event *)next;
+			if (change->len != 0 && events->stopFileName == change->name) {
+				touched = true;
+			}
+			next += sizeof(inotify_event) + change->len;
+		}
+	}
+	return touched;
+}
+
+int waitForEvents(acquisitionEvents *events, int timeoutMillis)
+{
+	epoll_event ready[3];
+	int count = epoll_wait(events->pollFd, ready, 3, timeoutMillis);
+	int fired = 0;
+	for (int i = 0; i < count; i++) {
+		fired |= (int)ready[i].data.u32;
+	}
+	if (fired & eventWake) {
+		eventfd_t wakeups;
+		eventfd_read(events->wakeFd, &wakeups);
+	}
+	if ((fired & eventStopFile) && !stopFileTouched(events)) {
+		fired &= ~eventStopFile;
+	}
+	return fired;
+}
+
+void wakeAcquisition(acquisitionEvents *events)
+{
+	eventfd_write(events->wakeFd, 1);
+}
+
+void closeAcquisitionEvents(acquisitionEvents *events)
+{
+	close(events->pollFd);
+	close(events->wakeFd);
+	close(events->watchFd);
+}
+#endif
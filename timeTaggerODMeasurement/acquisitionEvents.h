@@ -0,0 +1,42 @@
+// acquisitionEvents.h : Single wait point of the acquisition loop for packets, wake-ups and the stop file
+//
+
+#pragma once
+
+#include "TTMLib.h"
+#include <string>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+
+//What woke the loop, as bits
+const int eventData = 1;
+const int eventWake = 2;
+const int eventStopFile = 4;
+
+//Waiting costs nothing while idle and returns within microseconds of a packet arriving. Linux waits in epoll on the
+//data socket, an eventfd and an inotify watch on the stop file's directory; Windows waits on the equivalent events.
+struct acquisitionEvents {
+	SOCKET dataSocket;
+	std::string stopFileName;
+#if defined(_WIN32)
+	WSAEVENT dataEvent;
+	HANDLE wakeEvent;
+	HANDLE stopFileChange;
+#else
+	int pollFd;
+	int wakeFd;
+	int watchFd;
+#endif
+};
+
+//Start watching the data socket and the stop file (in the working directory)
+bool initAcquisitionEvents(acquisitionEvents *events, SOCKET dataSocket, const std::string &stopFileName);
+
+//Wait up to timeoutMillis (-1 for ever) and return the events that fired, 0 on timeout
+int waitForEvents(acquisitionEvents *events, int timeoutMillis);
+
+//Wake the loop from another thread
+void wakeAcquisition(acquisitionEvents *events);
+
+void closeAcquisitionEvents(acquisitionEvents *events);
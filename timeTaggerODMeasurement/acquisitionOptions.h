@@ -0,0 +1,150 @@
+// acquisitionOptions.h : Settings for a measurement run, taken from the command line
+//
+
+#pragma once
+
+#include "TTMLib.h"
+#include <string>
+#include <vector>
+
+//How the end of a shot is detected
+enum shotRule {
+	//Shot ends once numWindows windows have closed
+	shotRuleCount,
+	//Shot ends when no gate edge has been seen for shotGapMillis
+	shotRuleGap,
+	//Shot lasts while any of the digitalIOMask bits are set in the packet headers
+	shotRuleDigitalIO
+};
+
+//Where tag packets are received from
+enum ingestBackend {
+	//TTMData_c from the vendor library, one packet per fetch
+	ingestVendor,
+	//Native UDP receiver draining batches of datagrams per recvmmsg call, Linux only
+	ingestRecvmmsg,
+	//Kernel mapped TPACKET_V3 capture ring, packets are decoded where the kernel put them, Linux only
+	ingestTpacket
+};
+
+//What is given up when the writer falls behind, in order of how much is lost
+enum pressureAction {
+	//Windows keep photon counts per channel and bin (countBins bins of countBinTicks) rather than their tags
+	pressureCounts,
+	//Windows of the gates after the first, the background and reference windows, keep only their photon totals
+	pressureBackground,
+	//Shots starting under pressure are dropped whole, windows opened under pressure mid shot keep only their totals
+	pressureDrop
+};
+
+//A backpressure tier, taken once the closed window queue (or the memory budget, whichever is fuller) is at least
+//percent full
+struct pressureTier {
+	pressureAction action;
+	uint32_t percent;
+};
+
+//A gate cutting windows out of the tag stream, edges are tag edges (channel << 1 | slope). A window opens on openEdge
+//and closes on closeEdge, or once closeClocks rising clock edges have gone by if closeClocks is not 0
+struct gateDefinition {
+	uint8_t openEdge;
+	uint8_t closeEdge;
+	uint32_t closeClocks;
+};
+
+struct acquisitionOptions {
+	//Positional arguments
+	in_addr_t taggerIP;
+	std::string blackhole;
+	uint16_t numWindows;
+	std::vector<uint16_t> channelVect;
+	uint16_t clockLine;
+	uint16_t triggerLevel;
+	//Optional --name=value arguments
+	shotRule shotBoundary;
+	//For the count and digital IO rules a non-zero gap still ends a shot whose gate edges went missing
+	uint32_t shotGapMillis;
+	uint16_t digitalIOMask;
+	//Closed windows waiting for the writer, this bounds memory rather than numWindows
+	uint32_t maxInFlightWindows;
+	//Threads post-processing closed windows before the writer, 0 to hand windows straight to the writer
+	uint32_t postWorkers;
+	//zlib level (1..9) the tag datasets are deflated at, 0 to store them as they are. With post-processing workers the
+	//chunks are deflated on the workers and written directly, otherwise HDF5 deflates them on the writer thread
+	int compressLevel;
+	//Budget for tag storage in flight (open and queued windows) in bytes, 0 for no limit
+	uint64_t memoryBudget;
+	//Tiers of what to give up as the writer falls behind, empty to always wait for the writer (the kernel then drops
+	//packets once the socket buffer fills)
+	std::vector<pressureTier> backpressure;
+	//Gates run side by side, each with its own windows. Empty for the single gate on stop 1 (rising opens, falling closes),
+	//otherwise the first gate decides when a shot of numWindows windows is over
+	std::vector<gateDefinition> gates;
+	//Prefix for the temporary files oversized windows spill to
+	std::string spillPrefix;
+	//Local port serving pipeline metrics, 0 to leave it off
+	uint16_t metricsPort;
+	//Name of the shared memory ring windows are published to, empty to leave it off
+	std::string shmRingName;
+	uint64_t shmRingBytes;
+	//Where a summary of each shot is pushed as it ends, tcp:port or unix:path, empty to leave it off
+	std::string publishAddress;
+	//HDF5 file running statistics over shots are flushed to every statsEvery shots, empty to leave them off. Shots are
+	//gathered under statsKey, or the name of the run's file when that is empty
+	std::string statsFile;
+	std::string statsKey;
+	uint32_t statsEvery;
+	//Sidecar index of where each window is stored, empty to leave it off. With an index every shot is kept in a file of
+	//its own, named after blackhole with the run and shot numbers before the extension
+	std::string indexFile;
+	//Gate holding the reference windows the OD of the first gate's windows is taken against, 0 for no OD
+	uint32_t odReferenceGate;
+	ingestBackend ingest;
+	//TTMDataFormat_t the tagger sends tags in, packets are decoded by whatever format their header gives
+	uint8_t dataFormat;
+	//Skip tags outside the gate at decode time rather than decoding everything
+	bool gatedDecode;
+	//Per stop input cable delays subtracted from the tags before windowing, empty for none
+	std::string calibrationFile;
+	//Software dead time of each tag channel in ticks, all 0 to leave the filter out
+	uint64_t deadTimeTicks[8];
+	bool deadTimeRetrigger;
+	//Keep only photon counts per window, channel and bin (countBins bins of countBinTicks from the gate opening, the
+	//last bin takes everything after) rather than every tag
+	bool countsOnly;
+	uint32_t countBins;
+	uint64_t countBinTicks;
+	//Coincidences counted in each window, groups of coincMin to coincMax tags on the coincidence channels (bit n for tag
+	//channel n) within coincWindowTicks of the first tag of the group. 0 ticks to leave the counting out
+	uint64_t coincWindowTicks;
+	uint32_t coincMin;
+	uint32_t coincMax;
+	uint8_t coincChannelMask;
+	//Keep the tags taking part in each coincidence as well as the counts
+	bool coincTags;
+	//Local UDP port the tagger is told to send data to and every receiver listens on
+	uint16_t dataPort;
+	uint32_t receiveBufferBytes;
+	//Busy poll the socket for this long before sleeping, 0 to always sleep
+	uint32_t busyPollMicros;
+	//Interface the capture ring listens on and the ring size in bytes
+	std::string captureInterface;
+	uint32_t captureRingBytes;
+	//Benchmark run in place of the acquisition, empty for a normal run
+	std::string benchmarkName;
+	uint32_t benchmarkSeconds;
+	//False when the tagger is started and configured by something else (another program or a simulator)
+	bool vendorControl;
+	//Local port taking run commands, the tagger then stays connected between runs. 0 for a single run
+	uint16_t daemonPort;
+};
+
+//Tagger settings that can be changed between shots while the measurement keeps running
+struct liveSettings {
+	std::vector<uint16_t> channelVect;
+	uint16_t clockLine;
+	//Thresholds in mV for the start input, stops 1..8 and the external clock, as taken by SetTriggerLevel
+	int32_t triggerLevels[10];
+	//Delays in ticks (0..255) for stops 1..8, index 0 is unused, as taken by SetChannelDelay
+	int channelDelays[9];
+};
@@ -0,0 +1,627 @@
+// benchmark.cpp : Benchmarks of the pipeline stages, run in place of an acquisition with --benchmark=name
+//
+
+#include "stdafx.h"
+#include "benchmark.h"
+#include "pipelineMetrics.h"
+#include "tagDecoder.h"
+#include "coincidenceCounter.h"
+#include "chunkCompression.h"
+#include "tagWriter.h"
+#include "workPool.h"
+#include "calibration.h"
+#include "deadTimeFilter.h"
+#include "TTMLib.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <random>
+#include <thread>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//CPU time used by the whole process so far in seconds
+static double processCpuSeconds()
+{
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user);
+	//FILETIMEs count 100ns ticks
+	uint64_t ticks = ((uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) + ((uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime);
+	return ticks / 1e7;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+static const char *ingestName(ingestBackend ingest)
+{
+	switch (ingest) {
+	case ingestRecvmmsg:
+		return "recvmmsg";
+	case ingestTpacket:
+		return "tpacket";
+	default:
+		return "vendor";
+	}
+}
+
+void ingestBenchmark(packetSource *source, const acquisitionOptions *options)
+{
+	decoderState decoder;
+	initDecoderState(&decoder);
+	tagColumns block;
+	uint64_t packets = 0;
+	uint64_t tags = 0;
+	uint64_t bytes = 0;
+	std::chrono::steady_clock::time_point first;
+	std::chrono::steady_clock::time_point last;
+	double cpuStart = 0;
+	std::cout << "ingest benchmark (" << ingestName(options->ingest) << "), waiting for packets..." << std::endl;
+	for (;;) {
+		if (!source->waitForData(1000)) {
+			//Until the sender has started we keep waiting, after that a quiet second ends the run
+			if (packets != 0) {
+				break;
+			}
+			continue;
+		}
+		if (packets == 0) {
+			first = std::chrono::steady_clock::now();
+			cpuStart = processCpuSeconds();
+		}
+		const TTMDataPacket_t *tagBuffer;
+		while ((tagBuffer = source->nextPacket()) != NULL) {
+			recordPacket(tagBuffer);
+			decodeTags(tagBuffer, &decoder, &block);
+			packets++;
+			tags += block.times.size();
+			bytes += tagBuffer->Header.DataSize;
+		}
+		last = std::chrono::steady_clock::now();
+		if (last - first >= std::chrono::seconds(options->benchmarkSeconds)) {
+			break;
+		}
+	}
+	double cpuSeconds = processCpuSeconds() - cpuStart;
+	double seconds = std::chrono::duration<double>(last - first).count();
+	if (packets == 0 || seconds <= 0) {
+		std::cout << "no packets received" << std::endl;
+		return;
+	}
+	uint64_t lost = metrics.packetsLost.load();
+	uint64_t batches = metrics.receiveBatches.load();
+	std::cout << "packets " << packets << ", lost " << lost << " (" << 100.0 * lost / (packets + lost) << "%), rejected " << metrics.packetsRejected.load() << std::endl;
+	std::cout << "tags " << tags << " over " << seconds << "s" << std::endl;
+	std::cout << "throughput " << packets / seconds << " packets/s, " << tags / seconds / 1e6 << " Mtags/s, " << bytes * 8 / seconds / 1e6 << " Mbit/s" << std::endl;
+	std::cout << "packets per receive call " << (double)packets / (batches != 0 ? batches : 1) << std::endl;
+	std::cout << "cpu " << cpuSeconds * 1e9 / packets << " ns/packet, " << cpuSeconds * 1e9 / (tags != 0 ? tags : 1) << " ns/tag (" << 100.0 * cpuSeconds / seconds << "% of a core)" << std::endl;
+}
+
+//Tags of the vendor filter's output packets, flat packets hold one tag per 8 bytes and packed ones a low word per tag
+static uint64_t vendorPacketTags(const TTMDataPacket_t *packet)
+{
+	if (packet->Header.DataFormat == TTFormat_MultiIMode_EXT64_FLAT || packet->Header.DataFormat == TTFormat_IMode_EXT64_FLAT) {
+		return packet->Header.DataSize / 8;
+	}
+	const uint32_t *words = (const uint32_t *)packet->Data.RawTime32;
+	uint64_t tags = 0;
+	for (size_t w = 0; w < packet->Header.DataSize / 4u; w++) {
+		tags += (words[w] >> 31) == 0;
+	}
+	return tags;
+}
+
+void coincidenceBenchmark(const acquisitionOptions *options)
+{
+	//The vendor filter's default window if none was given
+	uint64_t windowTicks = options->coincWindowTicks != 0 ? options->coincWindowTicks : 61;
+	std::vector<uint8_t> channels;
+	for (int channel = 0; channel < 8; channel++) {
+		if (options->coincChannelMask >> channel & 1) {
+			channels.push_back((uint8_t)channel);
+		}
+	}
+	if (channels.empty()) {
+		std::cout << "no coincidence channels" << std::endl;
+		return;
+	}
+	//Background photons a few windows apart on average, with a tenth of them the start of a burst on several channels
+	const size_t numTags = 8 * 1024 * 1024;
+	std::mt19937_64 random(1);
+	std::exponential_distribution<double> gap(1.0 / (4.0 * windowTicks));
+	std::uniform_int_distribution<size_t> pickChannel(0, channels.size() - 1);
+	std::uniform_int_distribution<uint32_t> burstSize(2, 4);
+	std::uniform_int_distribution<uint64_t> burstSpread(0, windowTicks / 4);
+	std::uniform_real_distribution<double> uniform(0, 1);
+	tagColumns stream;
+	uint64_t time = 0;
+	while (stream.times.size() < numTags) {
+		time += 1 + (uint64_t)gap(random);
+		uint32_t tagsHere = uniform(random) < 0.1 ? burstSize(random) : 1;
+		for (uint32_t t = 0; t < tagsHere; t++) {
+			time += t == 0 ? 0 : burstSpread(random) / tagsHere;
+			stream.times.push_back(time);
+			stream.edges.push_back((uint8_t)(channels[pickChannel(random)] << 1 | 1));
+		}
+	}
+	std::cout << "coincidence benchmark, " << stream.times.size() << " tags, window " << windowTicks << " ticks, " << options->coincMin << " to " << options->coincMax << " tags" << std::endl;
+	//Native counter, fed a packet's worth of tags at a time as the decode loop would
+	const size_t blockTags = 4096;
+	coincidenceCounter counter;
+	initCoincidenceCounter(&counter, windowTicks, options->coincMin, options->coincMax, options->coincChannelMask, true);
+	coincidenceResult result;
+	result.groups = 0;
+	//Room for every tag up front, so the timing is of the counting rather than of growing the result
+	result.tags.times.reserve(stream.times.size());
+	result.tags.edges.reserve(stream.times.size());
+	tagColumns block;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t first = 0; first < stream.times.size(); first += blockTags) {
+		size_t last = std::min(first + blockTags, stream.times.size());
+		block.times.assign(stream.times.begin() + first, stream.times.begin() + last);
+		block.edges.assign(stream.edges.begin() + first, stream.edges.begin() + last);
+		countCoincidences(&counter, &block, &result);
+	}
+	endCoincidenceGroup(&counter, &result);
+	double nativeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	uint64_t nativeTags = result.tags.times.size();
+	//Vendor filter on the same stream as a single board
+	std::vector<MultiBoardTimetagI64> vendorTags(blockTags);
+	uint8_t channelMask[16] = { 0 };
+	channelMask[0] = options->coincChannelMask;
+	MultiTTMCoincCntFilter_c *filter = new MultiTTMCoincCntFilter_c(options->coincMin, options->coincMax, (int)windowTicks, channelMask);
+	TTMDataPacket_t *passed = new TTMDataPacket_t;
+	uint64_t vendorTagsPassed = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t first = 0; first < stream.times.size(); first += blockTags) {
+		size_t last = std::min(first + blockTags, stream.times.size());
+		for (size_t i = first; i < last; i++) {
+			vendorTags[i - first].Time = stream.times[i];
+			vendorTags[i - first].Slope = edgeSlope(stream.edges[i]);
+			vendorTags[i - first].Channel = edgeChannel(stream.edges[i]);
+			vendorTags[i - first].BoardID = 0;
+		}
+		filter->AddCoincEvents(&vendorTags[0], (int)(last - first));
+		while (filter->CoincEventsAvailable() && filter->GetCoincEvents(passed) == FlexIO_Success) {
+			vendorTagsPassed += vendorPacketTags(passed);
+		}
+	}
+	filter->Flush();
+	while (filter->CoincEventsAvailable() && filter->GetCoincEvents(passed) == FlexIO_Success) {
+		vendorTagsPassed += vendorPacketTags(passed);
+	}
+	double vendorSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	delete passed;
+	delete filter;
+	std::cout << "native " << stream.times.size() / nativeSeconds / 1e6 << " Mtags/s (" << nativeSeconds * 1e9 / stream.times.size() << " ns/tag), " << result.groups << " coincidences, " << nativeTags << " tags passed" << std::endl;
+	std::cout << "vendor " << stream.times.size() / vendorSeconds / 1e6 << " Mtags/s (" << vendorSeconds * 1e9 / stream.times.size() << " ns/tag), " << vendorTagsPassed << " tags passed" << std::endl;
+	if (vendorTagsPassed != nativeTags) {
+		std::cout << "the filters disagree on " << (int64_t)(nativeTags - vendorTagsPassed) << " tags" << std::endl;
+	}
+}
+
+//Photons on tag channels 1 to 4 a few hundred ticks apart with an edge of the clock line every 16 photons, spanning
+//several high words of the packed formats. The same stream for the same number of tags, so benchmarks compare
+static void syntheticPhotonStream(size_t numTags, uint16_t clockLine, tagColumns *tags)
+{
+	std::mt19937_64 random(1);
+	std::exponential_distribution<double> gap(1.0 / 300.0);
+	std::uniform_int_distribution<uint32_t> pickChannel(1, 4);
+	tags->times.clear();
+	tags->edges.clear();
+	tags->times.reserve(numTags);
+	tags->edges.reserve(numTags);
+	uint64_t time = 0;
+	for (size_t t = 0; t < numTags; t++) {
+		time += 1 + (uint64_t)gap(random);
+		tags->times.push_back(time);
+		tags->edges.push_back((uint8_t)((t % 16 == 0 ? clockLine - 1 : pickChannel(random)) << 1 | 1));
+	}
+}
+
+//Check a dataset written by the benchmark reads back as the words that went in
+static bool wordsReadBack(H5::H5File *file, const std::string &datasetName, const std::vector<uint32_t> &words)
+{
+	H5::DataSet dset = file->openDataSet(datasetName);
+	if ((size_t)dset.getSpace().getSimpleExtentNpoints() != words.size()) {
+		return false;
+	}
+	std::vector<uint32_t> stored(words.size());
+	dset.read(&stored[0], H5::PredType::NATIVE_UINT32);
+	return stored == words;
+}
+
+void writeBenchmark(const acquisitionOptions *options)
+{
+	int level = options->compressLevel != 0 ? options->compressLevel : 1;
+	unsigned workers = options->postWorkers != 0 ? options->postWorkers : std::max(1u, std::thread::hardware_concurrency());
+	//Windows cut from the synthetic photon stream, packed as they would be written
+	const size_t numWindows = 32;
+	const size_t tagsPerWindow = 512 * 1024;
+	tagColumns tags;
+	syntheticPhotonStream(numWindows * tagsPerWindow, options->clockLine, &tags);
+	std::vector<std::vector<uint32_t>> windowWords(numWindows);
+	size_t rawBytes = 0;
+	for (size_t w = 0; w < numWindows; w++) {
+		uint32_t highWord = 0;
+		encodeTagWords(&tags, w * tagsPerWindow, (w + 1) * tagsPerWindow, &highWord, &windowWords[w]);
+		rawBytes += windowWords[w].size() * sizeof(uint32_t);
+	}
+	tags = tagColumns();
+	std::cout << "write benchmark, " << numWindows << " windows of " << tagsPerWindow << " tags (" << rawBytes / 1e6 << " MB), zlib level " << level << ", " << workers << " workers" << std::endl;
+	std::string singleName = "writeBenchmarkSingle.h5";
+	std::string parallelName = "writeBenchmarkParallel.h5";
+	//HDF5 deflating every chunk inside the write, as the writer does without post-processing workers
+	H5::H5File *file = new H5::H5File(singleName, H5F_ACC_TRUNC);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t w = 0; w < numWindows; w++) {
+		writeTagWords(file, "Tags" + std::to_string(w), windowWords[w], NULL, level);
+	}
+	file->flush(H5F_SCOPE_GLOBAL);
+	double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	delete file;
+	//Workers deflating whole windows while the writer stores the chunks of the windows already done, in order
+	std::vector<std::vector<compressedChunk>> windowChunks(numWindows);
+	std::vector<std::promise<void>> compressed(numWindows);
+	workPool *pool = new workPool(workers);
+	file = new H5::H5File(parallelName, H5F_ACC_TRUNC);
+	start = std::chrono::steady_clock::now();
+	for (size_t w = 0; w < numWindows; w++) {
+		pool->submit([&windowWords, &windowChunks, &compressed, level, w]() {
+			compressWords(windowWords[w], level, &windowChunks[w]);
+			compressed[w].set_value();
+		});
+	}
+	size_t storedBytes = 0;
+	for (size_t w = 0; w < numWindows; w++) {
+		compressed[w].get_future().wait();
+		writeTagWords(file, "Tags" + std::to_string(w), windowWords[w], &windowChunks[w], level);
+		for (size_t c = 0; c < windowChunks[w].size(); c++) {
+			storedBytes += windowChunks[w][c].bytes.size();
+		}
+	}
+	file->flush(H5F_SCOPE_GLOBAL);
+	double parallelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	delete pool;
+	//Both ways have to give the words back through the ordinary filter pipeline
+	size_t badWindows = 0;
+	H5::H5File *single = new H5::H5File(singleName, H5F_ACC_RDONLY);
+	for (size_t w = 0; w < numWindows; w++) {
+		badWindows += !wordsReadBack(single, "Tags" + std::to_string(w), windowWords[w]);
+		badWindows += !wordsReadBack(file, "Tags" + std::to_string(w), windowWords[w]);
+	}
+	delete single;
+	delete file;
+	std::remove(singleName.c_str());
+	std::remove(parallelName.c_str());
+	std::cout << "single threaded " << rawBytes / singleSeconds / 1e6 << " MB/s (" << singleSeconds << " s)" << std::endl;
+	std::cout << "parallel " << rawBytes / parallelSeconds / 1e6 << " MB/s (" << parallelSeconds << " s), " << singleSeconds / parallelSeconds << "x" << std::endl;
+	std::cout << "compression ratio " << (double)rawBytes / storedBytes << std::endl;
+	if (badWindows != 0) {
+		std::cout << badWindows << " datasets did not read back as written" << std::endl;
+	}
+}
+
+//Largest payload the tagger puts in a packet
+const size_t packetDataBytes = 8192;
+
+//Pack tags into packets of one data format, a packed format repeats the high word at the start of every packet so each
+//packet decodes on its own as the tagger's do
+template <TTMDataFormat_t format>
+static void encodePackets(const tagColumns *tags, std::vector<TTMDataPacket_t *> *packets)
+{
+	typedef tagFormat<format> layout;
+	typedef typename layout::word word;
+	const uint64_t timeMask = ((uint64_t)1 << layout::timeBits) - 1;
+	TTMDataPacket_t *packet = NULL;
+	size_t numWords = 0;
+	uint64_t highWord = 0;
+	for (size_t i = 0; i < tags->times.size(); i++) {
+		uint64_t time = tags->times[i];
+		bool newHigh = layout::packed && (packet == NULL || numWords == 0 || time >> layout::timeBits != highWord);
+		size_t wordsNeeded = newHigh ? 2 : 1;
+		if (packet == NULL || (numWords + wordsNeeded) * sizeof(word) > packetDataBytes) {
+			packet = new TTMDataPacket_t;
+			memset(&packet->Header, 0, sizeof(packet->Header));
+			packet->Header.DataFormat = format;
+			packets->push_back(packet);
+			numWords = 0;
+			newHigh = layout::packed;
+		}
+		word *words = (word *)packet->Data.RawData;
+		if (newHigh) {
+			highWord = time >> layout::timeBits;
+			words[numWords++] = (word)((highWord & 0x7FFFFFFF) | 0x80000000u);
+		}
+		words[numWords++] = (word)(((uint64_t)tags->edges[i] << layout::timeBits) | (time & timeMask));
+		packet->Header.DataSize = (uint16_t)(numWords * sizeof(word));
+	}
+}
+
+//Decode the packets of one format a few times over and report how it went
+template <TTMDataFormat_t format>
+static void benchmarkFormat(const char *name, const tagColumns *tags)
+{
+	std::vector<TTMDataPacket_t *> packets;
+	encodePackets<format>(tags, &packets);
+	uint64_t bytes = 0;
+	for (size_t p = 0; p < packets.size(); p++) {
+		bytes += packets[p]->Header.DataSize + sizeof(TTMDataHeader_t);
+	}
+	const int passes = 20;
+	tagColumns block;
+	uint64_t decoded = 0;
+	bool matches = true;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < passes; pass++) {
+		decoderState decoder;
+		initDecoderState(&decoder);
+		size_t next = 0;
+		for (size_t p = 0; p < packets.size(); p++) {
+			decodeTags(packets[p], &decoder, &block);
+			decoded += block.times.size();
+			//Checked on the first pass only, so the others time the decoding alone
+			if (pass == 0) {
+				for (size_t i = 0; i < block.times.size() && matches; i++, next++) {
+					matches = block.times[i] == tags->times[next] && block.edges[i] == tags->edges[next];
+				}
+			}
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	for (size_t p = 0; p < packets.size(); p++) {
+		delete packets[p];
+	}
+	std::cout << name << ": " << decoded / seconds / 1e6 << " Mtags/s (" << seconds * 1e9 / decoded << " ns/tag), ";
+	std::cout << (double)bytes / tags->times.size() << " network bytes/tag in " << packets.size() << " packets";
+	if (!matches || decoded != (uint64_t)passes * tags->times.size()) {
+		std::cout << ", DECODED TAGS DIFFER";
+	}
+	std::cout << std::endl;
+}
+
+void formatBenchmark(const acquisitionOptions *options)
+{
+	const size_t numTags = 2 * 1024 * 1024;
+	tagColumns tags;
+	syntheticPhotonStream(numTags, options->clockLine, &tags);
+	std::cout << "format benchmark, " << numTags << " tags over " << tags.times.back() * 82.3045e-12 << " s" << std::endl;
+	benchmarkFormat<TTFormat_IMode_EXT64_PACK>("pack", &tags);
+	benchmarkFormat<TTFormat_IMode_EXT64_FLAT>("flat", &tags);
+	benchmarkFormat<TTFormat_MultiIMode_EXT64_PACK>("multi-pack", &tags);
+	benchmarkFormat<TTFormat_MultiIMode_EXT64_FLAT>("multi-flat", &tags);
+}
+
+//Cost of one step over every packet of the benchmark stream
+struct stepCost {
+	double seconds;
+	uint64_t tagsIn;
+	uint64_t tagsOut;
+	//Times the output columns had to grow, after the first packet
+	uint64_t regrowths;
+};
+
+static void reportStep(const char *name, const char *output, const stepCost *vendor, const stepCost *native)
+{
+	std::cout << name << std::endl;
+	std::cout << "  vendor " << vendor->seconds * 1e9 / vendor->tagsIn << " ns/tag, " << vendor->tagsOut << ' ' << output << " out, works in the caller's packets" << std::endl;
+	std::cout << "  native " << native->seconds * 1e9 / native->tagsIn << " ns/tag, " << native->tagsOut << ' ' << output << " out, columns grew " << native->regrowths << " times";
+	if (vendor->tagsOut != native->tagsOut) {
+		std::cout << ", DIFFERENT COUNTS";
+	}
+	std::cout << std::endl;
+}
+
+static void addTime(stepCost *cost, std::chrono::steady_clock::time_point start)
+{
+	cost->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Count a step's output columns growing, which is where the native steps allocate
+static void countRegrowth(stepCost *cost, size_t packet, size_t *capacity, size_t newCapacity)
+{
+	if (packet != 0 && newCapacity != *capacity) {
+		cost->regrowths++;
+	}
+	*capacity = newCapacity;
+}
+
+//Native counterpart of ChannelExchange, relabelling edges through a table and dropping those mapped to -1
+static void exchangeEdges(tagColumns *block, const int16_t rule[16])
+{
+	size_t kept = 0;
+	for (size_t i = 0; i < block->times.size(); i++) {
+		int16_t edge = rule[block->edges[i] & 15];
+		if (edge >= 0) {
+			block->times[kept] = block->times[i];
+			block->edges[kept] = (uint8_t)edge;
+			kept++;
+		}
+	}
+	block->times.resize(kept);
+	block->edges.resize(kept);
+}
+
+void vendorHelperBenchmark(const acquisitionOptions *options)
+{
+	//The same photon stream as the format benchmark, packed as the tagger sends it
+	const size_t numTags = 2 * 1024 * 1024;
+	tagColumns tags;
+	syntheticPhotonStream(numTags, options->clockLine, &tags);
+	std::vector<TTMDataPacket_t *> packed;
+	encodePackets<TTFormat_IMode_EXT64_PACK>(&tags, &packed);
+	size_t numPackets = packed.size();
+	std::cout << "vendor helper benchmark, " << numTags << " tags in " << numPackets << " packets" << std::endl;
+	//Each helper's input and output, the flat packets and decoded blocks are kept as the input of the later steps
+	std::vector<TTMDataPacket_t *> flat(numPackets);
+	std::vector<tagColumns> blocks(numPackets);
+	TTMDataPacket_t *out = new TTMDataPacket_t;
+	tagColumns work;
+	std::vector<uint32_t> words;
+	std::chrono::steady_clock::time_point start;
+
+	//Packed words to flat tags or to columns
+	stepCost vendor = stepCost();
+	stepCost native = stepCost();
+	uint64_t timeHigh = TTMData_c::TimeHighUndefined;
+	decoderState decoder;
+	initDecoderState(&decoder);
+	size_t capacity = 0;
+	for (size_t p = 0; p < numPackets; p++) {
+		flat[p] = new TTMDataPacket_t;
+		start = std::chrono::steady_clock::now();
+		TTMData_c::ExpandData(flat[p], packed[p], &timeHigh);
+		addTime(&vendor, start);
+		vendor.tagsOut += flat[p]->Header.DataSize / 8;
+		//Decoded into the same columns every time, as the acquisition does
+		start = std::chrono::steady_clock::now();
+		decodeTags(packed[p], &decoder, &work);
+		addTime(&native, start);
+		native.tagsOut += work.times.size();
+		countRegrowth(&native, p, &capacity, work.times.capacity());
+		blocks[p] = work;
+	}
+	vendor.tagsIn = native.tagsIn = numTags;
+	reportStep("ExpandData / decodeTags", "tags", &vendor, &native);
+
+	//Back to packed words
+	vendor = stepCost();
+	native = stepCost();
+	timeHigh = TTMData_c::TimeHighUndefined;
+	uint32_t highWord = 0xFFFFFFFF;
+	capacity = 0;
+	for (size_t p = 0; p < numPackets; p++) {
+		start = std::chrono::steady_clock::now();
+		TTMData_c::CompressData(out, flat[p], &timeHigh);
+		addTime(&vendor, start);
+		vendor.tagsOut += out->Header.DataSize / 4;
+		start = std::chrono::steady_clock::now();
+		words.clear();
+		encodeTagWords(&blocks[p], 0, blocks[p].times.size(), &highWord, &words);
+		addTime(&native, start);
+		native.tagsOut += words.size();
+		countRegrowth(&native, p, &capacity, words.capacity());
+	}
+	vendor.tagsIn = native.tagsIn = numTags;
+	reportStep("CompressData / encodeTagWords", "words", &vendor, &native);
+
+	//Cable delays, the native step also puts the block back into time order
+	vendor = stepCost();
+	native = stepCost();
+	int32_t offsetTicks[16];
+	TTMPortCableOffset_t cableOffsets;
+	memset(&cableOffsets, 0, sizeof(cableOffsets));
+	for (int stop = 0; stop < 8; stop++) {
+		cableOffsets.IMode[stop][0] = 3 * stop;
+		cableOffsets.IMode[stop][1] = 3 * stop + 1;
+		//TimeShiftEvents adds its offsets, with rising edges of stop 1..8 first and the falling ones after
+		offsetTicks[stop] = -cableOffsets.IMode[stop][0];
+		offsetTicks[stop + 8] = -cableOffsets.IMode[stop][1];
+	}
+	edgeCorrections corrections;
+	setEdgeCorrections(&corrections, &cableOffsets);
+	capacity = 0;
+	for (size_t p = 0; p < numPackets; p++) {
+		start = std::chrono::steady_clock::now();
+		TTMData_c::TimeShiftEvents(out, flat[p], offsetTicks);
+		addTime(&vendor, start);
+		vendor.tagsOut += out->Header.DataSize / 8;
+		work = blocks[p];
+		start = std::chrono::steady_clock::now();
+		correctTagTimes(&work, &corrections);
+		addTime(&native, start);
+		native.tagsOut += work.times.size();
+		countRegrowth(&native, p, &capacity, work.times.capacity());
+	}
+	//The tail held back for a next packet that never comes
+	work.times.clear();
+	work.edges.clear();
+	releaseHeldTags(&work, &corrections);
+	native.tagsOut += work.times.size();
+	vendor.tagsIn = native.tagsIn = numTags;
+	reportStep("TimeShiftEvents / correctTagTimes", "tags", &vendor, &native);
+
+	//Dead time on every channel, either slope
+	vendor = stepCost();
+	native = stepCost();
+	//The longest dead time given, or about 80ns without one
+	uint64_t deadTicks = *std::max_element(options->deadTimeTicks, options->deadTimeTicks + 8);
+	if (deadTicks == 0) {
+		deadTicks = 1000;
+	}
+	uint64_t vendorDead[16];
+	uint64_t previousEvent[16];
+	uint64_t nativeDead[8];
+	for (int i = 0; i < 16; i++) {
+		vendorDead[i] = deadTicks;
+		previousEvent[i] = TTMData_c::TimeHighUndefined;
+	}
+	for (int channel = 0; channel < 8; channel++) {
+		nativeDead[channel] = deadTicks;
+	}
+	deadTimeFilter deadTime;
+	initDeadTimeFilter(&deadTime, nativeDead, options->deadTimeRetrigger);
+	capacity = 0;
+	for (size_t p = 0; p < numPackets; p++) {
+		start = std::chrono::steady_clock::now();
+		TTMData_c::RemoveDuplicateEvents(out, flat[p], previousEvent, vendorDead, options->deadTimeRetrigger);
+		addTime(&vendor, start);
+		vendor.tagsOut += out->Header.DataSize / 8;
+		work = blocks[p];
+		start = std::chrono::steady_clock::now();
+		filterDeadTime(&work, &deadTime);
+		addTime(&native, start);
+		native.tagsOut += work.times.size();
+		countRegrowth(&native, p, &capacity, work.times.capacity());
+	}
+	vendor.tagsIn = native.tagsIn = numTags;
+	std::cout << "(dead time " << deadTicks << " ticks" << (options->deadTimeRetrigger ? ", retriggering)" : ")") << std::endl;
+	reportStep("RemoveDuplicateEvents / filterDeadTime", "tags", &vendor, &native);
+
+	//Stops 3 and 4 swapped and stop 5 dropped, as a rewired input would need
+	vendor = stepCost();
+	native = stepCost();
+	int16_t vendorRule[256];
+	int16_t nativeRule[16];
+	for (int edge = 0; edge < 256; edge++) {
+		vendorRule[edge] = (int16_t)edge;
+	}
+	for (int slope = 0; slope < 2; slope++) {
+		vendorRule[2 << 1 | slope] = (int16_t)(3 << 1 | slope);
+		vendorRule[3 << 1 | slope] = (int16_t)(2 << 1 | slope);
+		vendorRule[4 << 1 | slope] = -1;
+	}
+	for (int edge = 0; edge < 16; edge++) {
+		nativeRule[edge] = vendorRule[edge];
+	}
+	capacity = 0;
+	for (size_t p = 0; p < numPackets; p++) {
+		start = std::chrono::steady_clock::now();
+		TTMData_c::ChannelExchange(out, flat[p], vendorRule);
+		addTime(&vendor, start);
+		vendor.tagsOut += out->Header.DataSize / 8;
+		work = blocks[p];
+		start = std::chrono::steady_clock::now();
+		exchangeEdges(&work, nativeRule);
+		addTime(&native, start);
+		native.tagsOut += work.times.size();
+		countRegrowth(&native, p, &capacity, work.times.capacity());
+	}
+	vendor.tagsIn = native.tagsIn = numTags;
+	reportStep("ChannelExchange / edge table", "tags", &vendor, &native);
+
+	delete out;
+	for (size_t p = 0; p < numPackets; p++) {
+		delete packed[p];
+		delete flat[p];
+	}
+}
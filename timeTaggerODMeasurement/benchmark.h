@@ -0,0 +1,29 @@
+// benchmark.h : Benchmarks of the pipeline stages, run in place of an acquisition with --benchmark=name
+//
+
+#pragma once
+
+#include "acquisitionOptions.h"
+#include "packetSource.h"
+
+//Receive and decode whatever the source delivers, from the first packet until it has been quiet for a second or
+//benchmarkSeconds have passed, and report throughput, loss and CPU cost per packet for the chosen ingest backend
+void ingestBenchmark(packetSource *source, const acquisitionOptions *options);
+
+//Count coincidences on a synthetic photon stream with the native counter and with the vendor MultiTTMCoincCntFilter_c
+//using the coincidence options, and compare their throughput and the tags they pass. Needs no tagger
+void coincidenceBenchmark(const acquisitionOptions *options);
+
+//Write synthetic windows of tag words deflated at compressLevel (1 if 0) twice, once with HDF5 deflating each chunk
+//on the writing thread and once compressed on postWorkers threads (one per core if 0) and stored with direct chunk
+//writes, and compare the write bandwidth of the two. Needs no tagger
+void writeBenchmark(const acquisitionOptions *options);
+
+//Pack a synthetic photon stream into packets of each I-Mode continuous data format and decode them with the decoder
+//picked from the packet headers, reporting the decode cost and the network bytes per tag of each format. Needs no tagger
+void formatBenchmark(const acquisitionOptions *options);
+
+//Run the TTMData_c packet helpers (ExpandData, CompressData, TimeShiftEvents, RemoveDuplicateEvents, ChannelExchange)
+//on synthetic packets next to the native steps doing the same on tag columns, and report the cost per tag of each and
+//how often the native columns had to grow. Needs no tagger
+void vendorHelperBenchmark(const acquisitionOptions *options);
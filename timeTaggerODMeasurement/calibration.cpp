@@ -0,0 +1,123 @@
+// calibration.cpp : Cable and input delay corrections, loaded from a calibration file and applied to decoded tags
+//
+
+#include "stdafx.h"
+#include "calibration.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+bool loadCableOffsets(const std::string &path, TTMPortCableOffset_t *offsets)
+{
+	memset(offsets, 0, sizeof(TTMPortCableOffset_t));
+	std::ifstream file(path);
+	if (!file) {
+		std::cout << "could not open calibration file " << path << std::endl;
+		return false;
+	}
+	std::string line;
+	int lineNum = 0;
+	while (std::getline(file, line)) {
+		lineNum++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		int stop;
+		int32_t rising;
+		int32_t falling;
+		if (!(fields >> stop)) {
+			continue;
+		}
+		if (!(fields >> rising >> falling) || stop < 1 || stop > 8) {
+			std::cout << path << ":" << lineNum << ": expected a stop input 1..8 and its rising and falling delays" << std::endl;
+			return false;
+		}
+		offsets->IMode[stop - 1][0] = rising;
+		offsets->IMode[stop - 1][1] = falling;
+	}
+	return true;
+}
+
+void setEdgeCorrections(edgeCorrections *corrections, const TTMPortCableOffset_t *offsets)
+{
+	//Tag channels count the stop inputs from 0, slope 1 is the rising edge
+	for (int channel = 0; channel < 8; channel++) {
+		corrections->ticks[2 * channel + 1] = offsets->IMode[channel][0];
+		corrections->ticks[2 * channel] = offsets->IMode[channel][1];
+	}
+	int64_t minTicks = corrections->ticks[0];
+	corrections->maxTicks = corrections->ticks[0];
+	for (int edge = 1; edge < 16; edge++) {
+		minTicks = std::min(minTicks, corrections->ticks[edge]);
+		corrections->maxTicks = std::max(corrections->maxTicks, corrections->ticks[edge]);
+	}
+	corrections->spreadTicks = corrections->maxTicks - minTicks;
+	corrections->held.times.clear();
+	corrections->held.edges.clear();
+}
+
+void correctTagTimes(tagColumns *block, edgeCorrections *corrections)
+{
+	size_t numTags = block->times.size();
+	if (numTags == 0) {
+		return;
+	}
+	//Tags come in time order, so no tag of a later block is before this
+	uint64_t lastTime = block->times[numTags - 1];
+	uint64_t *times = &block->times[0];
+	uint8_t *edges = &block->edges[0];
+	const int64_t *ticks = corrections->ticks;
+	//Kept as a plain indexed loop over the columns so the compiler turns it into a vector gather and add
+	for (size_t i = 0; i < numTags; i++) {
+		times[i] -= (uint64_t)ticks[edges[i] & 15];
+	}
+	//The same correction on every edge keeps the order as it is
+	if (corrections->spreadTicks == 0) {
+		return;
+	}
+	tagColumns *held = &corrections->held;
+	if (!held->times.empty()) {
+		block->times.insert(block->times.begin(), held->times.begin(), held->times.end());
+		block->edges.insert(block->edges.begin(), held->edges.begin(), held->edges.end());
+		numTags = block->times.size();
+		times = &block->times[0];
+		edges = &block->edges[0];
+	}
+	//Tags only move past each other by the spread of the corrections, so an insertion pass puts them back in order
+	//cheaply
+	for (size_t i = 1; i < numTags; i++) {
+		if (times[i] >= times[i - 1]) {
+			continue;
+		}
+		uint64_t time = times[i];
+		uint8_t edge = edges[i];
+		size_t j = i;
+		while (j > 0 && times[j - 1] > time) {
+			times[j] = times[j - 1];
+			edges[j] = edges[j - 1];
+			j--;
+		}
+		times[j] = time;
+		edges[j] = edge;
+	}
+	//A later tag is corrected to no earlier than lastTime - maxTicks, anything from there on waits for the next block
+	int64_t keepFrom = (int64_t)lastTime - corrections->maxTicks;
+	size_t release = numTags;
+	while (release > 0 && (int64_t)times[release - 1] >= keepFrom) {
+		release--;
+	}
+	held->times.assign(block->times.begin() + release, block->times.end());
+	held->edges.assign(block->edges.begin() + release, block->edges.end());
+	block->times.resize(release);
+	block->edges.resize(release);
+}
+
+void releaseHeldTags(tagColumns *block, edgeCorrections *corrections)
+{
+	tagColumns *held = &corrections->held;
+	block->times.insert(block->times.end(), held->times.begin(), held->times.end());
+	block->edges.insert(block->edges.end(), held->edges.begin(), held->edges.end());
+	held->times.clear();
+	held->edges.clear();
+}
@@ -0,0 +1,32 @@
+// calibration.h : Cable and input delay corrections, loaded from a calibration file and applied to decoded tags
+//
+
+#pragma once
+
+#include "tagDecoder.h"
+#include <string>
+
+//Correction for each edge (channel << 1 | slope) in ticks, subtracted from the tag times
+struct edgeCorrections {
+	int64_t ticks[16];
+	//Largest correction and how far the corrections spread, tags only move past each other by the spread
+	int64_t maxTicks;
+	int64_t spreadTicks;
+	//Corrected tags at the end of the last block that a tag of the next block could still come before, held back and
+	//merged into the next block
+	tagColumns held;
+};
+
+//Read I-Mode delays from a calibration file, one "stop rising falling" line per stop input (1..8) with the delays in
+//ticks, # starts a comment. Stops that are not listed keep a delay of 0
+bool loadCableOffsets(const std::string &path, TTMPortCableOffset_t *offsets);
+
+//Set the corrections from the delays, with no tags held back
+void setEdgeCorrections(edgeCorrections *corrections, const TTMPortCableOffset_t *offsets);
+
+//Subtract the corrections from a decoded block, ahead of windowing, and put the tags back into time order. Tags the
+//next block could still have to go before are held back from the end of the block and handed on with the next one
+void correctTagTimes(tagColumns *block, edgeCorrections *corrections);
+
+//Append the tags still held back to a block, for when no block will follow
+void releaseHeldTags(tagColumns *block, edgeCorrections *corrections);
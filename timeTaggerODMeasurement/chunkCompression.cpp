@@ -0,0 +1,45 @@
+// chunkCompression.cpp : Deflating tag word chunks off the writer thread, for direct chunk writes to HDF5
+//
+
+#include "stdafx.h"
+#include "chunkCompression.h"
+#include <algorithm>
+#include <zlib.h>
+
+size_t chunkWordsFor(size_t numWords)
+{
+	if (numWords == 0) {
+		return 1;
+	}
+	return numWords < compressedChunkWords ? numWords : compressedChunkWords;
+}
+
+bool compressWords(const std::vector<uint32_t> &words, int level, std::vector<compressedChunk> *chunks)
+{
+	chunks->clear();
+	if (words.size() < compressMinWords) {
+		return true;
+	}
+	size_t chunkWords = chunkWordsFor(words.size());
+	std::vector<uint32_t> padded;
+	for (size_t first = 0; first < words.size(); first += chunkWords) {
+		const uint32_t *source = &words[first];
+		if (first + chunkWords > words.size()) {
+			padded.assign(chunkWords, 0);
+			std::copy(words.begin() + first, words.end(), padded.begin());
+			source = &padded[0];
+		}
+		//zlib streams with their header are what the deflate filter reads back
+		uLong sourceBytes = (uLong)(chunkWords * sizeof(uint32_t));
+		uLongf compressedBytes = compressBound(sourceBytes);
+		compressedChunk chunk;
+		chunk.bytes.resize(compressedBytes);
+		if (compress2(&chunk.bytes[0], &compressedBytes, (const Bytef *)source, sourceBytes, level) != Z_OK) {
+			chunks->clear();
+			return false;
+		}
+		chunk.bytes.resize(compressedBytes);
+		chunks->push_back(std::move(chunk));
+	}
+	return true;
+}
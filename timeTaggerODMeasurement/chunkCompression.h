@@ -0,0 +1,26 @@
+// chunkCompression.h : Deflating tag word chunks off the writer thread, for direct chunk writes to HDF5
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+//Largest chunk tag words are stored in, 256kB of words
+const size_t compressedChunkWords = 65536;
+
+//Smaller datasets are stored as they are, the chunk index of a compressed dataset costs more than deflating them saves
+const size_t compressMinWords = 4096;
+
+//A chunk of words deflated as the HDF5 deflate filter would have done it, ready for H5DOwrite_chunk
+struct compressedChunk {
+	std::vector<uint8_t> bytes;
+};
+
+//Chunk size for a dataset of numWords words, small datasets are a single chunk of their own size
+size_t chunkWordsFor(size_t numWords);
+
+//Deflate words chunk by chunk at the given zlib level. HDF5 stores whole chunks, so the last one is padded with zeros.
+//Leaves no chunks for fewer than compressMinWords words, or if zlib fails on any chunk, in which case it returns false
+//and the words are left for the deflate filter to compress as they are written
+bool compressWords(const std::vector<uint32_t> &words, int level, std::vector<compressedChunk> *chunks);
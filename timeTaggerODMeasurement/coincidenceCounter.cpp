@@ -0,0 +1,38 @@
+// coincidenceCounter.cpp : Live coincidence counting on the tags of each window, as MultiTTMCoincCntFilter_c does
+//
+
+#include "stdafx.h"
+#include "coincidenceCounter.h"
+
+void initCoincidenceCounter(coincidenceCounter *counter, uint64_t windowTicks, uint32_t minCount, uint32_t maxCount, uint8_t channelMask, bool keepTags)
+{
+	counter->windowTicks = windowTicks;
+	counter->minCount = minCount;
+	counter->maxCount = maxCount;
+	counter->channelMask = channelMask;
+	counter->keepTags = keepTags;
+	counter->groupStart = 0;
+	counter->groupSize = 0;
+	counter->groupFirst = 0;
+}
+
+void endCoincidenceGroup(coincidenceCounter *counter, coincidenceResult *result)
+{
+	if (counter->groupSize >= counter->minCount && counter->groupSize <= counter->maxCount) {
+		result->groups++;
+	}
+	else if (counter->keepTags) {
+		//Not a coincidence, drop the tags it left in the result
+		result->tags.times.resize(counter->groupFirst);
+		result->tags.edges.resize(counter->groupFirst);
+	}
+	counter->groupSize = 0;
+}
+
+void countCoincidences(coincidenceCounter *counter, const tagColumns *block, coincidenceResult *result)
+{
+	size_t numTags = block->times.size();
+	for (size_t i = 0; i < numTags; i++) {
+		addCoincidenceTag(counter, block->times[i], block->edges[i], result);
+	}
+}
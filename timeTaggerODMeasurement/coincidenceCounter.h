@@ -0,0 +1,56 @@
+// coincidenceCounter.h : Live coincidence counting on the tags of each window, as MultiTTMCoincCntFilter_c does
+//
+
+#pragma once
+
+#include "tagDecoder.h"
+
+//A group starts at the first tag on one of the masked channels and takes every masked tag up to windowTicks after it.
+//Groups of minCount to maxCount tags are coincidences, the next group starts with the first tag after the window
+struct coincidenceCounter {
+	uint64_t windowTicks;
+	uint32_t minCount;
+	uint32_t maxCount;
+	//Tag channels taking part, bit n for channel n
+	uint8_t channelMask;
+	//Keep the tags of each coincidence as well as counting them
+	bool keepTags;
+	//Group being gathered, its tags are kept at the end of the result from groupFirst on until we know if it counts
+	uint64_t groupStart;
+	uint32_t groupSize;
+	size_t groupFirst;
+};
+
+//Coincidences found in a window
+struct coincidenceResult {
+	uint64_t groups;
+	tagColumns tags;
+};
+
+void initCoincidenceCounter(coincidenceCounter *counter, uint64_t windowTicks, uint32_t minCount, uint32_t maxCount, uint8_t channelMask, bool keepTags);
+
+//Close the group in progress, counting it into result if it is a coincidence
+void endCoincidenceGroup(coincidenceCounter *counter, coincidenceResult *result);
+
+//Feed the next tag in time order
+inline void addCoincidenceTag(coincidenceCounter *counter, uint64_t time, uint8_t edge, coincidenceResult *result)
+{
+	if ((counter->channelMask >> (edgeChannel(edge) & 7) & 1) == 0) {
+		return;
+	}
+	if (counter->groupSize != 0 && time - counter->groupStart > counter->windowTicks) {
+		endCoincidenceGroup(counter, result);
+	}
+	if (counter->groupSize == 0) {
+		counter->groupStart = time;
+		counter->groupFirst = result->tags.times.size();
+	}
+	counter->groupSize++;
+	if (counter->keepTags) {
+		result->tags.times.push_back(time);
+		result->tags.edges.push_back(edge);
+	}
+}
+
+//Find the coincidences in a block of tags on their own, outside of any window (for benchmarking)
+void countCoincidences(coincidenceCounter *counter, const tagColumns *block, coincidenceResult *result);
@@ -0,0 +1,300 @@
+// commandServer.cpp : Local command socket of the acquisition daemon, runs are started and stopped without reconnecting
+//
+
+#include "stdafx.h"
+#include "commandServer.h"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+static std::thread serverThread;
+static std::atomic<bool> serverRunning(false);
+static SOCKET listenSocket = INVALID_SOCKET;
+
+//Channels are comma separated as on the command line
+static bool parseChannels(const std::string &channels, std::vector<uint16_t> *channelVect, std::string *error)
+{
+	std::stringstream channelList(channels);
+	int channel;
+	while (channelList >> channel) {
+		if (channel < 1 || channel > 8) {
+			*error = "channels run from 1 to 8";
+			return false;
+		}
+		channelVect->push_back((uint16_t)channel);
+		if (channelList.peek() == ',') {
+			channelList.ignore();
+		}
+	}
+	return true;
+}
+
+//Stop input number following a setting name, such as the 3 of level3, 0 if there is none
+static int settingInput(const std::string &name, const std::string &prefix)
+{
+	if (name.size() != prefix.size() + 1 || name.compare(0, prefix.size(), prefix) != 0) {
+		return 0;
+	}
+	char input = name[prefix.size()];
+	return (input >= '1' && input <= '8') ? input - '0' : 0;
+}
+
+//Read the name=value changes of a set
+static bool parseSettings(std::istringstream &words, runCommand *command, std::string *error)
+{
+	std::string setting;
+	while (words >> setting) {
+		size_t equals = setting.find('=');
+		if (equals == std::string::npos) {
+			*error = "settings are given as name=value";
+			return false;
+		}
+		std::string name = setting.substr(0, equals);
+		std::string value = setting.substr(equals + 1);
+		int number = atoi(value.c_str());
+		int input = 0;
+		if (name == "channels") {
+			command->channelVect.clear();
+			if (!parseChannels(value, &command->channelVect, error)) {
+				return false;
+			}
+		}
+		else if (name == "clock") {
+			//Stop 1 is the gate
+			if (number < 2 || number > 8) {
+				*error = "the clock line is a stop input from 2 to 8";
+				return false;
+			}
+			command->clockLine = (uint16_t)number;
+		}
+		else if (name == "level" || (input = settingInput(name, "level")) != 0) {
+			//The range of the threshold DAC
+			if (number < -4096 || number > 4095) {
+				*error = "trigger levels run from -4096 to 4095 mV";
+				return false;
+			}
+			//On its own level sets the photon inputs, as the triggerLevel argument does
+			int first = name == "level" ? 2 : input;
+			int last = name == "level" ? 8 : input;
+			for (int i = first; i <= last; i++) {
+				command->triggerLevels[i] = number;
+				command->levelMask |= 1 << i;
+			}
+		}
+		else if ((input = settingInput(name, "delay")) != 0) {
+			if (number < 0 || number > 255) {
+				*error = "channel delays run from 0 to 255 ticks";
+				return false;
+			}
+			command->channelDelays[input] = number;
+			command->delayMask |= 1 << input;
+		}
+		else {
+			*error = "unknown setting " + name;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool parseCommand(const std::string &line, runCommand *command, std::string *error)
+{
+	std::istringstream words(line);
+	std::string verb;
+	words >> verb;
+	command->blackhole.clear();
+	command->numWindows = 0;
+	command->channelVect.clear();
+	command->clockLine = 0;
+	command->levelMask = 0;
+	command->delayMask = 0;
+	if (verb == "start") {
+		command->kind = commandStart;
+		std::string numWindows;
+		std::string channels;
+		words >> command->blackhole >> numWindows >> channels;
+		if (command->blackhole.empty()) {
+			*error = "start needs an output file";
+			return false;
+		}
+		if (!numWindows.empty()) {
+			command->numWindows = (uint16_t)atoi(numWindows.c_str());
+		}
+		if (!parseChannels(channels, &command->channelVect, error)) {
+			return false;
+		}
+	}
+	else if (verb == "set") {
+		command->kind = commandSet;
+		if (!parseSettings(words, command, error)) {
+			return false;
+		}
+	}
+	else if (verb == "stop") {
+		command->kind = commandStop;
+	}
+	else if (verb == "status") {
+		command->kind = commandStatus;
+	}
+	else if (verb == "quit") {
+		command->kind = commandQuit;
+	}
+	else {
+		*error = "unknown command " + verb;
+		return false;
+	}
+	return true;
+}
+
+//Post a command to the acquisition loop and wait for its answer
+static std::string submitCommand(commandSlot *slot, const runCommand &command)
+{
+	std::unique_lock<std::mutex> guard(slot->lock);
+	if (slot->closed) {
+		return "error daemon is shutting down";
+	}
+	slot->pending = command;
+	slot->posted = true;
+	slot->reply.clear();
+	wakeAcquisition(slot->events);
+	slot->answered.wait(guard, [slot] { return !slot->posted; });
+	return slot->reply;
+}
+
+bool takeCommand(commandSlot *slot, runCommand *command)
+{
+	std::lock_guard<std::mutex> guard(slot->lock);
+	if (!slot->posted) {
+		return false;
+	}
+	*command = slot->pending;
+	return true;
+}
+
+void answerCommand(commandSlot *slot, const std::string &reply)
+{
+	std::lock_guard<std::mutex> guard(slot->lock);
+	slot->reply = reply;
+	slot->posted = false;
+	slot->answered.notify_all();
+}
+
+void closeCommandSlot(commandSlot *slot)
+{
+	std::lock_guard<std::mutex> guard(slot->lock);
+	slot->closed = true;
+	if (slot->posted) {
+		slot->reply = "error daemon is shutting down";
+		slot->posted = false;
+		slot->answered.notify_all();
+	}
+}
+
+//Answer commands from one controller until it hangs up
+static void serveController(SOCKET client, commandSlot *slot)
+{
+	std::string received;
+	char buffer[1024];
+	while (serverRunning) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(client, &readable);
+		timeval timeout;
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		int ready = select((int)client + 1, &readable, NULL, NULL, &timeout);
+		if (ready <= 0) {
+			continue;
+		}
+		int length = recv(client, buffer, sizeof(buffer), 0);
+		if (length <= 0) {
+			break;
+		}
+		received.append(buffer, length);
+		size_t end;
+		while ((end = received.find('\n')) != std::string::npos) {
+			std::string line = received.substr(0, end);
+			received.erase(0, end + 1);
+			if (!line.empty() && line[line.size() - 1] == '\r') {
+				line.erase(line.size() - 1);
+			}
+			if (line.empty()) {
+				continue;
+			}
+			runCommand command;
+			std::string reply;
+			if (parseCommand(line, &command, &reply)) {
+				reply = submitCommand(slot, command);
+			}
+			else {
+				reply = "error " + reply;
+			}
+			reply += '\n';
+			send(client, reply.c_str(), (int)reply.size(), 0);
+		}
+	}
+	closesocket(client);
+}
+
+static void serverLoop(commandSlot *slot)
+{
+	while (serverRunning) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(listenSocket, &readable);
+		timeval timeout;
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		if (select((int)listenSocket + 1, &readable, NULL, NULL, &timeout) > 0 && FD_ISSET(listenSocket, &readable)) {
+			SOCKET client = accept(listenSocket, NULL, NULL);
+			if (client != INVALID_SOCKET) {
+				serveController(client, slot);
+			}
+		}
+	}
+}
+
+bool startCommandServer(uint16_t port, commandSlot *slot, acquisitionEvents *events)
+{
+#if defined(_WIN32)
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+	slot->posted = false;
+	slot->closed = false;
+	slot->events = events;
+	listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenSocket == INVALID_SOCKET) {
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const SockOpt_t *)&reuse, sizeof(reuse));
+	//Runs can only be started from this machine
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, 4) != 0) {
+		std::cout << "could not take commands on port " << port << std::endl;
+		closesocket(listenSocket);
+		listenSocket = INVALID_SOCKET;
+		return false;
+	}
+	serverRunning = true;
+	serverThread = std::thread(serverLoop, slot);
+	return true;
+}
+
+void stopCommandServer()
+{
+	if (!serverRunning) {
+		return;
+	}
+	serverRunning = false;
+	serverThread.join();
+	closesocket(listenSocket);
+	listenSocket = INVALID_SOCKET;
+}
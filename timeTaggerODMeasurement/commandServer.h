@@ -0,0 +1,70 @@
+// commandServer.h : Local command socket of the acquisition daemon, runs are started and stopped without reconnecting
+//
+
+#pragma once
+
+#include "acquisitionEvents.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//One command per line, each answered with a line starting "ok" or "error":
+//  start blackhole [numWindows [channels]]   begin writing shots, missing settings come from the command line
+//  stop                                      finish the shot in progress and close the run
+//  set [channels=a,b] [clock=N] [level=mV] [levelN=mV] [delayN=ticks]
+//                                            change stop inputs, clock line, trigger levels (level alone sets stops 2..8)
+//                                            and channel delays of stop N, taking effect at the end of the shot in progress
+//  status
+//  quit                                      stop any run and shut the daemon down
+enum commandKind {
+	commandStart,
+	commandStop,
+	commandSet,
+	commandStatus,
+	commandQuit
+};
+
+struct runCommand {
+	commandKind kind;
+	//Per-run settings of a start, empty or 0 where the daemon's own apply
+	std::string blackhole;
+	uint16_t numWindows;
+	std::vector<uint16_t> channelVect;
+	//Changes of a set, a clock line of 0 and clear mask bits leave the setting as it is
+	uint16_t clockLine;
+	uint32_t levelMask;
+	int32_t triggerLevels[10];
+	uint32_t delayMask;
+	int channelDelays[9];
+};
+
+//Commands are handed to the acquisition loop one at a time, the connection waits until the loop has answered
+struct commandSlot {
+	std::mutex lock;
+	std::condition_variable answered;
+	runCommand pending;
+	bool posted;
+	std::string reply;
+	//Set once the loop has finished, later commands are turned away
+	bool closed;
+	//Loop to wake when a command is posted
+	acquisitionEvents *events;
+};
+
+//Read a command line, false with the reason in error if it does not make sense
+bool parseCommand(const std::string &line, runCommand *command, std::string *error);
+
+//Listen on a loopback port for commands
+bool startCommandServer(uint16_t port, commandSlot *slot, acquisitionEvents *events);
+
+void stopCommandServer();
+
+//Pick up a posted command, false if there is none
+bool takeCommand(commandSlot *slot, runCommand *command);
+
+//Send the answer back to the connection that posted the command
+void answerCommand(commandSlot *slot, const std::string &reply);
+
+//Turn away anything still posted or yet to come, once the loop is no longer taking commands
+void closeCommandSlot(commandSlot *slot);
@@ -0,0 +1,45 @@
+// deadTimeFilter.cpp : Software dead time per channel, dropping detector afterpulses straight after decoding
+//
+
+#include "stdafx.h"
+#include "deadTimeFilter.h"
+
+void initDeadTimeFilter(deadTimeFilter *filter, const uint64_t deadTicks[8], bool retrigger)
+{
+	for (int channel = 0; channel < 8; channel++) {
+		filter->deadTicks[channel] = deadTicks[channel];
+		filter->quietUntil[channel] = 0;
+		filter->removed[channel] = 0;
+	}
+	filter->retrigger = retrigger;
+}
+
+size_t filterDeadTime(tagColumns *block, deadTimeFilter *filter)
+{
+	size_t numTags = block->times.size();
+	if (numTags == 0) {
+		return 0;
+	}
+	uint64_t *times = &block->times[0];
+	uint8_t *edges = &block->edges[0];
+	//Every tag is copied down and the output only moves on for the ones we keep, leaving no branch on the outcome
+	uint64_t restart = filter->retrigger ? ~(uint64_t)0 : 0;
+	size_t kept = 0;
+	for (size_t i = 0; i < numTags; i++) {
+		uint64_t time = times[i];
+		uint8_t edge = edges[i];
+		uint8_t channel = edgeChannel(edge) & 7;
+		uint64_t keep = time >= filter->quietUntil[channel];
+		times[kept] = time;
+		edges[kept] = edge;
+		kept += (size_t)keep;
+		filter->removed[channel] += 1 - keep;
+		//A kept tag always starts a new dead time, a dropped one only extends it with retrigger
+		uint64_t mask = (0 - keep) | restart;
+		uint64_t next = time + filter->deadTicks[channel];
+		filter->quietUntil[channel] = (next & mask) | (filter->quietUntil[channel] & ~mask);
+	}
+	block->times.resize(kept);
+	block->edges.resize(kept);
+	return numTags - kept;
+}
@@ -0,0 +1,24 @@
+// deadTimeFilter.h : Software dead time per channel, dropping detector afterpulses straight after decoding
+//
+
+#pragma once
+
+#include "tagDecoder.h"
+
+//Same choice as MultiTTMEvtSorter_c::SetChannelDeadtimeTicks: without retrigger a channel takes tags again one dead time
+//after the tag that started the dead time, with retrigger only once it has been quiet for a whole dead time
+struct deadTimeFilter {
+	//Dead time of each tag channel in ticks, 0 lets every tag through
+	uint64_t deadTicks[8];
+	bool retrigger;
+	//Tags of a channel before this time are dropped
+	uint64_t quietUntil[8];
+	//Tags dropped so far on each channel
+	uint64_t removed[8];
+};
+
+void initDeadTimeFilter(deadTimeFilter *filter, const uint64_t deadTicks[8], bool retrigger);
+
+//Drop tags that fall in the dead time of their channel, compacting the block in place. Each channel's tags are in time
+//order within the block, so one running end of dead time per channel is enough. Returns the number of tags dropped
+size_t filterDeadTime(tagColumns *block, deadTimeFilter *filter);
@@ -0,0 +1,148 @@
+// latencyHistogram.cpp : High dynamic range latency histograms for the pipeline stages
+//
+
+#include "stdafx.h"
+#include "latencyHistogram.h"
+
+stageLatencies latencies;
+
+//Name the histograms before main runs, the counts start at zero as statics
+static struct latencyNames {
+	latencyNames() {
+		latencies.receiveToDecode.name = "ttm_receive_to_decode_seconds";
+		latencies.receiveToDecode.help = "Packet fetched to packet decoded";
+		latencies.decodeToWindowClose.name = "ttm_decode_to_window_close_seconds";
+		latencies.decodeToWindowClose.help = "Packet with the closing gate edge decoded to window handed to the writer";
+		latencies.windowCloseToCommit.name = "ttm_window_close_to_commit_seconds";
+		latencies.windowCloseToCommit.help = "Window handed to the writer to window written";
+		latencies.lastPhotonToDisk.name = "ttm_last_photon_to_disk_seconds";
+		latencies.lastPhotonToDisk.help = "Packet with the last photon of a shot fetched to the shot file on disk";
+	}
+} namer;
+
+static latencyHistogram *allStages[] = { &latencies.receiveToDecode, &latencies.decodeToWindowClose, &latencies.windowCloseToCommit, &latencies.lastPhotonToDisk };
+const int stageCount = sizeof(allStages) / sizeof(allStages[0]);
+
+static int highestBit(uint64_t value)
+{
+	int bit = 0;
+	while (value >>= 1) {
+		bit++;
+	}
+	return bit;
+}
+
+static int bucketIndex(uint64_t nanos)
+{
+	if (nanos < 2 * latencySubBuckets) {
+		return (int)nanos;
+	}
+	//Keep the top seven bits, the leading one picks the power of two and the other six the bucket within it
+	int shift = highestBit(nanos) - 6;
+	return 2 * latencySubBuckets + (shift - 1) * latencySubBuckets + (int)((nanos >> shift) - latencySubBuckets);
+}
+
+//Lowest value that lands in a bucket
+static uint64_t bucketValue(int index)
+{
+	if (index < 2 * latencySubBuckets) {
+		return index;
+	}
+	int shift = (index - 2 * latencySubBuckets) / latencySubBuckets + 1;
+	uint64_t mantissa = (index - 2 * latencySubBuckets) % latencySubBuckets + latencySubBuckets;
+	return mantissa << shift;
+}
+
+void recordLatency(latencyHistogram *histogram, uint64_t nanos)
+{
+	histogram->counts[bucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+	histogram->total.fetch_add(1, std::memory_order_relaxed);
+	histogram->sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+	uint64_t seen = histogram->maxNanos.load(std::memory_order_relaxed);
+	while (nanos > seen && !histogram->maxNanos.compare_exchange_weak(seen, nanos, std::memory_order_relaxed)) {
+	}
+}
+
+void recordStage(latencyHistogram *histogram, stageStamp from, stageStamp to)
+{
+	if (to < from) {
+		return;
+	}
+	recordLatency(histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+uint64_t latencyPercentile(const latencyHistogram *histogram, double fraction)
+{
+	uint64_t total = histogram->total.load(std::memory_order_relaxed);
+	if (total == 0) {
+		return 0;
+	}
+	uint64_t wanted = (uint64_t)(fraction * total + 0.5);
+	if (wanted == 0) {
+		wanted = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < latencyBucketCount; i++) {
+		seen += histogram->counts[i].load(std::memory_order_relaxed);
+		if (seen >= wanted) {
+			return bucketValue(i);
+		}
+	}
+	return histogram->maxNanos.load(std::memory_order_relaxed);
+}
+
+static const double reportedQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+void formatLatencySummaries(std::ostream &out)
+{
+	for (int s = 0; s < stageCount; s++) {
+		const latencyHistogram *histogram = allStages[s];
+		out << "# HELP " << histogram->name << ' ' << histogram->help << '\n';
+		out << "# TYPE " << histogram->name << " summary\n";
+		for (double quantile : reportedQuantiles) {
+			out << histogram->name << "{quantile=\"" << quantile << "\"} " << latencyPercentile(histogram, quantile) / 1e9 << '\n';
+		}
+		out << histogram->name << "_sum " << histogram->sumNanos.load(std::memory_order_relaxed) / 1e9 << '\n';
+		out << histogram->name << "_count " << histogram->total.load(std::memory_order_relaxed) << '\n';
+	}
+}
+
+void dumpLatencies(std::ostream &out, bool withBuckets)
+{
+	out << "stage latencies in microseconds (count p50 p90 p99 p99.9 max)" << std::endl;
+	for (int s = 0; s < stageCount; s++) {
+		const latencyHistogram *histogram = allStages[s];
+		out << histogram->name << ' ' << histogram->total.load(std::memory_order_relaxed);
+		for (double quantile : reportedQuantiles) {
+			out << ' ' << latencyPercentile(histogram, quantile) / 1e3;
+		}
+		out << ' ' << histogram->maxNanos.load(std::memory_order_relaxed) / 1e3 << std::endl;
+	}
+	if (!withBuckets) {
+		return;
+	}
+	//Full buckets so the distributions can be redrawn offline, as lowest value in ns and count
+	for (int s = 0; s < stageCount; s++) {
+		const latencyHistogram *histogram = allStages[s];
+		out << "buckets " << histogram->name << std::endl;
+		for (int i = 0; i < latencyBucketCount; i++) {
+			uint64_t count = histogram->counts[i].load(std::memory_order_relaxed);
+			if (count != 0) {
+				out << bucketValue(i) << ' ' << count << std::endl;
+			}
+		}
+	}
+}
+
+void resetLatencies()
+{
+	for (int s = 0; s < stageCount; s++) {
+		latencyHistogram *histogram = allStages[s];
+		for (int i = 0; i < latencyBucketCount; i++) {
+			histogram->counts[i].store(0, std::memory_order_relaxed);
+		}
+		histogram->total.store(0, std::memory_order_relaxed);
+		histogram->sumNanos.store(0, std::memory_order_relaxed);
+		histogram->maxNanos.store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,61 @@
+// latencyHistogram.h : High dynamic range latency histograms for the pipeline stages
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+
+//Log-linear buckets: values below 128ns are exact, above that each power of two is split into 64 buckets,
+//so any recorded value is resolved to within 1/64 (about 1.6%) across the whole 64 bit range
+const int latencySubBuckets = 64;
+const int latencyBucketCount = 2 * latencySubBuckets + 57 * latencySubBuckets;
+
+typedef std::chrono::steady_clock::time_point stageStamp;
+
+//Recording is lock free so the histograms can be read live while the pipeline fills them
+struct latencyHistogram {
+	const char *name;
+	const char *help;
+	std::atomic<uint64_t> counts[latencyBucketCount];
+	std::atomic<uint64_t> total;
+	std::atomic<uint64_t> sumNanos;
+	std::atomic<uint64_t> maxNanos;
+};
+
+//Stage intervals of the pipeline
+struct stageLatencies {
+	//Packet fetched to packet decoded
+	latencyHistogram receiveToDecode;
+	//Decode of the packet holding the closing gate edge to the window being handed to the writer
+	latencyHistogram decodeToWindowClose;
+	//Window handed to the writer to its tags being written
+	latencyHistogram windowCloseToCommit;
+	//Packet holding the last photon of a shot to the shot file being complete on disk
+	latencyHistogram lastPhotonToDisk;
+};
+
+extern stageLatencies latencies;
+
+inline stageStamp stampNow() {
+	return std::chrono::steady_clock::now();
+}
+
+void recordLatency(latencyHistogram *histogram, uint64_t nanos);
+
+//Record the interval between two stamps
+void recordStage(latencyHistogram *histogram, stageStamp from, stageStamp to);
+
+//Smallest value with at least the given fraction (0..1) of recorded values at or below it
+uint64_t latencyPercentile(const latencyHistogram *histogram, double fraction);
+
+//Quantile summaries of every stage in the plain text scrape format
+void formatLatencySummaries(std::ostream &out);
+
+//Percentile table of every stage, optionally followed by the non-empty buckets
+void dumpLatencies(std::ostream &out, bool withBuckets);
+
+//Empty every stage, for a run starting afresh. Values recorded meanwhile may land on either side of the reset
+void resetLatencies();
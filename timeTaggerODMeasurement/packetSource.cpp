@@ -0,0 +1,405 @@
+// packetSource.cpp : Where tag packets come from, the vendor data connection or a native receiver
+//
+
+#include "stdafx.h"
+#include "packetSource.h"
+#include "pipelineMetrics.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#if defined(__linux)
+#include <linux/filter.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+
+//Datagrams pulled in by a single recvmmsg call
+const int receiveSlots = 64;
+
+//Capture ring blocks, a block is handed over once full or once it has waited this long for more packets
+const uint32_t captureBlockBytes = 1024 * 1024;
+const uint32_t captureBlockMillis = 2;
+
+vendorPacketSource::vendorPacketSource(in_addr_t taggerIP, uint16_t dataPort, uint32_t receiveBufferBytes) : buffer(new TTMDataPacket_t), fetched(false)
+{
+	connection = new TTMData_c;
+	connection->Connect(taggerIP, dataPort, INADDR_ANY, 0, receiveBufferBytes, INVALID_SOCKET);
+}
+
+vendorPacketSource::~vendorPacketSource()
+{
+	delete buffer;
+	delete connection;
+}
+
+bool vendorPacketSource::waitForData(uint32_t timeoutMillis)
+{
+	bool dataAvailable = false;
+	fetched = false;
+	connection->DataAvailable(&dataAvailable, timeoutMillis);
+	if (dataAvailable && connection->FetchData(buffer, 100) == FlexIO_Success) {
+		countMetric(metrics.receiveBatches);
+		fetched = true;
+	}
+	return fetched;
+}
+
+SOCKET vendorPacketSource::readySocket()
+{
+	SOCKET dataSocket = INVALID_SOCKET;
+	connection->GetSocket(&dataSocket);
+	return dataSocket;
+}
+
+const TTMDataPacket_t *vendorPacketSource::nextPacket()
+{
+	if (!fetched) {
+		return NULL;
+	}
+	fetched = false;
+	return buffer;
+}
+
+void vendorPacketSource::disconnect()
+{
+	connection->Disconnect();
+}
+
+bool checkPacketHeader(TTMDataPacket_t *packet, size_t receivedBytes)
+{
+	TTMDataHeader_t *header = &packet->Header;
+	if (receivedBytes < sizeof(TTMDataHeader_t)) {
+		return false;
+	}
+	//The cookies are defined in network byte order so they compare as they arrive
+	if (header->TTMPacketMagicA != TTMCookieA || header->TTMPacketMagicB != TTMCookieB || header->TTMDataMagicA != DataCookieA || header->TTMDataMagicB != DataCookieB) {
+		return false;
+	}
+	if (ntohs(header->PacketVersion) != PacketVersionCookie) {
+		return false;
+	}
+	header->PacketVersion = ntohs(header->PacketVersion);
+	header->PacketCnt = ntohs(header->PacketCnt);
+	header->MModeTimeout = ntohs(header->MModeTimeout);
+	header->DigitalIOState = ntohs(header->DigitalIOState);
+	header->RunMagic = ntohs(header->RunMagic);
+	header->GPXClockConf = ntohs(header->GPXClockConf);
+	header->UserData = ntohs(header->UserData);
+	header->DataSize = ntohs(header->DataSize);
+	//The tags were asked for in little endian byte order (UseLittleEndianByteOrder), so only a truncated datagram needs fixing up
+	size_t dataBytes = receivedBytes - sizeof(TTMDataHeader_t);
+	if (header->DataSize > dataBytes) {
+		header->DataSize = (uint16_t)(dataBytes & ~(size_t)3);
+	}
+	return true;
+}
+
+#if defined(__linux)
+recvmmsgPacketSource::recvmmsgPacketSource() : dataSocket(INVALID_SOCKET), busyPoll(false), slots(receiveSlots), messages(receiveSlots), vectors(receiveSlots), received(0), next(0)
+{
+	for (int i = 0; i < receiveSlots; i++) {
+		//Datagrams start with the header, the slot's padding word keeps the tags aligned behind it
+		vectors[i].iov_base = &slots[i].Header;
+		vectors[i].iov_len = sizeof(TTMDataPacket_t) - offsetof(TTMDataPacket_t, Header);
+		memset(&messages[i], 0, sizeof(mmsghdr));
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+recvmmsgPacketSource::~recvmmsgPacketSource()
+{
+	disconnect();
+}
+
+bool recvmmsgPacketSource::open(uint16_t dataPort, uint32_t receiveBufferBytes, uint32_t busyPollMicros)
+{
+	dataSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (dataSocket == INVALID_SOCKET) {
+		return false;
+	}
+	//Try past the rmem_max limit first (needs CAP_NET_ADMIN), then settle for what we are allowed
+	int bufferBytes = (int)receiveBufferBytes;
+	if (setsockopt(dataSocket, SOL_SOCKET, SO_RCVBUFFORCE, &bufferBytes, sizeof(bufferBytes)) != 0) {
+		setsockopt(dataSocket, SOL_SOCKET, SO_RCVBUF, &bufferBytes, sizeof(bufferBytes));
+	}
+	int grantedBytes = 0;
+	socklen_t optionLength = sizeof(grantedBytes);
+	getsockopt(dataSocket, SOL_SOCKET, SO_RCVBUF, &grantedBytes, &optionLength);
+	//The kernel reports double the requested size to cover its bookkeeping
+	if (grantedBytes / 2 < bufferBytes) {
+		std::cout << "receive buffer is " << grantedBytes / 2 << " bytes rather than " << bufferBytes << ", raise net.core.rmem_max" << std::endl;
+	}
+	if (busyPollMicros != 0) {
+		int micros = (int)busyPollMicros;
+		if (setsockopt(dataSocket, SOL_SOCKET, SO_BUSY_POLL, &micros, sizeof(micros)) != 0) {
+			std::cout << "SO_BUSY_POLL refused, spinning in user space only" << std::endl;
+		}
+		busyPoll = true;
+	}
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(dataPort);
+	if (bind(dataSocket, (sockaddr *)&address, sizeof(address)) != 0) {
+		std::cout << "could not bind data port " << dataPort << std::endl;
+		closesocket(dataSocket);
+		dataSocket = INVALID_SOCKET;
+		return false;
+	}
+	return true;
+}
+
+int recvmmsgPacketSource::receiveBatch()
+{
+	int count = recvmmsg(dataSocket, &messages[0], receiveSlots, MSG_DONTWAIT, NULL);
+	if (count <= 0) {
+		return 0;
+	}
+	countMetric(metrics.receiveBatches);
+	return count;
+}
+
+bool recvmmsgPacketSource::waitForData(uint32_t timeoutMillis)
+{
+	received = 0;
+	next = 0;
+	if (dataSocket == INVALID_SOCKET) {
+		return false;
+	}
+	if (busyPoll) {
+		//Spin on the socket rather than sleep, trading a core for wake-up latency
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+		while ((received = receiveBatch()) == 0 && std::chrono::steady_clock::now() < deadline) {
+		}
+		return received != 0;
+	}
+	pollfd readable;
+	readable.fd = dataSocket;
+	readable.events = POLLIN;
+	readable.revents = 0;
+	if (poll(&readable, 1, (int)timeoutMillis) <= 0) {
+		return false;
+	}
+	received = receiveBatch();
+	return received != 0;
+}
+
+SOCKET recvmmsgPacketSource::readySocket()
+{
+	return dataSocket;
+}
+
+const TTMDataPacket_t *recvmmsgPacketSource::nextPacket()
+{
+	while (next < received) {
+		TTMDataPacket_t *packet = &slots[next];
+		size_t receivedBytes = messages[next].msg_len;
+		next++;
+		if (checkPacketHeader(packet, receivedBytes)) {
+			return packet;
+		}
+		countMetric(metrics.packetsRejected);
+	}
+	return NULL;
+}
+
+void recvmmsgPacketSource::disconnect()
+{
+	if (dataSocket != INVALID_SOCKET) {
+		closesocket(dataSocket);
+		dataSocket = INVALID_SOCKET;
+	}
+}
+
+tpacketPacketSource::tpacketPacketSource() : captureSocket(INVALID_SOCKET), ring(NULL), currentBlock(0), heldBlock(NULL), nextFrame(NULL), framesLeft(0)
+{
+	memset(&request, 0, sizeof(request));
+}
+
+tpacketPacketSource::~tpacketPacketSource()
+{
+	disconnect();
+}
+
+bool tpacketPacketSource::open(const std::string &interfaceName, uint16_t dataPort, uint32_t ringBytes)
+{
+	captureSocket = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if (captureSocket == INVALID_SOCKET) {
+		std::cout << "could not open a packet socket, the capture ring needs CAP_NET_RAW" << std::endl;
+		return false;
+	}
+	//Only whole IPv4 UDP datagrams to the data port make it into the ring (udp dst port N and not a fragment)
+	sock_filter filterCode[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 8),
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3FFF, 4, 0),
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, dataPort, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	sock_fprog filter;
+	filter.len = sizeof(filterCode) / sizeof(filterCode[0]);
+	filter.filter = filterCode;
+	int version = TPACKET_V3;
+	if (setsockopt(captureSocket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) != 0 || setsockopt(captureSocket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+		disconnect();
+		return false;
+	}
+	//Our own sends would show up twice on loopback, older kernels without this are caught by the packet type check
+	int ignoreOutgoing = 1;
+	setsockopt(captureSocket, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignoreOutgoing, sizeof(ignoreOutgoing));
+	request.tp_block_size = captureBlockBytes;
+	request.tp_block_nr = ringBytes / captureBlockBytes < 4 ? 4 : ringBytes / captureBlockBytes;
+	//Frames are packed back to back in V3, the frame size only has to cover the largest packet
+	request.tp_frame_size = 65536;
+	request.tp_frame_nr = request.tp_block_nr * (request.tp_block_size / request.tp_frame_size);
+	request.tp_retire_blk_tov = captureBlockMillis;
+	request.tp_feature_req_word = 0;
+	if (setsockopt(captureSocket, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0) {
+		std::cout << "could not set up a " << request.tp_block_nr << "MB capture ring" << std::endl;
+		disconnect();
+		return false;
+	}
+	size_t mappedBytes = (size_t)request.tp_block_size * request.tp_block_nr;
+	void *mapped = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, captureSocket, 0);
+	if (mapped == MAP_FAILED) {
+		//Locking the ring in memory is only worth it when allowed
+		mapped = mmap(NULL, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, captureSocket, 0);
+	}
+	if (mapped == MAP_FAILED) {
+		disconnect();
+		return false;
+	}
+	ring = (uint8_t *)mapped;
+	sockaddr_ll link;
+	memset(&link, 0, sizeof(link));
+	link.sll_family = AF_PACKET;
+	link.sll_protocol = htons(ETH_P_IP);
+	link.sll_ifindex = if_nametoindex(interfaceName.c_str());
+	if (link.sll_ifindex == 0 || bind(captureSocket, (sockaddr *)&link, sizeof(link)) != 0) {
+		std::cout << "could not capture on interface " << interfaceName << std::endl;
+		disconnect();
+		return false;
+	}
+	return true;
+}
+
+void tpacketPacketSource::releaseBlock()
+{
+	if (heldBlock == NULL) {
+		return;
+	}
+	__atomic_store_n(&heldBlock->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	heldBlock = NULL;
+	framesLeft = 0;
+	currentBlock = (currentBlock + 1) % request.tp_block_nr;
+}
+
+bool tpacketPacketSource::waitForData(uint32_t timeoutMillis)
+{
+	if (ring == NULL) {
+		return false;
+	}
+	releaseBlock();
+	tpacket_block_desc *block = (tpacket_block_desc *)(ring + (size_t)currentBlock * request.tp_block_size);
+	if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+		pollfd readable;
+		readable.fd = captureSocket;
+		readable.events = POLLIN | POLLERR;
+		readable.revents = 0;
+		poll(&readable, 1, (int)timeoutMillis);
+		if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+			return false;
+		}
+	}
+	heldBlock = block;
+	framesLeft = block->hdr.bh1.num_pkts;
+	nextFrame = (uint8_t *)block + block->hdr.bh1.offset_to_first_pkt;
+	countMetric(metrics.receiveBatches);
+	return true;
+}
+
+SOCKET tpacketPacketSource::readySocket()
+{
+	return captureSocket;
+}
+
+const TTMDataPacket_t *tpacketPacketSource::nextPacket()
+{
+	while (framesLeft != 0) {
+		tpacket3_hdr *frame = (tpacket3_hdr *)nextFrame;
+		nextFrame += frame->tp_next_offset;
+		framesLeft--;
+		const sockaddr_ll *link = (const sockaddr_ll *)((uint8_t *)frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+		if (link->sll_pkttype == PACKET_OUTGOING) {
+			continue;
+		}
+		//The filter only lets whole UDP datagrams through, so the IP and UDP headers can be stepped over directly
+		uint8_t *ipHeader = (uint8_t *)frame + frame->tp_net;
+		uint8_t *udpHeader = ipHeader + (ipHeader[0] & 0xF) * 4;
+		uint8_t *payload = udpHeader + 8;
+		size_t datagramBytes = ntohs(*(uint16_t *)(udpHeader + 4)) - 8;
+		size_t capturedBytes = frame->tp_snaplen - (payload - ((uint8_t *)frame + frame->tp_mac));
+		//The padding word in front of the header lands on the UDP checksum, it is never read or written
+		TTMDataPacket_t *packet = (TTMDataPacket_t *)(payload - offsetof(TTMDataPacket_t, Header));
+		if (capturedBytes >= datagramBytes && checkPacketHeader(packet, datagramBytes)) {
+			return packet;
+		}
+		countMetric(metrics.packetsRejected);
+	}
+	return NULL;
+}
+
+void tpacketPacketSource::disconnect()
+{
+	if (captureSocket == INVALID_SOCKET) {
+		return;
+	}
+	tpacket_stats_v3 stats;
+	socklen_t statsLength = sizeof(stats);
+	if (ring != NULL && getsockopt(captureSocket, SOL_PACKET, PACKET_STATISTICS, &stats, &statsLength) == 0 && stats.tp_drops != 0) {
+		std::cout << "capture ring dropped " << stats.tp_drops << " packets" << std::endl;
+	}
+	if (ring != NULL) {
+		munmap(ring, (size_t)request.tp_block_size * request.tp_block_nr);
+		ring = NULL;
+	}
+	heldBlock = NULL;
+	framesLeft = 0;
+	closesocket(captureSocket);
+	captureSocket = INVALID_SOCKET;
+}
+#endif
+
+packetSource *openPacketSource(const acquisitionOptions *options)
+{
+#if defined(__linux)
+	if (options->ingest == ingestRecvmmsg) {
+		recvmmsgPacketSource *source = new recvmmsgPacketSource;
+		if (!source->open(options->dataPort, options->receiveBufferBytes, options->busyPollMicros)) {
+			delete source;
+			return NULL;
+		}
+		return source;
+	}
+	if (options->ingest == ingestTpacket) {
+		tpacketPacketSource *source = new tpacketPacketSource;
+		if (!source->open(options->captureInterface, options->dataPort, options->captureRingBytes)) {
+			delete source;
+			return NULL;
+		}
+		return source;
+	}
+#endif
+	return new vendorPacketSource(options->taggerIP, options->dataPort, options->receiveBufferBytes);
+}
@@ -0,0 +1,94 @@
+// packetSource.h : Where tag packets come from, the vendor data connection or a native receiver
+//
+
+#pragma once
+
+#include "acquisitionOptions.h"
+#include "TTMLib.hpp"
+#include <vector>
+#if defined(__linux)
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#endif
+
+//Packets are received in batches, a batch stays valid until the next waitForData
+class packetSource {
+public:
+	virtual ~packetSource() {}
+	//Wait up to timeoutMillis for at least one packet, false on timeout. A timeout of 0 just takes what is waiting
+	virtual bool waitForData(uint32_t timeoutMillis) = 0;
+	//Socket that turns readable when packets arrive, for waiting on alongside other events
+	virtual SOCKET readySocket() = 0;
+	//Next packet of the current batch in host byte order, NULL once the batch is used up
+	virtual const TTMDataPacket_t *nextPacket() = 0;
+	virtual void disconnect() = 0;
+};
+
+//The vendor TTMData_c connection, batches of one packet
+class vendorPacketSource : public packetSource {
+public:
+	vendorPacketSource(in_addr_t taggerIP, uint16_t dataPort, uint32_t receiveBufferBytes);
+	~vendorPacketSource();
+	bool waitForData(uint32_t timeoutMillis);
+	SOCKET readySocket();
+	const TTMDataPacket_t *nextPacket();
+	void disconnect();
+private:
+	TTMData_c *connection;
+	TTMDataPacket_t *buffer;
+	bool fetched;
+};
+
+#if defined(__linux)
+//Native receiver bound to the data port, each recvmmsg call fills a pool of packet slots
+class recvmmsgPacketSource : public packetSource {
+public:
+	recvmmsgPacketSource();
+	~recvmmsgPacketSource();
+	bool open(uint16_t dataPort, uint32_t receiveBufferBytes, uint32_t busyPollMicros);
+	bool waitForData(uint32_t timeoutMillis);
+	SOCKET readySocket();
+	const TTMDataPacket_t *nextPacket();
+	void disconnect();
+private:
+	//Pull in whatever is queued on the socket without blocking, returns the number of datagrams
+	int receiveBatch();
+	SOCKET dataSocket;
+	bool busyPoll;
+	std::vector<TTMDataPacket_t> slots;
+	std::vector<mmsghdr> messages;
+	std::vector<iovec> vectors;
+	int received;
+	int next;
+};
+
+//Capture ring shared with the kernel (PACKET_RX_RING, TPACKET_V3) filtered to the data port. A batch is one ring
+//block, packets are handed out where they sit in the block with only their header swapped to host order in place.
+//Tagger packets must arrive unfragmented, so the interface needs an MTU above the tagger's packet size.
+class tpacketPacketSource : public packetSource {
+public:
+	tpacketPacketSource();
+	~tpacketPacketSource();
+	bool open(const std::string &interfaceName, uint16_t dataPort, uint32_t ringBytes);
+	bool waitForData(uint32_t timeoutMillis);
+	SOCKET readySocket();
+	const TTMDataPacket_t *nextPacket();
+	void disconnect();
+private:
+	//Hand the block we were working on back to the kernel
+	void releaseBlock();
+	SOCKET captureSocket;
+	uint8_t *ring;
+	tpacket_req3 request;
+	uint32_t currentBlock;
+	tpacket_block_desc *heldBlock;
+	uint8_t *nextFrame;
+	uint32_t framesLeft;
+};
+#endif
+
+//Check a raw packet from the wire and bring its header to host byte order, false if it is not a tagger data packet
+bool checkPacketHeader(TTMDataPacket_t *packet, size_t receivedBytes);
+
+//Open the source picked in the options, NULL if it could not be set up
+packetSource *openPacketSource(const acquisitionOptions *options);
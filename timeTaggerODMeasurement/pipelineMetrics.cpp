@@ -0,0 +1,246 @@
+// pipelineMetrics.cpp : Counters for the acquisition pipeline and a local scrape endpoint serving them
+//
+
+#include "stdafx.h"
+#include "pipelineMetrics.h"
+#include "windowManager.h"
+#include "latencyHistogram.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+pipelineMetrics metrics;
+
+//PacketCnt of the previous packet, only touched by the decode loop
+static bool havePacketCnt = false;
+static uint16_t lastPacketCnt = 0;
+
+void recordPacket(const TTMDataPacket_t *tagBuffer)
+{
+	countMetric(metrics.packets);
+	countMetric(metrics.packetBytes, tagBuffer->Header.DataSize);
+	uint16_t packetCnt = tagBuffer->Header.PacketCnt;
+	if (havePacketCnt) {
+		//The counter wraps at 16 bits, anything but the next value means packets went missing
+		uint16_t missing = (uint16_t)(packetCnt - lastPacketCnt - 1);
+		if (missing != 0) {
+			countMetric(metrics.packetGaps);
+			countMetric(metrics.packetsLost, missing);
+		}
+	}
+	havePacketCnt = true;
+	lastPacketCnt = packetCnt;
+}
+
+void recordTags(const tagColumns *block)
+{
+	uint64_t counts[8] = { 0 };
+	size_t numTags = block->edges.size();
+	for (size_t i = 0; i < numTags; i++) {
+		counts[edgeChannel(block->edges[i])]++;
+	}
+	for (int channel = 0; channel < 8; channel++) {
+		if (counts[channel] != 0) {
+			countMetric(metrics.tagsByChannel[channel], counts[channel]);
+		}
+	}
+}
+
+void recordWriteLatency(uint64_t micros)
+{
+	int bucket = 0;
+	while (bucket < writeLatencyBuckets && micros > writeLatencyBounds[bucket]) {
+		bucket++;
+	}
+	countMetric(metrics.writeLatencyCount[bucket]);
+	countMetric(metrics.writeLatencyMicros, micros);
+}
+
+//State of the scrape endpoint
+static std::thread serverThread;
+static std::atomic<bool> serverRunning(false);
+static SOCKET listenSocket = INVALID_SOCKET;
+
+//Per second rates worked out by the server thread once a second
+struct metricRates {
+	uint64_t packets;
+	uint64_t tags[8];
+	double packetsPerSecond;
+	double tagsPerSecond[8];
+	uint64_t skipped;
+	uint64_t decoded;
+	//Share of the tags over the last second that were skipped outside the gate
+	double skippedFraction;
+	std::chrono::steady_clock::time_point sampled;
+};
+
+static void updateRates(metricRates *rates)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(now - rates->sampled).count();
+	if (seconds <= 0) {
+		return;
+	}
+	uint64_t packets = metrics.packets.load(std::memory_order_relaxed);
+	rates->packetsPerSecond = (packets - rates->packets) / seconds;
+	rates->packets = packets;
+	for (int channel = 0; channel < 8; channel++) {
+		uint64_t tags = metrics.tagsByChannel[channel].load(std::memory_order_relaxed);
+		rates->tagsPerSecond[channel] = (tags - rates->tags[channel]) / seconds;
+		rates->tags[channel] = tags;
+	}
+	uint64_t skipped = metrics.tagsSkipped.load(std::memory_order_relaxed);
+	uint64_t decoded = 0;
+	for (int channel = 0; channel < 8; channel++) {
+		decoded += rates->tags[channel];
+	}
+	uint64_t seen = (skipped - rates->skipped) + (decoded - rates->decoded);
+	rates->skippedFraction = seen != 0 ? (double)(skipped - rates->skipped) / seen : 0;
+	rates->skipped = skipped;
+	rates->decoded = decoded;
+	rates->sampled = now;
+}
+
+static void writeMetric(std::ostringstream &out, const char *name, const char *type, const char *help, double value)
+{
+	out << "# HELP " << name << ' ' << help << '\n';
+	out << "# TYPE " << name << ' ' << type << '\n';
+	out << name << ' ' << value << '\n';
+}
+
+static void writeCounter(std::ostringstream &out, const char *name, const char *help, const std::atomic<uint64_t> &counter)
+{
+	writeMetric(out, name, "counter", help, (double)counter.load(std::memory_order_relaxed));
+}
+
+static std::string formatMetrics(const metricRates *rates, windowQueue *closedQueue, windowQueue *writerQueue, tagMemory *memory)
+{
+	std::ostringstream out;
+	out.precision(15);
+	writeCounter(out, "ttm_packets_total", "Packets fetched from the tagger", metrics.packets);
+	writeCounter(out, "ttm_packet_bytes_total", "Tag bytes fetched from the tagger", metrics.packetBytes);
+	writeMetric(out, "ttm_packets_per_second", "gauge", "Packets fetched over the last second", rates->packetsPerSecond);
+	writeCounter(out, "ttm_packets_lost_total", "Packets missing from the PacketCnt sequence", metrics.packetsLost);
+	writeCounter(out, "ttm_packet_gaps_total", "Breaks in the PacketCnt sequence", metrics.packetGaps);
+	writeCounter(out, "ttm_receive_batches_total", "Receive calls that returned packets", metrics.receiveBatches);
+	writeCounter(out, "ttm_packets_rejected_total", "Datagrams with bad cookies or packet version", metrics.packetsRejected);
+	out << "# HELP ttm_tags_total Decoded tags per channel\n# TYPE ttm_tags_total counter\n";
+	for (int channel = 0; channel < 8; channel++) {
+		out << "ttm_tags_total{channel=\"" << channel << "\"} " << metrics.tagsByChannel[channel].load(std::memory_order_relaxed) << '\n';
+	}
+	out << "# HELP ttm_tags_per_second Decoded tags per channel over the last second\n# TYPE ttm_tags_per_second gauge\n";
+	for (int channel = 0; channel < 8; channel++) {
+		out << "ttm_tags_per_second{channel=\"" << channel << "\"} " << rates->tagsPerSecond[channel] << '\n';
+	}
+	writeCounter(out, "ttm_tags_skipped_total", "Tags outside the gate skipped without decoding", metrics.tagsSkipped);
+	writeMetric(out, "ttm_tags_skipped_ratio", "gauge", "Share of the tags skipped outside the gate over the last second", rates->skippedFraction);
+	writeCounter(out, "ttm_dead_time_removed_total", "Tags dropped inside the software dead time", metrics.deadTimeRemoved);
+	writeCounter(out, "ttm_windows_closed_total", "Gate windows handed to the writer", metrics.windowsClosed);
+	writeCounter(out, "ttm_shots_closed_total", "Shots handed to the writer", metrics.shotsClosed);
+	writeCounter(out, "ttm_unpaired_gate_edges_total", "Gate edges without a partner", metrics.unpairedEdges);
+	writeMetric(out, "ttm_window_queue_depth", "gauge", "Windows waiting for the writer", (double)writerQueue->size());
+	writeMetric(out, "ttm_window_queue_capacity", "gauge", "Most windows allowed to wait for the writer", (double)writerQueue->capacity());
+	if (closedQueue != writerQueue) {
+		writeMetric(out, "ttm_pipeline_queue_depth", "gauge", "Closed windows waiting for the post-processing pool", (double)closedQueue->size());
+		writeMetric(out, "ttm_pipeline_queue_capacity", "gauge", "Most closed windows allowed to wait for the pool", (double)closedQueue->capacity());
+	}
+	writeMetric(out, "ttm_inflight_tag_bytes", "gauge", "Tag storage held by open and queued windows", (double)memory->inFlightBytes.load(std::memory_order_relaxed));
+	writeCounter(out, "ttm_window_allocations_total", "Window structures allocated, their tag columns are counted apart", metrics.windowAllocations);
+	writeCounter(out, "ttm_tag_column_growths_total", "Packets over which the tag columns of an open window had to grow", metrics.columnGrowths);
+	writeCounter(out, "ttm_spilled_blocks_total", "Tag blocks spilled to disk", metrics.spilledBlocks);
+	writeCounter(out, "ttm_spill_failures_total", "Windows that could not be spilled and kept their tags in memory", metrics.spillFailures);
+	writeCounter(out, "ttm_windows_degraded_total", "Windows kept as counts or totals under backpressure", metrics.windowsDegraded);
+	writeCounter(out, "ttm_shots_dropped_total", "Shots dropped whole under backpressure", metrics.shotsDropped);
+	writeCounter(out, "ttm_bytes_written_total", "Bytes written to HDF5 datasets", metrics.bytesWritten);
+	out << "# HELP ttm_hdf5_write_seconds Time taken by each window and shot write\n# TYPE ttm_hdf5_write_seconds histogram\n";
+	uint64_t cumulative = 0;
+	for (int bucket = 0; bucket < writeLatencyBuckets; bucket++) {
+		cumulative += metrics.writeLatencyCount[bucket].load(std::memory_order_relaxed);
+		out << "ttm_hdf5_write_seconds_bucket{le=\"" << writeLatencyBounds[bucket] / 1e6 << "\"} " << cumulative << '\n';
+	}
+	cumulative += metrics.writeLatencyCount[writeLatencyBuckets].load(std::memory_order_relaxed);
+	out << "ttm_hdf5_write_seconds_bucket{le=\"+Inf\"} " << cumulative << '\n';
+	out << "ttm_hdf5_write_seconds_sum " << metrics.writeLatencyMicros.load(std::memory_order_relaxed) / 1e6 << '\n';
+	out << "ttm_hdf5_write_seconds_count " << cumulative << '\n';
+	formatLatencySummaries(out);
+	return out.str();
+}
+
+//Answer a single scrape, whatever was asked for gets the metrics
+static void serveScrape(SOCKET client, const metricRates *rates, windowQueue *closedQueue, windowQueue *writerQueue, tagMemory *memory)
+{
+	char request[2048];
+	recv(client, request, sizeof(request), 0);
+	std::string body = formatMetrics(rates, closedQueue, writerQueue, memory);
+	std::ostringstream response;
+	response << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << body.size() << "\r\nConnection: close\r\n\r\n" << body;
+	std::string text = response.str();
+	send(client, text.c_str(), (int)text.size(), 0);
+	closesocket(client);
+}
+
+static void serverLoop(windowQueue *closedQueue, windowQueue *writerQueue, tagMemory *memory)
+{
+	metricRates rates = metricRates();
+	rates.sampled = std::chrono::steady_clock::now();
+	while (serverRunning) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(listenSocket, &readable);
+		timeval timeout;
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+		int ready = select((int)listenSocket + 1, &readable, NULL, NULL, &timeout);
+		if (std::chrono::steady_clock::now() - rates.sampled >= std::chrono::seconds(1)) {
+			updateRates(&rates);
+		}
+		if (ready > 0 && FD_ISSET(listenSocket, &readable)) {
+			SOCKET client = accept(listenSocket, NULL, NULL);
+			if (client != INVALID_SOCKET) {
+				serveScrape(client, &rates, closedQueue, writerQueue, memory);
+			}
+		}
+	}
+}
+
+bool startMetricsServer(uint16_t port, windowQueue *closedQueue, windowQueue *writerQueue, tagMemory *memory)
+{
+#if defined(_WIN32)
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+	listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenSocket == INVALID_SOCKET) {
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const SockOpt_t *)&reuse, sizeof(reuse));
+	//Only local monitoring gets to see the metrics
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, 4) != 0) {
+		std::cout << "could not serve metrics on port " << port << std::endl;
+		closesocket(listenSocket);
+		listenSocket = INVALID_SOCKET;
+		return false;
+	}
+	serverRunning = true;
+	serverThread = std::thread(serverLoop, closedQueue, writerQueue, memory);
+	return true;
+}
+
+void stopMetricsServer()
+{
+	if (!serverRunning) {
+		return;
+	}
+	serverRunning = false;
+	serverThread.join();
+	closesocket(listenSocket);
+	listenSocket = INVALID_SOCKET;
+}
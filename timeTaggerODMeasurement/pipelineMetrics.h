@@ -0,0 +1,68 @@
+// pipelineMetrics.h : Counters for the acquisition pipeline and a local scrape endpoint serving them
+//
+
+#pragma once
+
+#include "tagDecoder.h"
+#include <atomic>
+
+class windowQueue;
+struct tagMemory;
+
+//Upper bounds of the HDF5 write latency buckets in microseconds
+const int writeLatencyBuckets = 8;
+const uint64_t writeLatencyBounds[writeLatencyBuckets] = { 100, 300, 1000, 3000, 10000, 30000, 100000, 300000 };
+
+//All counters only ever go up and are updated with relaxed atomics from the hot paths
+struct pipelineMetrics {
+	std::atomic<uint64_t> packets;
+	std::atomic<uint64_t> packetBytes;
+	//Packets missing according to the running PacketCnt in the headers, and how often a gap was seen
+	std::atomic<uint64_t> packetsLost;
+	std::atomic<uint64_t> packetGaps;
+	//Receive calls that returned packets, packets per batch is packets / receiveBatches
+	std::atomic<uint64_t> receiveBatches;
+	//Datagrams on the data port that were not tagger data packets
+	std::atomic<uint64_t> packetsRejected;
+	std::atomic<uint64_t> tagsByChannel[8];
+	//Tags outside the gate skipped by the gated decoder, these never make it into tagsByChannel
+	std::atomic<uint64_t> tagsSkipped;
+	//Tags dropped by the software dead time filter
+	std::atomic<uint64_t> deadTimeRemoved;
+	std::atomic<uint64_t> windowsClosed;
+	std::atomic<uint64_t> shotsClosed;
+	std::atomic<uint64_t> unpairedEdges;
+	std::atomic<uint64_t> windowAllocations;
+	std::atomic<uint64_t> columnGrowths;
+	std::atomic<uint64_t> spilledBlocks;
+	//Windows whose tags could not be written to their spill file and were kept in memory
+	std::atomic<uint64_t> spillFailures;
+	//Windows kept with less than the run was set up for, and shots dropped whole, under backpressure
+	std::atomic<uint64_t> windowsDegraded;
+	std::atomic<uint64_t> shotsDropped;
+	std::atomic<uint64_t> bytesWritten;
+	std::atomic<uint64_t> writeLatencyCount[writeLatencyBuckets + 1];
+	std::atomic<uint64_t> writeLatencyMicros;
+};
+
+extern pipelineMetrics metrics;
+
+inline void countMetric(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+	counter.fetch_add(amount, std::memory_order_relaxed);
+}
+
+//Count a fetched packet and check its PacketCnt against the previous one, only call from the decode loop
+void recordPacket(const TTMDataPacket_t *tagBuffer);
+
+//Count decoded tags per channel, one atomic add per channel rather than per tag
+void recordTags(const tagColumns *block);
+
+//Record how long one HDF5 write took
+void recordWriteLatency(uint64_t micros);
+
+//Serve the metrics in the plain text scrape format on 127.0.0.1:port from a background thread, queue depths and in-flight
+//bytes are read from the window queues and tag memory at scrape time. The writer reads writerQueue, which is closedQueue
+//unless the windows go through the post-processing pool first
+bool startMetricsServer(uint16_t port, windowQueue *closedQueue, windowQueue *writerQueue, tagMemory *memory);
+
+void stopMetricsServer();
@@ -0,0 +1,131 @@
+// sharedTagRing.cpp : Shared memory ring publishing the decoded tag columns of each window to local analysis processes
+//
+
+#include "stdafx.h"
+#include "sharedTagRing.h"
+#include "windowManager.h"
+#include <cstring>
+#include <iostream>
+
+bool createSharedTagRing(sharedTagRing *ring, const std::string &name, uint64_t dataBytes)
+{
+	dataBytes = (dataBytes + 7) & ~(uint64_t)7;
+	ring->seq = 0;
+	ring->skipped = 0;
+	if (!mapSharedRing(name, ringHeaderBytes + dataBytes, true, &ring->mapping)) {
+		std::cout << "could not create shared memory ring " << name << std::endl;
+		return false;
+	}
+	ring->header = (ringHeader *)ring->mapping.base;
+	ring->data = ring->mapping.base + ringHeaderBytes;
+	//Readers still attached to a ring from an earlier run see the magic vanish while it is set up again
+	ring->header->magic = 0;
+	ring->header->version = ringVersion;
+	ring->header->dataBytes = dataBytes;
+	ring->header->headerBytes = ringHeaderBytes;
+	ring->header->claimPos.store(0);
+	ring->header->commitPos.store(0);
+	ring->header->lastRecordPos.store(0);
+	ring->header->lastSeq.store(0);
+	std::atomic_thread_fence(std::memory_order_release);
+	ring->header->magic = ringMagic;
+	return true;
+}
+
+//Copy a window's tags of one kind into the record, spilled blocks first as in the written file
+static void copyColumns(const tagWindow *window, bool clock, uint64_t *times, uint8_t *edges)
+{
+	size_t n = 0;
+	tagColumns block;
+	for (size_t b = 0; b < window->spilled.size(); b++) {
+		if (window->spilled[b].clock != clock) {
+			continue;
+		}
+		//A block that cannot be read back is left as zeros rather than shifting the rest of the window
+		if (readSpilledBlock(window, &window->spilled[b], &block)) {
+			memcpy(times + n, &block.times[0], block.times.size() * sizeof(uint64_t));
+			memcpy(edges + n, &block.edges[0], block.edges.size());
+		}
+		else {
+			memset(times + n, 0, window->spilled[b].numTags * sizeof(uint64_t));
+			memset(edges + n, 0, window->spilled[b].numTags);
+		}
+		n += window->spilled[b].numTags;
+	}
+	const tagColumns *tags = clock ? &window->clockTags : &window->windowedTags;
+	if (!tags->times.empty()) {
+		memcpy(times + n, &tags->times[0], tags->times.size() * sizeof(uint64_t));
+		memcpy(edges + n, &tags->edges[0], tags->edges.size());
+	}
+}
+
+void publishWindow(sharedTagRing *ring, const tagWindow *window)
+{
+	uint64_t numWindowed = window->windowedTags.times.size();
+	uint64_t numClock = window->clockTags.times.size();
+	for (size_t b = 0; b < window->spilled.size(); b++) {
+		if (window->spilled[b].clock) {
+			numClock += window->spilled[b].numTags;
+		}
+		else {
+			numWindowed += window->spilled[b].numTags;
+		}
+	}
+	ringHeader *header = ring->header;
+	uint64_t recordBytes = ringRecordSize(numWindowed, numClock);
+	//Keep at least half the ring for the windows before it so readers are not lapped by a single record
+	if (recordBytes > header->dataBytes / 2) {
+		ring->skipped++;
+		return;
+	}
+	uint64_t pos = header->claimPos.load(std::memory_order_relaxed);
+	uint64_t offset = pos % header->dataBytes;
+	//Records do not wrap, one that would is put at the start of the ring after padding out to the end
+	uint64_t padBytes = offset + recordBytes > header->dataBytes ? header->dataBytes - offset : 0;
+	header->claimPos.store(pos + padBytes + recordBytes);
+	//The claim is visible before any of the old records underneath are touched. The store alone only orders the writes
+	//before it, the fence keeps the plain writes into the record from moving up past it on weakly ordered targets
+	std::atomic_thread_fence(std::memory_order_release);
+	if (padBytes != 0) {
+		//Readers step over a gap too small for a record header by themselves
+		if (padBytes >= sizeof(ringRecordHeader)) {
+			ringRecordHeader *padding = (ringRecordHeader *)(ring->data + offset);
+			memset(padding, 0, sizeof(ringRecordHeader));
+			padding->recordBytes = padBytes;
+			padding->flags = ringRecordPadding;
+		}
+		pos += padBytes;
+		offset = 0;
+	}
+	ringRecordHeader *record = (ringRecordHeader *)(ring->data + offset);
+	record->seq = ++ring->seq;
+	record->recordBytes = recordBytes;
+	record->shotNum = window->shotNum;
+	record->windowNum = window->windowNum;
+	record->flags = window->shotEnd ? ringRecordShotEnd : ringRecordWindow;
+	if (!window->shotEnd && !window->complete) {
+		record->flags |= ringRecordIncomplete;
+	}
+	record->startTime = window->startTime;
+	record->endTime = window->endTime;
+	record->numWindowed = numWindowed;
+	record->numClock = numClock;
+	uint64_t *windowedTimes = (uint64_t *)(record + 1);
+	uint64_t *clockTimes = windowedTimes + numWindowed;
+	uint8_t *windowedEdges = (uint8_t *)(clockTimes + numClock);
+	uint8_t *clockEdges = windowedEdges + numWindowed;
+	copyColumns(window, false, windowedTimes, windowedEdges);
+	copyColumns(window, true, clockTimes, clockEdges);
+	header->lastRecordPos.store(pos, std::memory_order_release);
+	header->lastSeq.store(ring->seq, std::memory_order_release);
+	header->commitPos.store(pos + recordBytes, std::memory_order_release);
+}
+
+void closeSharedTagRing(sharedTagRing *ring)
+{
+	if (ring->skipped != 0) {
+		std::cout << ring->skipped << " windows were too large for the shared memory ring" << std::endl;
+	}
+	//The object itself is left in place so late readers can still pick up the last windows
+	unmapSharedRing(&ring->mapping);
+}
@@ -0,0 +1,266 @@
+// sharedTagRing.h : Shared memory ring publishing the decoded tag columns of each window to local analysis processes
+//
+// This header has no dependency on the time tagger library so analysis programs can include it on its own and use
+// sharedTagRingReader. The acquisition process is the only writer, it never waits for readers; a reader that falls a
+// whole ring behind is told so and skips ahead to the newest window.
+//
+// Layout: a 256 byte ringHeader followed by dataBytes of records. Positions are byte counts since the ring was
+// created and never wrap, the place in the data region is position % dataBytes. Each record is a ringRecordHeader
+// followed by the windowed tag times (uint64), the clock tag times (uint64), the windowed tag edges (uint8) and the
+// clock tag edges (uint8), padded to 8 bytes. Records never straddle the end of the data region, a padding record
+// (or fewer than sizeof(ringRecordHeader) bytes of nothing) fills the gap.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+const uint32_t ringMagic = 0x524D5454;
+const uint32_t ringVersion = 1;
+const uint64_t ringHeaderBytes = 256;
+
+struct ringHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t dataBytes;
+	uint64_t headerBytes;
+	uint64_t reservedA[5];
+	//End of the space the writer has claimed, data before claimPos - dataBytes may have been overwritten
+	std::atomic<uint64_t> claimPos;
+	uint64_t reservedB[7];
+	//End of the last complete record
+	std::atomic<uint64_t> commitPos;
+	//Start and sequence number of the last complete record, where lapped readers pick up again
+	std::atomic<uint64_t> lastRecordPos;
+	std::atomic<uint64_t> lastSeq;
+};
+
+//Record flags
+const uint32_t ringRecordWindow = 1;
+const uint32_t ringRecordShotEnd = 2;
+const uint32_t ringRecordPadding = 4;
+//Window lost its closing gate edge
+const uint32_t ringRecordIncomplete = 8;
+
+struct ringRecordHeader {
+	//Sequence numbers count up from 1 with every window or shot end record
+	uint64_t seq;
+	uint64_t recordBytes;
+	uint64_t shotNum;
+	uint32_t windowNum;
+	uint32_t flags;
+	uint64_t startTime;
+	uint64_t endTime;
+	uint64_t numWindowed;
+	uint64_t numClock;
+};
+
+inline uint64_t ringRecordSize(uint64_t numWindowed, uint64_t numClock) {
+	uint64_t bytes = sizeof(ringRecordHeader) + (numWindowed + numClock) * (sizeof(uint64_t) + sizeof(uint8_t));
+	return (bytes + 7) & ~(uint64_t)7;
+}
+
+//Platform mapping of the named ring, /dev/shm/<name> on Linux and Local\<name> on Windows
+struct sharedRingMapping {
+	uint8_t *base;
+	uint64_t bytes;
+#if defined(_WIN32)
+	HANDLE handle;
+#else
+	int fd;
+#endif
+};
+
+inline bool mapSharedRing(const std::string &name, uint64_t bytes, bool create, sharedRingMapping *mapping) {
+	mapping->base = NULL;
+	mapping->bytes = bytes;
+#if defined(_WIN32)
+	std::string objectName = "Local\\" + name;
+	if (create) {
+		mapping->handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(bytes >> 32), (DWORD)bytes, objectName.c_str());
+	}
+	else {
+		mapping->handle = OpenFileMappingA(FILE_MAP_READ, FALSE, objectName.c_str());
+	}
+	if (mapping->handle == NULL) {
+		return false;
+	}
+	mapping->base = (uint8_t *)MapViewOfFile(mapping->handle, create ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, (SIZE_T)bytes);
+	if (mapping->base == NULL) {
+		CloseHandle(mapping->handle);
+		return false;
+	}
+#else
+	std::string objectName = "/" + name;
+	mapping->fd = shm_open(objectName.c_str(), create ? (O_CREAT | O_RDWR) : O_RDONLY, 0644);
+	if (mapping->fd < 0) {
+		return false;
+	}
+	if (create && ftruncate(mapping->fd, (off_t)bytes) != 0) {
+		close(mapping->fd);
+		return false;
+	}
+	//Readers find the size from the object itself
+	if (!create) {
+		struct stat status;
+		fstat(mapping->fd, &status);
+		mapping->bytes = (uint64_t)status.st_size;
+	}
+	void *base = mmap(NULL, (size_t)mapping->bytes, create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, mapping->fd, 0);
+	if (base == MAP_FAILED) {
+		close(mapping->fd);
+		return false;
+	}
+	mapping->base = (uint8_t *)base;
+#endif
+	return true;
+}
+
+inline void unmapSharedRing(sharedRingMapping *mapping) {
+	if (mapping->base == NULL) {
+		return;
+	}
+#if defined(_WIN32)
+	UnmapViewOfFile(mapping->base);
+	CloseHandle(mapping->handle);
+#else
+	munmap(mapping->base, (size_t)mapping->bytes);
+	close(mapping->fd);
+#endif
+	mapping->base = NULL;
+}
+
+//A window as seen by a reader, the pointers point straight into shared memory
+struct ringWindowView {
+	ringRecordHeader header;
+	const uint64_t *windowedTimes;
+	const uint8_t *windowedEdges;
+	const uint64_t *clockTimes;
+	const uint8_t *clockEdges;
+	uint64_t pos;
+};
+
+//Reference reader, each reader keeps its own position so any number can follow the same ring
+class sharedTagRingReader {
+public:
+	sharedTagRingReader() : header(NULL), data(NULL), readPos(0), lapped(0) {
+		mapping.base = NULL;
+	}
+	~sharedTagRingReader() {
+		unmapSharedRing(&mapping);
+	}
+	//Attach to a ring, reading starts with the next window published
+	bool open(const std::string &name) {
+		if (!mapSharedRing(name, 0, false, &mapping)) {
+			return false;
+		}
+		header = (const ringHeader *)mapping.base;
+		if (mapping.bytes < ringHeaderBytes || header->magic != ringMagic || header->version != ringVersion) {
+			unmapSharedRing(&mapping);
+			return false;
+		}
+		data = mapping.base + header->headerBytes;
+		readPos = header->commitPos.load(std::memory_order_acquire);
+		return true;
+	}
+	//Fetch the next record without copying, false if nothing new has been committed
+	bool next(ringWindowView *view) {
+		for (;;) {
+			uint64_t commit = header->commitPos.load(std::memory_order_acquire);
+			if (readPos >= commit) {
+				return false;
+			}
+			if (!stillThere(readPos)) {
+				//Writer went round the ring past us, start again from the newest record
+				lapped++;
+				readPos = header->lastRecordPos.load(std::memory_order_acquire);
+				continue;
+			}
+			uint64_t offset = readPos % header->dataBytes;
+			if (header->dataBytes - offset < sizeof(ringRecordHeader)) {
+				readPos += header->dataBytes - offset;
+				continue;
+			}
+			const uint8_t *record = data + offset;
+			view->header = *(const ringRecordHeader *)record;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (!stillThere(readPos) || view->header.recordBytes == 0) {
+				continue;
+			}
+			view->pos = readPos;
+			readPos += view->header.recordBytes;
+			if (view->header.flags & ringRecordPadding) {
+				continue;
+			}
+			const uint8_t *columns = record + sizeof(ringRecordHeader);
+			view->windowedTimes = (const uint64_t *)columns;
+			view->clockTimes = view->windowedTimes + view->header.numWindowed;
+			view->windowedEdges = (const uint8_t *)(view->clockTimes + view->header.numClock);
+			view->clockEdges = view->windowedEdges + view->header.numWindowed;
+			return true;
+		}
+	}
+	//Wait for the next record, polling every 100us
+	bool waitNext(ringWindowView *view, uint32_t timeoutMillis) {
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+		while (!next(view)) {
+			if (std::chrono::steady_clock::now() >= deadline) {
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return true;
+	}
+	//Call once done with a view, false if the writer overwrote it while it was being used
+	bool valid(const ringWindowView *view) const {
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return stillThere(view->pos);
+	}
+	//Times the reader fell a whole ring behind
+	uint64_t lapCount() const {
+		return lapped;
+	}
+private:
+	bool stillThere(uint64_t pos) const {
+		return header->claimPos.load(std::memory_order_acquire) <= pos + header->dataBytes;
+	}
+	sharedRingMapping mapping;
+	const ringHeader *header;
+	const uint8_t *data;
+	uint64_t readPos;
+	uint64_t lapped;
+};
+
+struct tagWindow;
+
+//Writer side, owned by the acquisition process
+struct sharedTagRing {
+	sharedRingMapping mapping;
+	ringHeader *header;
+	uint8_t *data;
+	uint64_t seq;
+	//Windows too big to ever fit in the ring
+	uint64_t skipped;
+};
+
+//Create (or take over) the named ring with dataBytes of room for records
+bool createSharedTagRing(sharedTagRing *ring, const std::string &name, uint64_t dataBytes);
+
+//Copy a window (or shot end marker) into the ring
+void publishWindow(sharedTagRing *ring, const tagWindow *window);
+
+void closeSharedTagRing(sharedTagRing *ring);
@@ -0,0 +1,211 @@
+// shotPublisher.cpp : Per shot summaries pushed to local subscribers as soon as a shot ends
+//
+
+#include "stdafx.h"
+#include "shotPublisher.h"
+#include "windowManager.h"
+#include "pipelineMetrics.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#endif
+
+#if defined(_WIN32)
+static const int sendFlags = 0;
+#else
+//Never block on a full subscriber and never die of SIGPIPE on a gone one
+static const int sendFlags = MSG_DONTWAIT | MSG_NOSIGNAL;
+#endif
+
+static void setNonBlocking(SOCKET socket)
+{
+#if defined(_WIN32)
+	u_long nonBlocking = 1;
+	ioctlsocket(socket, FIONBIO, &nonBlocking);
+#else
+	fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+static SOCKET listenTcp(uint16_t port)
+{
+	SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+	int reuse = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const SockOpt_t *)&reuse, sizeof(reuse));
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, 4) != 0) {
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+	return listenSocket;
+}
+
+static SOCKET listenUnix(const std::string &path)
+{
+#if defined(_WIN32)
+	std::cout << "unix sockets are not available on Windows, publish on tcp:port" << std::endl;
+	return INVALID_SOCKET;
+#else
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (path.size() >= sizeof(address.sun_path)) {
+		return INVALID_SOCKET;
+	}
+	SOCKET listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path.c_str());
+	//A socket file left by an earlier run that did not shut down cleanly
+	unlink(path.c_str());
+	if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenSocket, 4) != 0) {
+		closesocket(listenSocket);
+		return INVALID_SOCKET;
+	}
+	return listenSocket;
+#endif
+}
+
+bool startShotPublisher(shotPublisher *publisher, const std::string &address)
+{
+#if defined(_WIN32)
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+	publisher->listenSocket = INVALID_SOCKET;
+	publisher->socketPath.clear();
+	publisher->subscribers.clear();
+	publisher->packetsLost = metrics.packetsLost.load();
+	publisher->deadTimeRemoved = metrics.deadTimeRemoved.load();
+	publisher->published = 0;
+	publisher->subscribersDropped = 0;
+	if (address.compare(0, 4, "tcp:") == 0) {
+		publisher->listenSocket = listenTcp((uint16_t)atoi(address.c_str() + 4));
+	}
+	else if (address.compare(0, 5, "unix:") == 0) {
+		publisher->listenSocket = listenUnix(address.substr(5));
+		publisher->socketPath = address.substr(5);
+	}
+	if (publisher->listenSocket == INVALID_SOCKET) {
+		std::cout << "could not publish shot summaries on " << address << std::endl;
+		return false;
+	}
+	//Subscribers are taken on at the end of each shot, which must not wait for one to turn up
+	setNonBlocking(publisher->listenSocket);
+	return true;
+}
+
+//Accept everyone waiting to subscribe
+static void acceptSubscribers(shotPublisher *publisher)
+{
+	while (true) {
+		SOCKET subscriber = accept(publisher->listenSocket, NULL, NULL);
+		if (subscriber == INVALID_SOCKET) {
+			return;
+		}
+		setNonBlocking(subscriber);
+		if (publisher->socketPath.empty()) {
+			//Summaries are single small writes, Nagle would only hold them back
+			int noDelay = 1;
+			setsockopt(subscriber, IPPROTO_TCP, TCP_NODELAY, (const SockOpt_t *)&noDelay, sizeof(noDelay));
+		}
+		publisher->subscribers.push_back(subscriber);
+	}
+}
+
+static std::string formatSummary(shotPublisher *publisher, const windowManager *manager)
+{
+	std::ostringstream out;
+	out << "{\"shot\":" << manager->shotNum << ",\"gates\":[";
+	for (size_t g = 0; g < manager->gates.size(); g++) {
+		const gateStream *stream = &manager->gates[g];
+		out << (g == 0 ? "" : ",") << "{\"windows\":" << stream->windowNum << ",\"photons\":[";
+		for (int channel = 0; channel < 8; channel++) {
+			out << (channel == 0 ? "" : ",") << stream->shotPhotons[channel];
+		}
+		out << "],\"windowPhotons\":[";
+		for (size_t w = 0; w < stream->windowPhotons.size(); w++) {
+			out << (w == 0 ? "" : ",") << stream->windowPhotons[w];
+		}
+		out << "],\"coincidences\":" << stream->shotCoincidences << "}";
+	}
+	//OD of each window of the first gate against the same window of the reference gate, as in the statistics. A window
+	//with no light on either side has none
+	if (manager->odReferenceGate != 0 && manager->odReferenceGate < manager->gates.size()) {
+		const std::vector<uint64_t> &signal = manager->gates[0].windowPhotons;
+		const std::vector<uint64_t> &reference = manager->gates[manager->odReferenceGate].windowPhotons;
+		size_t numWindows = signal.size() < reference.size() ? signal.size() : reference.size();
+		out << "],\"od\":[";
+		for (size_t w = 0; w < numWindows; w++) {
+			out << (w == 0 ? "" : ",");
+			if (signal[w] != 0 && reference[w] != 0) {
+				out << std::log((double)reference[w] / (double)signal[w]);
+			}
+			else {
+				out << "null";
+			}
+		}
+	}
+	uint64_t packetsLost = metrics.packetsLost.load();
+	uint64_t deadTimeRemoved = metrics.deadTimeRemoved.load();
+	uint64_t lastPhotonAge = std::chrono::duration_cast<std::chrono::microseconds>(stampNow() - manager->lastPhotonReceived).count();
+	out << "],\"windowsCutShort\":" << manager->windowsCutShort << ",\"unpairedEdges\":" << manager->unpairedEdges;
+	out << ",\"windowsDegraded\":" << manager->windowsDegraded << ",\"dropped\":" << (manager->droppingShot ? "true" : "false");
+	out << ",\"packetsLost\":" << packetsLost - publisher->packetsLost << ",\"deadTimeRemoved\":" << deadTimeRemoved - publisher->deadTimeRemoved;
+	out << ",\"lastPhotonAgeMicros\":" << lastPhotonAge << "}\n";
+	publisher->packetsLost = packetsLost;
+	publisher->deadTimeRemoved = deadTimeRemoved;
+	return out.str();
+}
+
+void publishShot(shotPublisher *publisher, const windowManager *manager)
+{
+	acceptSubscribers(publisher);
+	std::string summary = formatSummary(publisher, manager);
+	size_t kept = 0;
+	for (size_t s = 0; s < publisher->subscribers.size(); s++) {
+		SOCKET subscriber = publisher->subscribers[s];
+		//Anything short of the whole line would leave the stream torn, so a subscriber this far behind is let go
+		if (send(subscriber, summary.c_str(), (int)summary.size(), sendFlags) != (int)summary.size()) {
+			closesocket(subscriber);
+			publisher->subscribersDropped++;
+			continue;
+		}
+		publisher->subscribers[kept++] = subscriber;
+	}
+	publisher->subscribers.resize(kept);
+	publisher->published++;
+}
+
+void stopShotPublisher(shotPublisher *publisher)
+{
+	for (size_t s = 0; s < publisher->subscribers.size(); s++) {
+		closesocket(publisher->subscribers[s]);
+	}
+	publisher->subscribers.clear();
+	closesocket(publisher->listenSocket);
+	publisher->listenSocket = INVALID_SOCKET;
+#if !defined(_WIN32)
+	if (!publisher->socketPath.empty()) {
+		unlink(publisher->socketPath.c_str());
+	}
+#endif
+	std::cout << publisher->published << " shot summaries published";
+	if (publisher->subscribersDropped != 0) {
+		std::cout << ", " << publisher->subscribersDropped << " subscribers dropped for falling behind";
+	}
+	std::cout << std::endl;
+}
@@ -0,0 +1,40 @@
+// shotPublisher.h : Per shot summaries pushed to local subscribers as soon as a shot ends
+//
+//Subscribers connect to a loopback TCP port or a Unix socket and get one JSON line per shot, sent from the decode loop
+//as the last window closes rather than once the shot file is written:
+//  {"shot":12,"gates":[{"windows":20,"photons":[0,0,812,790,0,0,0,0],"windowPhotons":[81,...],"coincidences":3}],
+//   "windowsCutShort":0,"unpairedEdges":0,"windowsDegraded":0,"dropped":false,"packetsLost":0,"deadTimeRemoved":14,
+//   "lastPhotonAgeMicros":212}
+//photons are per tag channel over the shot, windowPhotons the photon total of each window in order. windowsDegraded
+//and dropped tell what backpressure gave up, the photon tallies are complete either way. With --od-reference-gate an
+//"od" array after the gates has ln(reference / signal) of each window of the first gate, null where either side saw
+//no photons. A subscriber that
+//cannot take a summary without blocking is dropped, the acquisition never waits on one
+
+#pragma once
+
+#include "TTMLib.h"
+#include <string>
+#include <vector>
+
+struct windowManager;
+
+struct shotPublisher {
+	SOCKET listenSocket;
+	//Path of the Unix socket to remove when done, empty for TCP
+	std::string socketPath;
+	std::vector<SOCKET> subscribers;
+	//Loss counters at the end of the previous shot, summaries carry what was lost during their own shot
+	uint64_t packetsLost;
+	uint64_t deadTimeRemoved;
+	uint64_t published;
+	uint64_t subscribersDropped;
+};
+
+//Listen at tcp:port (loopback only) or unix:path, false if the address is not understood or cannot be bound
+bool startShotPublisher(shotPublisher *publisher, const std::string &address);
+
+//Take on any new subscribers and send them the summary of the shot the manager has just finished
+void publishShot(shotPublisher *publisher, const windowManager *manager);
+
+void stopShotPublisher(shotPublisher *publisher);
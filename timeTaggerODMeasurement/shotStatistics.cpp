@@ -0,0 +1,199 @@
+// shotStatistics.cpp : Running mean and variance over shots of the window counts, count bins and OD, kept per run key
+//
+
+#include "stdafx.h"
+#include "shotStatistics.h"
+#include "H5Cpp.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+void initShotStatistics(shotStatistics *stats, const acquisitionOptions *options)
+{
+	stats->path = options->statsFile;
+	stats->key = options->statsKey;
+	stats->keys.clear();
+	stats->countBins = options->countsOnly ? options->countBins : 0;
+	stats->odReferenceGate = options->odReferenceGate;
+	stats->flushEvery = options->statsEvery;
+	stats->shotsSinceFlush = 0;
+}
+
+void setStatisticsKey(shotStatistics *stats, const std::string &key)
+{
+	stats->key = key;
+}
+
+//Statistics of a gate under the current key, made on first use
+static gateStatistics *currentGate(shotStatistics *stats, uint32_t gateNum)
+{
+	keyStatistics *key = &stats->keys[stats->key];
+	if (key->gates.size() <= gateNum) {
+		key->gates.resize(gateNum + 1);
+	}
+	return &key->gates[gateNum];
+}
+
+void addWindowStatistics(shotStatistics *stats, const tagWindow *window)
+{
+	gateStatistics *gate = currentGate(stats, window->gateNum);
+	if (!window->complete) {
+		gate->incompleteWindows++;
+		return;
+	}
+	size_t w = window->windowNum;
+	if (gate->windowCounts.size() < (w + 1) * 8) {
+		gate->windowCounts.resize((w + 1) * 8, runningStat());
+	}
+	uint64_t photons = 0;
+	for (int channel = 0; channel < 8; channel++) {
+		addSample(&gate->windowCounts[w * 8 + channel], window->photons[channel]);
+		photons += window->photons[channel];
+	}
+	if (gate->shotPhotons.size() < w + 1) {
+		gate->shotPhotons.resize(w + 1, 0);
+	}
+	gate->shotPhotons[w] = photons;
+	//Windows degraded under backpressure only have good photon totals
+	if (stats->countBins != 0 && !window->counts.empty() && window->storage == storeFull) {
+		size_t binsPerWindow = window->counts.size();
+		uint32_t countRows = (uint32_t)(binsPerWindow / stats->countBins);
+		//Bins of a different layout cannot be added to the old ones, they start over
+		if (countRows != gate->countRows) {
+			if (gate->countRows != 0) {
+				std::cout << "count rows of gate " << window->gateNum << " went from " << gate->countRows << " to " << countRows << ", bin statistics start again" << std::endl;
+			}
+			gate->binCounts.clear();
+			gate->countRows = countRows;
+		}
+		if (gate->binCounts.size() < (w + 1) * binsPerWindow) {
+			gate->binCounts.resize((w + 1) * binsPerWindow, runningStat());
+		}
+		for (size_t b = 0; b < binsPerWindow; b++) {
+			addSample(&gate->binCounts[w * binsPerWindow + b], window->counts[b]);
+		}
+	}
+}
+
+void endStatisticsShot(shotStatistics *stats)
+{
+	keyStatistics *key = &stats->keys[stats->key];
+	key->shots++;
+	if (stats->odReferenceGate != 0 && key->gates.size() > stats->odReferenceGate) {
+		const std::vector<uint64_t> &signal = key->gates[0].shotPhotons;
+		const std::vector<uint64_t> &reference = key->gates[stats->odReferenceGate].shotPhotons;
+		size_t numWindows = signal.size() < reference.size() ? signal.size() : reference.size();
+		if (key->od.size() < numWindows) {
+			key->od.resize(numWindows, runningStat());
+		}
+		//A window with no light on either side has no OD to speak of and is left out
+		for (size_t w = 0; w < numWindows; w++) {
+			if (signal[w] != 0 && reference[w] != 0) {
+				addSample(&key->od[w], std::log((double)reference[w] / (double)signal[w]));
+			}
+		}
+	}
+	for (size_t g = 0; g < key->gates.size(); g++) {
+		key->gates[g].shotPhotons.clear();
+	}
+	stats->shotsSinceFlush++;
+	if (stats->flushEvery != 0 && stats->shotsSinceFlush >= stats->flushEvery) {
+		flushShotStatistics(stats);
+	}
+}
+
+//Mean, variance and samples of a block of statistics as three datasets of the given shape
+static void writeStats(H5::Group *group, const std::string &name, const std::vector<runningStat> &values, int rank, const hsize_t *dims)
+{
+	size_t numValues = values.size();
+	std::vector<double> means(numValues);
+	std::vector<double> variances(numValues);
+	std::vector<uint64_t> samples(numValues);
+	for (size_t i = 0; i < numValues; i++) {
+		means[i] = values[i].mean;
+		variances[i] = sampleVariance(&values[i]);
+		samples[i] = values[i].samples;
+	}
+	H5::DataSpace dspace(rank, dims);
+	H5::DataSet meanSet = group->createDataSet(name + "Mean", H5::PredType::NATIVE_DOUBLE, dspace);
+	H5::DataSet varianceSet = group->createDataSet(name + "Variance", H5::PredType::NATIVE_DOUBLE, dspace);
+	H5::DataSet sampleSet = group->createDataSet(name + "Samples", H5::PredType::NATIVE_UINT64, dspace);
+	if (numValues != 0) {
+		meanSet.write(&means[0], H5::PredType::NATIVE_DOUBLE);
+		varianceSet.write(&variances[0], H5::PredType::NATIVE_DOUBLE);
+		sampleSet.write(&samples[0], H5::PredType::NATIVE_UINT64);
+	}
+}
+
+static void writeGate(H5::Group *group, const gateStatistics *gate, uint32_t countBins)
+{
+	hsize_t dims[3];
+	dims[0] = gate->windowCounts.size() / 8;
+	dims[1] = 8;
+	writeStats(group, "Count", gate->windowCounts, 2, dims);
+	H5::DataSpace scalar(H5S_SCALAR);
+	H5::Attribute incomplete = group->createAttribute("IncompleteWindows", H5::PredType::NATIVE_UINT64, scalar);
+	incomplete.write(H5::PredType::NATIVE_UINT64, &gate->incompleteWindows);
+	if (countBins != 0 && gate->countRows != 0) {
+		dims[0] = gate->binCounts.size() / gate->countRows / countBins;
+		dims[1] = gate->countRows;
+		dims[2] = countBins;
+		writeStats(group, "Bin", gate->binCounts, 3, dims);
+	}
+}
+
+//Keys become group names, so they cannot hold slashes
+static std::string keyGroupName(const std::string &key)
+{
+	std::string name = "/" + (key.empty() ? std::string("run") : key);
+	for (size_t i = 1; i < name.size(); i++) {
+		if (name[i] == '/') {
+			name[i] = '_';
+		}
+	}
+	return name;
+}
+
+bool flushShotStatistics(shotStatistics *stats)
+{
+	stats->shotsSinceFlush = 0;
+	if (stats->keys.empty()) {
+		return true;
+	}
+	//Written aside and swapped in, like the shot files, so a reader never sees half of it
+	std::string partPath = stats->path + ".part";
+	try {
+		H5::H5File file(partPath, H5F_ACC_TRUNC);
+		H5::DataSpace scalar(H5S_SCALAR);
+		for (std::map<std::string, keyStatistics>::const_iterator k = stats->keys.begin(); k != stats->keys.end(); ++k) {
+			const keyStatistics *key = &k->second;
+			std::string groupName = keyGroupName(k->first);
+			H5::Group group = file.createGroup(groupName);
+			H5::Attribute shots = group.createAttribute("Shots", H5::PredType::NATIVE_UINT64, scalar);
+			shots.write(H5::PredType::NATIVE_UINT64, &key->shots);
+			for (size_t g = 0; g < key->gates.size(); g++) {
+				if (g == 0) {
+					writeGate(&group, &key->gates[g], stats->countBins);
+					continue;
+				}
+				H5::Group gateGroup = file.createGroup(groupName + "/Gate" + std::to_string(g));
+				writeGate(&gateGroup, &key->gates[g], stats->countBins);
+			}
+			if (stats->odReferenceGate != 0) {
+				hsize_t dims[1];
+				dims[0] = key->od.size();
+				writeStats(&group, "OD", key->od, 1, dims);
+			}
+		}
+	}
+	catch (H5::Exception &error) {
+		std::cout << "could not write statistics to " << partPath << ": " << error.getDetailMsg() << std::endl;
+		return false;
+	}
+	std::remove(stats->path.c_str());
+	if (std::rename(partPath.c_str(), stats->path.c_str()) != 0) {
+		std::cout << "could not move " << partPath << " to " << stats->path << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,79 @@
+// shotStatistics.h : Running mean and variance over shots of the window counts, count bins and OD, kept per run key
+//
+
+#pragma once
+
+#include "windowManager.h"
+#include <map>
+#include <string>
+#include <vector>
+
+//Mean and variance of one quantity over shots, updated one shot at a time (Welford) so nothing but these three
+//numbers is kept however many shots go by
+struct runningStat {
+	uint64_t samples;
+	double mean;
+	//Sum of the squared differences from the mean
+	double squares;
+};
+
+inline void addSample(runningStat *stat, double value) {
+	stat->samples++;
+	double delta = value - stat->mean;
+	stat->mean += delta / stat->samples;
+	stat->squares += delta * (value - stat->mean);
+}
+
+//Sample variance, 0 until there are two samples
+inline double sampleVariance(const runningStat *stat) {
+	return stat->samples > 1 ? stat->squares / (stat->samples - 1) : 0;
+}
+
+//Statistics of the windows of one gate, windows are matched up across shots by their number in the shot
+struct gateStatistics {
+	//Photons of each window and tag channel, window * 8 + channel
+	std::vector<runningStat> windowCounts;
+	//Counts only mode bins of each window, (window * countRows + row) * countBins + bin
+	std::vector<runningStat> binCounts;
+	uint32_t countRows;
+	//Windows cut short, left out of everything as their counts are not comparable with whole ones
+	uint64_t incompleteWindows;
+	//Photon totals of the windows of the shot in progress, for the OD
+	std::vector<uint64_t> shotPhotons;
+};
+
+//Everything gathered under one key
+struct keyStatistics {
+	uint64_t shots;
+	std::vector<gateStatistics> gates;
+	//OD of each window of the first gate against the same window of the reference gate
+	std::vector<runningStat> od;
+};
+
+struct shotStatistics {
+	//HDF5 file the statistics are flushed to, rewritten whole each time
+	std::string path;
+	//Key the shots are gathered under now, a run or configuration tag
+	std::string key;
+	std::map<std::string, keyStatistics> keys;
+	uint32_t countBins;
+	//Gate whose windows hold the probe without atoms, OD = ln(reference photons / photons) window by window. 0 for no OD
+	uint32_t odReferenceGate;
+	//Shots between flushes, 0 to flush only at the end
+	uint32_t flushEvery;
+	uint32_t shotsSinceFlush;
+};
+
+void initShotStatistics(shotStatistics *stats, const acquisitionOptions *options);
+
+//Gather the shots from now on under another key, the ones gathered so far stay as they are
+void setStatisticsKey(shotStatistics *stats, const std::string &key);
+
+//Add the counts of a written window to the statistics of its window number
+void addWindowStatistics(shotStatistics *stats, const tagWindow *window);
+
+//Finish the shot, adding its OD, and flush if enough shots have gone by
+void endStatisticsShot(shotStatistics *stats);
+
+//Write every key's statistics to the file, groups named after the keys with gate n in Gate<n> below them
+bool flushShotStatistics(shotStatistics *stats);
@@ -5,10 +5,20 @@
 
 #pragma once
 
+#if defined(_WIN32)
 #include "targetver.h"
+#endif
 
 #include <stdio.h>
+#if defined(_WIN32)
 #include <tchar.h>
+#else
+#include <string.h>
+#include <unistd.h>
+//Stand-ins for the Windows calls used outside the tagger library
+#define Sleep(X) usleep((X) * 1000)
+#define strtok_s strtok_r
+#endif
 
 
 
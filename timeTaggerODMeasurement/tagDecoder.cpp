@@ -0,0 +1,192 @@
+// tagDecoder.cpp : Decoding of packed time tagger words into tag columns
+//
+
+#include "stdafx.h"
+#include "tagDecoder.h"
+#include <iostream>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TAG_SCAN_SSE2
+#endif
+
+void initDecoderState(decoderState *state)
+{
+	state->highWord = 0;
+	state->gateOpen = false;
+	//Whatever the first packet brings, it will not be this
+	state->dataFormat = TTFormat_Unknown;
+	state->decode = NULL;
+}
+
+//The decode loop of a single format, every layout decision is made at compile time so the loop over the words does
+//nothing but decode
+template <TTMDataFormat_t format>
+static void decodeFormat(const void *data, size_t numBytes, decoderState *state, tagColumns *tags)
+{
+	typedef tagFormat<format> layout;
+	const typename layout::word *words = (const typename layout::word *)data;
+	size_t numWords = numBytes / sizeof(typename layout::word);
+	const uint64_t timeMask = ((uint64_t)1 << layout::timeBits) - 1;
+	for (size_t i = 0; i < numWords; i++) {
+		uint64_t word = words[i];
+		if (layout::packed) {
+			//High words just move the upper part of the timestamp on
+			if (word >> 31) {
+				state->highWord = (uint32_t)word & 0x7FFFFFFF;
+				continue;
+			}
+		}
+		//Null words are padding
+		if (word != 0) {
+			uint64_t high = layout::packed ? (uint64_t)state->highWord << layout::timeBits : 0;
+			tags->times.push_back(high | (word & timeMask));
+			tags->edges.push_back((uint8_t)((word >> layout::timeBits) & 0xF));
+		}
+	}
+}
+
+packetDecoder decoderForFormat(uint8_t dataFormat)
+{
+	switch (dataFormat) {
+	case TTFormat_IMode_EXT64_PACK:
+		return decodeFormat<TTFormat_IMode_EXT64_PACK>;
+	case TTFormat_MultiIMode_EXT64_PACK:
+		return decodeFormat<TTFormat_MultiIMode_EXT64_PACK>;
+	case TTFormat_IMode_EXT64_FLAT:
+		return decodeFormat<TTFormat_IMode_EXT64_FLAT>;
+	case TTFormat_MultiIMode_EXT64_FLAT:
+		return decodeFormat<TTFormat_MultiIMode_EXT64_FLAT>;
+	default:
+		//Raw GPX and the G, R and M modes count time from start pulses in their own bins
+		return NULL;
+	}
+}
+
+//Pick the decoder for the format of a packet, once per run unless the tagger is reconfigured to another format
+static void checkFormat(const TTMDataPacket_t *tagBuffer, decoderState *state)
+{
+	if (tagBuffer->Header.DataFormat == state->dataFormat) {
+		return;
+	}
+	state->dataFormat = tagBuffer->Header.DataFormat;
+	state->decode = decoderForFormat(state->dataFormat);
+	if (state->decode == NULL) {
+		std::cout << "packets in data format " << (int)state->dataFormat << " have no I-Mode continuous tags and are not decoded" << std::endl;
+	}
+}
+
+void decodeTags(const TTMDataPacket_t *tagBuffer, decoderState *state, tagColumns *block)
+{
+	block->times.clear();
+	block->edges.clear();
+	checkFormat(tagBuffer, state);
+	if (state->decode != NULL) {
+		//Only the first DataSize bytes of the packet hold tags
+		state->decode(tagBuffer->Data.RawData, tagBuffer->Header.DataSize, state, block);
+	}
+}
+
+//Packed words seen as plain 32 bit numbers, bit 31 is the high/low marker (see TimetagI64Pack). As signed numbers the
+//low words of channels 1..7 are exactly the ones above this, high words are negative and gate edges and padding below
+const int32_t otherChannelWords = 0x0FFFFFFF;
+
+//First word from begin on that is not a low word of channels 1..7
+static size_t nextGateWord(const uint32_t *words, size_t begin, size_t end)
+{
+	size_t i = begin;
+#if defined(TAG_SCAN_SSE2)
+	//Eight words at a time, falling through to the word by word loop to find which one stopped the scan
+	const __m128i threshold = _mm_set1_epi32(otherChannelWords);
+	for (; i + 8 <= end; i += 8) {
+		__m128i first = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(words + i)), threshold);
+		__m128i second = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)(words + i + 4)), threshold);
+		if (_mm_movemask_epi8(_mm_and_si128(first, second)) != 0xFFFF) {
+			break;
+		}
+	}
+#endif
+	while (i < end && (int32_t)words[i] > otherChannelWords) {
+		i++;
+	}
+	return i;
+}
+
+size_t decodeGatedTags(const TTMDataPacket_t *tagBuffer, decoderState *state, tagColumns *block)
+{
+	checkFormat(tagBuffer, state);
+	if (state->dataFormat != TTFormat_IMode_EXT64_PACK) {
+		decodeTags(tagBuffer, state, block);
+		return 0;
+	}
+	block->times.clear();
+	block->edges.clear();
+	const uint32_t *words = (const uint32_t *)tagBuffer->Data.TimetagI64Pack;
+	size_t numWords = packetWordCount(tagBuffer);
+	size_t skipped = 0;
+	size_t i = 0;
+	while (i < numWords) {
+		if (!state->gateOpen) {
+			size_t next = nextGateWord(words, i, numWords);
+			skipped += next - i;
+			i = next;
+			if (i == numWords) {
+				break;
+			}
+		}
+		uint32_t payload = words[i] & 0x7FFFFFFF;
+		if (words[i] >> 31) {
+			state->highWord = payload;
+		}
+		else if (payload != 0) {
+			uint8_t edge = (uint8_t)((payload >> 27) & 0xF);
+			if (edgeChannel(edge) == 0) {
+				state->gateOpen = edgeSlope(edge) == 1;
+			}
+			block->times.push_back(((uint64_t)state->highWord << 27) | (payload & 0x7FFFFFF));
+			block->edges.push_back(edge);
+		}
+		i++;
+	}
+	return skipped;
+}
+
+void decodeTagWords(const TimetagI64Pack *words, size_t numWords, decoderState *state, tagColumns *tags)
+{
+	decodeFormat<TTFormat_IMode_EXT64_PACK>(words, numWords * sizeof(TimetagI64Pack), state, tags);
+}
+
+void decodeStoredWords(const uint32_t *words, size_t numWords, decoderState *state, tagColumns *tags)
+{
+	//Stored words keep the high/low flag in bit 0 rather than bit 31
+	for (size_t i = 0; i < numWords; i++) {
+		uint32_t payload = words[i] >> 1;
+		if (words[i] & 1) {
+			state->highWord = payload;
+		}
+		else if (payload != 0) {
+			tags->times.push_back(((uint64_t)state->highWord << 27) | (payload & 0x7FFFFFF));
+			tags->edges.push_back((uint8_t)((payload >> 27) & 0xF));
+		}
+	}
+}
+
+void encodeTagWords(const tagColumns *tags, size_t begin, size_t end, uint32_t *highWord, std::vector<uint32_t> *wordsOut)
+{
+	for (size_t i = begin; i < end; i++) {
+		uint64_t time = tags->times[i];
+		uint32_t high = (uint32_t)(time >> 27) & 0x7FFFFFFF;
+		if (high != *highWord) {
+			*highWord = high;
+			wordsOut->push_back(highTagWord(time));
+		}
+		wordsOut->push_back(lowTagWord(time, tags->edges[i]));
+	}
+}
+
+void encodeWindowColumns(const tagColumns *tags, uint64_t startTime, std::vector<uint32_t> *wordsOut)
+{
+	uint32_t highWord = windowHighWord(startTime);
+	wordsOut->clear();
+	wordsOut->reserve(tags->times.size() + tags->times.size() / 64 + 1);
+	encodeTagWords(tags, 0, tags->times.size(), &highWord, wordsOut);
+}
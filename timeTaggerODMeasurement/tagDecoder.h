@@ -0,0 +1,113 @@
+// tagDecoder.h : Decoding of packed time tagger words into tag columns
+//
+
+#pragma once
+
+#include "TTMLib.h"
+#include <vector>
+
+//Decoded tags stored column-wise, times are full timestamps (high word bits 27..57, low word bits 0..26) in 82.3ps ticks
+//and edges hold the channel number in bits 1..3 and the slope in bit 0
+struct tagColumns {
+	std::vector<uint64_t> times;
+	std::vector<uint8_t> edges;
+};
+
+struct decoderState;
+
+//Decodes the DataSize bytes of a packet in one data format, appending to the columns
+typedef void (*packetDecoder)(const void *data, size_t numBytes, decoderState *state, tagColumns *tags);
+
+//State carried from one packet to the next
+struct decoderState {
+	uint32_t highWord;
+	//Gate level as last seen by decodeGatedTags, the gate is channel 0 and opens on its rising edge
+	bool gateOpen;
+	//Data format of the packets so far and its decoder, picked on the first packet and only again if the format changes.
+	//NULL for formats that are not decoded
+	uint8_t dataFormat;
+	packetDecoder decode;
+};
+
+void initDecoderState(decoderState *state);
+
+//Layout of the I-Mode continuous data formats, the ones with tags in 82.3ps ticks. Packed formats have 32 bit words, a
+//high word (bit 31 set) with the upper time bits and low words with the lower timeBits bits of the time. Flat formats
+//have 64 bit words holding the whole time. Either way the slope and channel sit just above the time bits, and on the
+//multiboard formats the board index above those (the boards are not told apart, only one is ever connected)
+template <TTMDataFormat_t format> struct tagFormat;
+
+template <> struct tagFormat<TTFormat_IMode_EXT64_PACK> {
+	typedef uint32_t word;
+	static const bool packed = true;
+	static const int timeBits = 27;
+};
+
+template <> struct tagFormat<TTFormat_MultiIMode_EXT64_PACK> {
+	typedef uint32_t word;
+	static const bool packed = true;
+	static const int timeBits = 23;
+};
+
+template <> struct tagFormat<TTFormat_IMode_EXT64_FLAT> {
+	typedef uint64_t word;
+	static const bool packed = false;
+	static const int timeBits = 60;
+};
+
+template <> struct tagFormat<TTFormat_MultiIMode_EXT64_FLAT> {
+	typedef uint64_t word;
+	static const bool packed = false;
+	static const int timeBits = 56;
+};
+
+//Decoder for packets of a data format, NULL if the format is not one of the tagFormat ones
+packetDecoder decoderForFormat(uint8_t dataFormat);
+
+inline uint8_t edgeChannel(uint8_t edge) {
+	return edge >> 1;
+}
+
+inline uint8_t edgeSlope(uint8_t edge) {
+	return edge & 1;
+}
+
+//Number of packed words actually filled in a packet
+inline size_t packetWordCount(const TTMDataPacket_t *tagBuffer) {
+	return tagBuffer->Header.DataSize / sizeof(tagBuffer->Data.TimetagI64Pack[0]);
+}
+
+//Decode a packet into tag columns with the decoder for its data format, the columns are cleared first
+void decodeTags(const TTMDataPacket_t *tagBuffer, decoderState *state, tagColumns *block);
+
+//Decode a packet as decodeTags, but while the gate is closed only look at gate edges and high words. Tags of the other
+//channels outside the gate are skipped over without being decoded, returns how many were skipped. Only single board
+//packed packets are skipped through, other formats are decoded whole
+size_t decodeGatedTags(const TTMDataPacket_t *tagBuffer, decoderState *state, tagColumns *block);
+
+//Decode packed words as they arrive from the tagger, appending to the columns
+void decodeTagWords(const TimetagI64Pack *words, size_t numWords, decoderState *state, tagColumns *tags);
+
+//Decode words in the format written to the HDF5 files (see encodeTagWords), appending to the columns
+void decodeStoredWords(const uint32_t *words, size_t numWords, decoderState *state, tagColumns *tags);
+
+//Encode tags [begin, end) back into the packed high/low word format used in the HDF5 files, a high word is emitted
+//whenever the high part of the timestamp differs from *highWord which is updated as we go
+void encodeTagWords(const tagColumns *tags, size_t begin, size_t end, uint32_t *highWord, std::vector<uint32_t> *wordsOut);
+
+//High part of a window start, which the packed tag words of the window pick up from
+inline uint32_t windowHighWord(uint64_t startTime) {
+	return (uint32_t)(startTime >> 27) & 0x7FFFFFFF;
+}
+
+//Encode all the tags of a window in place of the contents of wordsOut, from the high word of the window start
+void encodeWindowColumns(const tagColumns *tags, uint64_t startTime, std::vector<uint32_t> *wordsOut);
+
+//Packed high and low words of a single timestamp, as used for the start and end tags
+inline uint32_t highTagWord(uint64_t time) {
+	return (((uint32_t)(time >> 27) & 0x7FFFFFFF) << 1) | 1;
+}
+
+inline uint32_t lowTagWord(uint64_t time, uint8_t edge) {
+	return ((((uint32_t)edge << 27) | (uint32_t)(time & 0x7FFFFFF)) << 1) | 0;
+}
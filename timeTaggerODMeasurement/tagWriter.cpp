@@ -0,0 +1,513 @@
+// tagWriter.cpp : Writes closed windows to HDF5 as they arrive, one file per shot
+//
+
+#include "stdafx.h"
+#include "tagWriter.h"
+#include "pipelineMetrics.h"
+#include "H5DOpublic.h"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+void initTagWriter(tagWriter *writer, const acquisitionOptions *options, tagMemory *memory)
+{
+	writer->filename = options->blackhole;
+	writer->groupName = "/Tags";
+	writer->datasetName = "TagWindow";
+	writer->startDataSetName = "StartTag";
+	writer->endDataSetName = "EndTag";
+	writer->channelVect = options->channelVect;
+	writer->file = NULL;
+	writer->gates.resize(options->gates.empty() ? 1 : options->gates.size());
+	for (size_t g = 0; g < writer->gates.size(); g++) {
+		writer->gates[g].groupName = g == 0 ? writer->groupName : writer->groupName + "/Gate" + std::to_string(g);
+	}
+	writer->countBins = options->countsOnly ? options->countBins : 0;
+	writer->countBinTicks = options->countBinTicks;
+	writer->coincWindowTicks = options->coincWindowTicks;
+	writer->coincTags = options->coincTags;
+	writer->compressLevel = options->compressLevel;
+	writer->shotsWritten = 0;
+	writer->memory = memory;
+	writer->ring = NULL;
+	writer->stats = NULL;
+	writer->index = NULL;
+}
+
+//Peak resident memory of the whole process over its lifetime in bytes
+static uint64_t processPeakMemory()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize;
+	}
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+//Write a vector of words as a one dimensional dataset
+static void writeWords(H5::H5File *file, const std::string &datasetName, const std::vector<uint32_t> &words)
+{
+	hsize_t dims[1];
+	dims[0] = words.size();
+	H5::DataSpace dspace(1, dims);
+	H5::DataSet dset(file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
+	//Empty windows still get a (zero length) dataset so window numbering stays contiguous
+	if (!words.empty()) {
+		dset.write(&words[0], H5::PredType::NATIVE_UINT32);
+		countMetric(metrics.bytesWritten, words.size() * sizeof(uint32_t));
+	}
+}
+
+//Dataset of words stored in chunks through the deflate filter
+static H5::DataSet createDeflatedDataSet(H5::H5File *file, const std::string &datasetName, size_t numWords, int compressLevel)
+{
+	hsize_t dims[1];
+	dims[0] = numWords;
+	H5::DataSpace dspace(1, dims);
+	H5::DSetCreatPropList plist;
+	hsize_t chunkDims[1];
+	chunkDims[0] = chunkWordsFor(numWords);
+	plist.setChunk(1, chunkDims);
+	plist.setDeflate(compressLevel);
+	return file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT32, dspace, plist);
+}
+
+void writeTagWords(H5::H5File *file, const std::string &datasetName, const std::vector<uint32_t> &words, const std::vector<compressedChunk> *chunks, int compressLevel)
+{
+	if (compressLevel == 0 || words.size() < compressMinWords) {
+		writeWords(file, datasetName, words);
+		return;
+	}
+	H5::DataSet dset = createDeflatedDataSet(file, datasetName, words.size(), compressLevel);
+	//Words zlib could not deflate beforehand come with no chunks, the filter has another go at them
+	if (chunks != NULL && chunks->empty()) {
+		chunks = NULL;
+	}
+	if (chunks == NULL) {
+		//HDF5 deflates each chunk itself, inside the write call
+		dset.write(&words[0], H5::PredType::NATIVE_UINT32);
+		countMetric(metrics.bytesWritten, words.size() * sizeof(uint32_t));
+		return;
+	}
+	//Chunks deflated beforehand go straight to the file, all the library does is the I/O
+	hsize_t offset[1];
+	size_t chunkWords = chunkWordsFor(words.size());
+	for (size_t c = 0; c < chunks->size(); c++) {
+		const compressedChunk *chunk = &(*chunks)[c];
+		offset[0] = c * chunkWords;
+		if (H5DOwrite_chunk(dset.getId(), H5P_DEFAULT, 0, offset, chunk->bytes.size(), &chunk->bytes[0]) < 0) {
+			std::cout << "could not write chunk " << c << " of " << datasetName << std::endl;
+		}
+		countMetric(metrics.bytesWritten, chunk->bytes.size());
+	}
+}
+
+//Append words to the end of an extendible dataset
+static void appendWords(H5::DataSet *dset, hsize_t *written, const std::vector<uint32_t> &words)
+{
+	if (words.empty()) {
+		return;
+	}
+	hsize_t size[1];
+	size[0] = *written + words.size();
+	dset->extend(size);
+	H5::DataSpace fileSpace = dset->getSpace();
+	hsize_t offset[1];
+	offset[0] = *written;
+	hsize_t count[1];
+	count[0] = words.size();
+	fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	H5::DataSpace memSpace(1, count);
+	dset->write(&words[0], H5::PredType::NATIVE_UINT32, memSpace, fileSpace);
+	countMetric(metrics.bytesWritten, words.size() * sizeof(uint32_t));
+	*written += words.size();
+}
+
+//Write the windowed or clock tags of a window, reading spilled blocks back from disk first. Returns the words written
+static size_t writeWindowTags(H5::H5File *file, const std::string &datasetName, const tagWindow *window, bool clock, int compressLevel)
+{
+	//Words packed (and maybe deflated) by the post-processing stages only need writing
+	if (window->encoded) {
+		const std::vector<compressedChunk> *chunks = window->compressed ? (clock ? &window->clockChunks : &window->windowedChunks) : NULL;
+		const std::vector<uint32_t> &words = clock ? window->clockWords : window->windowedWords;
+		writeTagWords(file, datasetName, words, chunks, compressLevel);
+		return words.size();
+	}
+	const tagColumns *tags = clock ? &window->clockTags : &window->windowedTags;
+	//The packed words start from the high word of the window start, as in the start tags
+	uint32_t highWord = windowHighWord(window->startTime);
+	std::vector<uint32_t> words;
+	bool spilled = false;
+	for (size_t b = 0; b < window->spilled.size(); b++) {
+		spilled = spilled || window->spilled[b].clock == clock;
+	}
+	if (!spilled) {
+		encodeWindowColumns(tags, window->startTime, &words);
+		writeTagWords(file, datasetName, words, NULL, compressLevel);
+		return words.size();
+	}
+	//Spilled windows are written in pieces, so the dataset has to be able to grow
+	hsize_t dims[1];
+	dims[0] = 0;
+	hsize_t maxDims[1];
+	maxDims[0] = H5S_UNLIMITED;
+	H5::DataSpace dspace(1, dims, maxDims);
+	H5::DSetCreatPropList plist;
+	hsize_t chunkDims[1];
+	chunkDims[0] = spillBlockTags;
+	plist.setChunk(1, chunkDims);
+	if (compressLevel != 0) {
+		plist.setDeflate(compressLevel);
+	}
+	H5::DataSet dset(file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT32, dspace, plist));
+	hsize_t written = 0;
+	tagColumns block;
+	for (size_t b = 0; b < window->spilled.size(); b++) {
+		if (window->spilled[b].clock != clock) {
+			continue;
+		}
+		if (!readSpilledBlock(window, &window->spilled[b], &block)) {
+			std::cout << "could not read back spilled tags from " << window->spillPath << std::endl;
+			continue;
+		}
+		words.clear();
+		encodeTagWords(&block, 0, block.times.size(), &highWord, &words);
+		appendWords(&dset, &written, words);
+	}
+	words.clear();
+	encodeTagWords(tags, 0, tags->times.size(), &highWord, &words);
+	appendWords(&dset, &written, words);
+	return (size_t)written;
+}
+
+//Counts of the whole shot for a gate as one windows x channels x bins dataset, channels in the order of the channel list
+static void writeCounts(tagWriter *writer, gateOutput *gate)
+{
+	size_t numWindows = gate->windowStartTags.size() / 2;
+	hsize_t dims[3];
+	dims[0] = numWindows;
+	dims[1] = numWindows != 0 ? gate->shotCounts.size() / numWindows / writer->countBins : 0;
+	dims[2] = writer->countBins;
+	H5::DataSpace dspace(3, dims);
+	std::string datasetName = gate->groupName + '/' + "Counts";
+	H5::DataSet dset(writer->file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
+	if (!gate->shotCounts.empty()) {
+		dset.write(&gate->shotCounts[0], H5::PredType::NATIVE_UINT32);
+		countMetric(metrics.bytesWritten, gate->shotCounts.size() * sizeof(uint32_t));
+	}
+	//Bin width in ticks, the last bin runs on to the end of the window
+	H5::DataSpace scalar(H5S_SCALAR);
+	H5::Attribute binAttribute = dset.createAttribute("BinTicks", H5::PredType::NATIVE_UINT64, scalar);
+	binAttribute.write(H5::PredType::NATIVE_UINT64, &writer->countBinTicks);
+	gate->shotCounts.clear();
+}
+
+//Coincidence counts of the whole shot for a gate, one per window
+static void writeCoincidences(tagWriter *writer, gateOutput *gate)
+{
+	hsize_t dims[1];
+	dims[0] = gate->shotCoincidences.size();
+	H5::DataSpace dspace(1, dims);
+	std::string datasetName = gate->groupName + '/' + "Coincidences";
+	H5::DataSet dset(writer->file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT64, dspace));
+	if (!gate->shotCoincidences.empty()) {
+		dset.write(&gate->shotCoincidences[0], H5::PredType::NATIVE_UINT64);
+		countMetric(metrics.bytesWritten, gate->shotCoincidences.size() * sizeof(uint64_t));
+	}
+	//Coincidence window in ticks
+	H5::DataSpace scalar(H5S_SCALAR);
+	H5::Attribute windowAttribute = dset.createAttribute("WindowTicks", H5::PredType::NATIVE_UINT64, scalar);
+	windowAttribute.write(H5::PredType::NATIVE_UINT64, &writer->coincWindowTicks);
+	gate->shotCoincidences.clear();
+}
+
+static std::string partFilename(const tagWriter *writer)
+{
+	return writer->shotFilename + ".part";
+}
+
+//With an index every shot is kept, as name.<run>.<shot>.ext next to the file it would otherwise have replaced
+static std::string numberedFilename(const tagWriter *writer, uint64_t shotNum)
+{
+	size_t slash = writer->filename.find_last_of("/\\");
+	size_t dot = writer->filename.find_last_of('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		dot = writer->filename.size();
+	}
+	return writer->filename.substr(0, dot) + "." + std::to_string(writer->index->run) + "." + std::to_string(shotNum) + writer->filename.substr(dot);
+}
+
+static void openShotFile(tagWriter *writer, uint64_t shotNum)
+{
+	writer->shotFilename = writer->index != NULL ? numberedFilename(writer, shotNum) : writer->filename;
+	std::string filename = partFilename(writer);
+	writer->file = new H5::H5File(&filename[0u], H5F_ACC_TRUNC);
+	for (size_t g = 0; g < writer->gates.size(); g++) {
+		gateOutput *gate = &writer->gates[g];
+		H5::Group group(writer->file->createGroup(&gate->groupName[0u]));
+		group.close();
+		gate->windowStartTags.clear();
+		gate->windowEndTags.clear();
+		gate->windowComplete.clear();
+		gate->shotCounts.clear();
+		gate->shotCoincidences.clear();
+		gate->windowStorage.clear();
+		gate->windowPhotons.clear();
+		gate->windowsDegraded = 0;
+		gate->windowsSpillFailed = 0;
+	}
+}
+
+//Counts kept in place of the tags of a window under backpressure, rows x bins
+static void writeWindowCounts(tagWriter *writer, const std::string &datasetName, const tagWindow *window)
+{
+	hsize_t dims[2];
+	dims[0] = window->counts.size() / window->countBins;
+	dims[1] = window->countBins;
+	H5::DataSpace dspace(2, dims);
+	H5::DataSet dset(writer->file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
+	if (!window->counts.empty()) {
+		dset.write(&window->counts[0], H5::PredType::NATIVE_UINT32);
+		countMetric(metrics.bytesWritten, window->counts.size() * sizeof(uint32_t));
+	}
+	H5::DataSpace scalar(H5S_SCALAR);
+	H5::Attribute binAttribute = dset.createAttribute("BinTicks", H5::PredType::NATIVE_UINT64, scalar);
+	binAttribute.write(H5::PredType::NATIVE_UINT64, &writer->countBinTicks);
+}
+
+void writeWindow(const tagWindow *window, tagWriter *writer)
+{
+	//First window of a shot creates the file
+	if (writer->file == NULL) {
+		openShotFile(writer, window->shotNum);
+	}
+	gateOutput *gate = &writer->gates[window->gateNum];
+	gate->windowStorage.push_back(window->storage);
+	gate->windowPhotons.insert(gate->windowPhotons.end(), window->photons, window->photons + 8);
+	if (window->storage != storeFull) {
+		gate->windowsDegraded++;
+	}
+	if (window->spillFailed) {
+		gate->windowsSpillFailed++;
+	}
+	if (writer->coincWindowTicks != 0) {
+		gate->shotCoincidences.push_back(window->coincidences.groups);
+	}
+	if (writer->coincWindowTicks != 0 && writer->coincTags) {
+		//Packed from the high word of the window start like the windowed tags
+		std::vector<uint32_t> words;
+		if (!window->encoded) {
+			encodeWindowColumns(&window->coincidences.tags, window->startTime, &words);
+		}
+		const std::vector<compressedChunk> *chunks = window->compressed ? &window->coincidenceChunks : NULL;
+		std::string datasetName = gate->groupName + '/' + "CoincTags" + std::to_string(window->windowNum);
+		const std::vector<uint32_t> &coincidenceWords = window->encoded ? window->coincidenceWords : words;
+		writeTagWords(writer->file, datasetName, coincidenceWords, chunks, writer->compressLevel);
+		if (writer->index != NULL) {
+			indexWindowDataset(writer->index, window, indexCoincTags, datasetName, 0, coincidenceWords.size());
+		}
+	}
+	if (writer->countBins != 0) {
+		if (writer->index != NULL) {
+			indexWindowDataset(writer->index, window, indexCounts, gate->groupName + '/' + "Counts", gate->shotCounts.size(), window->counts.size());
+		}
+		gate->shotCounts.insert(gate->shotCounts.end(), window->counts.begin(), window->counts.end());
+	}
+	else {
+		//Degraded windows still get their (empty) tag datasets so window numbering stays contiguous
+		if (window->storage == storeCounts) {
+			std::string countsName = gate->groupName + '/' + "Counts" + std::to_string(window->windowNum);
+			writeWindowCounts(writer, countsName, window);
+			if (writer->index != NULL) {
+				indexWindowDataset(writer->index, window, indexCounts, countsName, 0, window->counts.size());
+			}
+		}
+		std::string datasetName = gate->groupName + '/' + writer->datasetName + std::to_string(window->windowNum);
+		size_t numWords = writeWindowTags(writer->file, datasetName, window, false, writer->compressLevel);
+		std::string clockDatasetName = gate->groupName + '/' + "ClockTags" + std::to_string(window->windowNum);
+		size_t numClockWords = writeWindowTags(writer->file, clockDatasetName, window, true, writer->compressLevel);
+		if (writer->index != NULL) {
+			indexWindowDataset(writer->index, window, indexTags, datasetName, 0, numWords);
+			indexWindowDataset(writer->index, window, indexClockTags, clockDatasetName, 0, numClockWords);
+		}
+	}
+	//Record the high and low words of the start and end of the window
+	gate->windowStartTags.push_back(highTagWord(window->startTime));
+	gate->windowStartTags.push_back(lowTagWord(window->startTime, window->startEdge));
+	gate->windowEndTags.push_back(highTagWord(window->endTime));
+	gate->windowEndTags.push_back(lowTagWord(window->endTime, window->endEdge));
+	gate->windowComplete.push_back(window->complete ? 1 : 0);
+	if (writer->stats != NULL) {
+		addWindowStatistics(writer->stats, window);
+	}
+	if (!window->complete) {
+		std::cout << "window " << window->windowNum << " of gate " << window->gateNum << " in shot " << window->shotNum << " lost its closing gate edge" << std::endl;
+	}
+}
+
+//Whether each window was closed by its gate edge, cut short windows still have an end tag
+static void writeWindowComplete(tagWriter *writer, gateOutput *gate)
+{
+	hsize_t dims[1];
+	dims[0] = gate->windowComplete.size();
+	H5::DataSpace dspace(1, dims);
+	std::string datasetName = gate->groupName + '/' + "Complete";
+	H5::DataSet dset(writer->file->createDataSet(&datasetName[0u], H5::PredType::NATIVE_UINT8, dspace));
+	if (!gate->windowComplete.empty()) {
+		dset.write(&gate->windowComplete[0], H5::PredType::NATIVE_UINT8);
+		countMetric(metrics.bytesWritten, gate->windowComplete.size());
+	}
+}
+
+//What each window kept and the photon totals the degraded ones are left with
+static void writeWindowStorage(tagWriter *writer, gateOutput *gate)
+{
+	hsize_t dims[2];
+	dims[0] = gate->windowStorage.size();
+	H5::DataSpace storageSpace(1, dims);
+	std::string storageName = gate->groupName + '/' + "Storage";
+	H5::DataSet storageSet(writer->file->createDataSet(&storageName[0u], H5::PredType::NATIVE_UINT8, storageSpace));
+	storageSet.write(&gate->windowStorage[0], H5::PredType::NATIVE_UINT8);
+	dims[1] = 8;
+	H5::DataSpace photonSpace(2, dims);
+	std::string photonName = gate->groupName + '/' + "Photons";
+	H5::DataSet photonSet(writer->file->createDataSet(&photonName[0u], H5::PredType::NATIVE_UINT32, photonSpace));
+	photonSet.write(&gate->windowPhotons[0], H5::PredType::NATIVE_UINT32);
+	countMetric(metrics.bytesWritten, gate->windowStorage.size() + gate->windowPhotons.size() * sizeof(uint32_t));
+}
+
+void finishShot(const tagWindow *marker, tagWriter *writer)
+{
+	bool dropped = marker != NULL && marker->storage == storeDropped;
+	if (writer->file == NULL) {
+		if (!dropped) {
+			return;
+		}
+		openShotFile(writer, marker->shotNum);
+	}
+	std::cout << "writing..." << std::endl;
+	for (size_t g = 0; g < writer->gates.size(); g++) {
+		gateOutput *gate = &writer->gates[g];
+		if (g != 0) {
+			std::cout << "gate " << g << ": ";
+		}
+		writeWords(writer->file, gate->groupName + '/' + writer->startDataSetName, gate->windowStartTags);
+		std::cout << "start tags written...";
+		writeWords(writer->file, gate->groupName + '/' + writer->endDataSetName, gate->windowEndTags);
+		std::cout << "end tags written...";
+		writeWindowComplete(writer, gate);
+		if (writer->countBins != 0) {
+			writeCounts(writer, gate);
+			std::cout << "counts written...";
+		}
+		if (writer->coincWindowTicks != 0) {
+			writeCoincidences(writer, gate);
+			std::cout << "coincidences written...";
+		}
+		if (gate->windowsDegraded != 0) {
+			writeWindowStorage(writer, gate);
+			std::cout << gate->windowsDegraded << " degraded windows marked...";
+		}
+	}
+	//And the channel list
+	std::string groupName = "/Inform";
+	H5::Group ChannelListgroup(writer->file->createGroup(&groupName[0u]));
+	std::string totDatasetName = groupName + '/' + "ChannelList";
+	//Channels can be changed between shots, the marker has the ones this shot was taken with
+	const std::vector<uint16_t> &channelVect = (marker != NULL && !marker->channelVect.empty()) ? marker->channelVect : writer->channelVect;
+	hsize_t dims[1];
+	dims[0] = channelVect.size();
+	H5::DataSpace dspace(1, dims);
+	H5::DataSet dset(writer->file->createDataSet(&totDatasetName[0u], H5::PredType::NATIVE_UINT16, dspace));
+	//An empty channel list windows every channel other than the gate and clock
+	if (!channelVect.empty()) {
+		dset.write(&channelVect[0], H5::PredType::NATIVE_UINT16);
+	}
+	std::cout << "channel list written..." << std::endl;
+	//Peak memory of the shot goes in with the channel list
+	if (marker != NULL) {
+		H5::DataSpace scalar(H5S_SCALAR);
+		H5::Attribute peakAttribute = ChannelListgroup.createAttribute("PeakTagBytes", H5::PredType::NATIVE_UINT64, scalar);
+		peakAttribute.write(H5::PredType::NATIVE_UINT64, &marker->peakTagBytes);
+		std::cout << "peak tag memory " << marker->peakTagBytes / (1024 * 1024) << "MB, process peak " << processPeakMemory() / (1024 * 1024) << "MB" << std::endl;
+		//Losses are only noted when there were some, a shot without any attributes here lost nothing
+		if (dropped) {
+			uint8_t flag = 1;
+			H5::Attribute droppedAttribute = ChannelListgroup.createAttribute("Dropped", H5::PredType::NATIVE_UINT8, scalar);
+			droppedAttribute.write(H5::PredType::NATIVE_UINT8, &flag);
+			std::cout << "shot dropped under backpressure, written without windows" << std::endl;
+		}
+		if (marker->packetsLost != 0) {
+			H5::Attribute lostAttribute = ChannelListgroup.createAttribute("PacketsLost", H5::PredType::NATIVE_UINT64, scalar);
+			lostAttribute.write(H5::PredType::NATIVE_UINT64, &marker->packetsLost);
+		}
+		uint32_t spillFailed = 0;
+		for (size_t g = 0; g < writer->gates.size(); g++) {
+			spillFailed += writer->gates[g].windowsSpillFailed;
+		}
+		if (spillFailed != 0) {
+			H5::Attribute spillAttribute = ChannelListgroup.createAttribute("SpillFailed", H5::PredType::NATIVE_UINT32, scalar);
+			spillAttribute.write(H5::PredType::NATIVE_UINT32, &spillFailed);
+			std::cout << spillFailed << " windows could not be spilled to disk" << std::endl;
+		}
+	}
+	//Close all the HDF5 related crap to ensure memory gets freed
+	dset.close();
+	dspace.close();
+	ChannelListgroup.close();
+	writer->file->close();
+	delete writer->file;
+	writer->file = NULL;
+	//Swap the finished shot in so nobody picks up a half written file
+	std::string filename = partFilename(writer);
+	std::remove(&writer->shotFilename[0u]);
+	if (std::rename(&filename[0u], &writer->shotFilename[0u]) != 0) {
+		std::cout << "could not move " << filename << " to " << writer->shotFilename << std::endl;
+	}
+	else if (writer->index != NULL) {
+		commitIndexedShot(writer->index, writer->shotFilename);
+	}
+	writer->shotsWritten++;
+	if (writer->stats != NULL && !dropped) {
+		endStatisticsShot(writer->stats);
+	}
+}
+
+void writerLoop(windowQueue *queue, tagWriter *writer)
+{
+	tagWindow *window;
+	while ((window = queue->pop()) != NULL) {
+		//Readers of the ring get the window before it reaches the disk, they only know about the first gate
+		if (writer->ring != NULL && window->gateNum == 0) {
+			publishWindow(writer->ring, window);
+		}
+		std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+		if (window->shotEnd) {
+			finishShot(window, writer);
+			recordStage(&latencies.lastPhotonToDisk, window->closeReceived, stampNow());
+		}
+		else {
+			writeWindow(window, writer);
+			recordStage(&latencies.windowCloseToCommit, window->closed, stampNow());
+		}
+		recordWriteLatency(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - writeStart).count());
+		//Windows are handed over by the window manager, we free them once written
+		releaseWindow(window, writer->memory);
+	}
+	//A shot cut short by the end of the run is still worth keeping
+	if (writer->file != NULL) {
+		finishShot(NULL, writer);
+	}
+}
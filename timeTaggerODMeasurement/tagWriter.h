@@ -0,0 +1,78 @@
+// tagWriter.h : Writes closed windows to HDF5 as they arrive, one file per shot
+//
+
+#pragma once
+
+#include "windowManager.h"
+#include "sharedTagRing.h"
+#include "shotStatistics.h"
+#include "windowIndex.h"
+#include "H5Cpp.h"
+#include <string>
+#include <vector>
+
+//What a shot gathers for one gate until it ends, gate 0 goes in groupName and gate n in groupName/Gate<n>
+struct gateOutput {
+	std::string groupName;
+	std::vector<uint32_t> windowStartTags;
+	std::vector<uint32_t> windowEndTags;
+	//1 for each window closed by its gate edge, 0 for one cut short by the end of the shot or a lost edge
+	std::vector<uint8_t> windowComplete;
+	std::vector<uint32_t> shotCounts;
+	std::vector<uint64_t> shotCoincidences;
+	//What was kept of each window and its photon totals per channel, written when backpressure degraded any of them
+	std::vector<uint8_t> windowStorage;
+	std::vector<uint32_t> windowPhotons;
+	uint32_t windowsDegraded;
+	//Windows that could not be spilled to disk and were held in memory instead
+	uint32_t windowsSpillFailed;
+};
+
+struct tagWriter {
+	//Shots are written to filename + ".part" and renamed over filename once complete, unless there is an index
+	std::string filename;
+	//File the shot in progress goes to, filename or the numbered file of the shot when indexing
+	std::string shotFilename;
+	std::string groupName;
+	std::string datasetName;
+	std::string startDataSetName;
+	std::string endDataSetName;
+	std::vector<uint16_t> channelVect;
+	//File of the shot in progress, NULL between shots
+	H5::H5File *file;
+	std::vector<gateOutput> gates;
+	//Counts only mode writes a windows x channels x bins table per shot in place of the tags, 0 bins to write tags
+	uint32_t countBins;
+	uint64_t countBinTicks;
+	//Coincidences of each window of the shot, written as one dataset once the shot ends. 0 ticks when not counted
+	uint64_t coincWindowTicks;
+	bool coincTags;
+	//zlib level tag words are stored at, 0 to store them uncompressed
+	int compressLevel;
+	uint64_t shotsWritten;
+	//Budget the written windows are returned to
+	tagMemory *memory;
+	//Shared memory ring windows are published to before being written, NULL if there is none
+	sharedTagRing *ring;
+	//Running statistics over shots the written windows are added to, NULL if there are none
+	shotStatistics *stats;
+	//Index of where every window is stored, NULL if there is none. Each shot is then kept in a file of its own
+	windowIndex *index;
+};
+
+void initTagWriter(tagWriter *writer, const acquisitionOptions *options, tagMemory *memory);
+
+//Write packed tag words as a dataset, deflated at compressLevel unless that is 0. Chunks deflated beforehand by
+//compressWords go in with direct chunk writes, without them (NULL, or empty where compressWords failed) HDF5 deflates
+//the words inside the write
+void writeTagWords(H5::H5File *file, const std::string &datasetName, const std::vector<uint32_t> &words, const std::vector<compressedChunk> *chunks, int compressLevel);
+
+//Write the tags of a single window into the file of its shot, under the group of its gate, stitching any spilled blocks back in
+void writeWindow(const tagWindow *window, tagWriter *writer);
+
+//Write the start/end tags and channel list and close the shot file. A shot dropped under backpressure still gets a file,
+//with no windows and marked Dropped
+void finishShot(const tagWindow *marker, tagWriter *writer);
+
+//Writer thread body, consumes windows until the queue is closed
+void writerLoop(windowQueue *queue, tagWriter *writer);
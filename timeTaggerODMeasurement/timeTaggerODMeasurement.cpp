@@ -4,22 +4,29 @@
 #include "stdafx.h"
 #include "TTMLib.h"
 #include "TTMLib.hpp"
+#include "acquisitionOptions.h"
+#include "tagDecoder.h"
+#include "windowManager.h"
+#include "tagWriter.h"
+#include "pipelineMetrics.h"
+#include "latencyHistogram.h"
+#include "sharedTagRing.h"
+#include "packetSource.h"
+#include "benchmark.h"
+#include "acquisitionEvents.h"
+#include "commandServer.h"
+#include "calibration.h"
+#include "deadTimeFilter.h"
+#include "windowPipeline.h"
+#include "shotPublisher.h"
+#include "shotStatistics.h"
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <vector>
-#include "H5Cpp.h"
 #include <iostream>
 #include <sstream>
-
-struct countData {
-	uint16_t windowNum;
-	uint32_t highWord;
-	bool windowStatus;
-	std::vector<std::vector<uint32_t>> windowedTags;
-	std::vector<std::vector<uint32_t>> clockTags;
-	std::vector<uint32_t> windowStartTags;
-	std::vector<uint32_t> windowEndTags;
-};
+#include <thread>
 
 //Convert IPV4 in human readable form to decimal form
 int IPV4ToDecimal(char* IPV4) 
@@ -42,7 +49,7 @@ int IPV4ToDecimal(char* IPV4)
 }
 
 //Get time tagger channels to use from command line argument
-std::vector<uint16_t> getChannels(char* argIn) {
+std::vector<uint16_t> getChannels(const char* argIn) {
 	std::vector<uint16_t> channelVect;
 	std::stringstream ss(argIn);
 	int i;
@@ -105,229 +112,999 @@ TTMMeasConfig_t* configSetter(std::vector<uint16_t>* channelVect, uint16_t* cloc
 	return configOut;
 }
 
-int processTags(TTMDataPacket_t *tagBuffer, countData *countData, uint16_t* clockline)
+//Turn on the edges the gates open and close on, stops other than stop 1 are off unless they are photon channels
+void enableGateEdges(TTMMeasConfig_t *config, const std::vector<gateDefinition> &gates)
 {
-	//Determine the number of tags to process
-	int numElements = sizeof(tagBuffer->Data.TimetagI64Pack) / sizeof(tagBuffer->Data.TimetagI64Pack[0]);
-	//Loop over tags
-	for (int i = 0; i < numElements; i++) {
-		//Extract the payload and highLow data
-		uint32_t payload = tagBuffer->Data.TimetagI64Pack[i].Payload;
-		uint32_t highLow = tagBuffer->Data.TimetagI64Pack[i].HighLow;
-		//Determine if this is a high word and if so set the new high word
-		if (highLow == 1) {
-			(*countData).highWord = payload;
-			//Write the highWord to the table if the window is open
-			if ((*countData).windowStatus) {
-				(*countData).windowedTags[(*countData).windowNum].push_back((payload << 1) | highLow);
-				(*countData).clockTags[(*countData).windowNum].push_back((payload << 1) | highLow);
-			}
-		}
-		//If word is low word
-		else if (highLow == 0) {
-			//See if payload is null
-			if (payload != 0) {
-				//Check channel number
-				uint8_t channelNum = ((payload >> 28) & 7);
-				//If channel number is 1 then check whether we're using the rising or falling edge to dictate whether the window is open or closed
-				if (channelNum == 0) {
-					uint8_t slope = ((payload >> 27) & 1);
-					//If slope is positive set the window open and record the low and high word of the start of the window
-					if (slope == 1) {
-						(*countData).windowStatus = true;
-						(*countData).windowStartTags[(*countData).windowNum * 2] = ((*countData).highWord << 1) | 1;
-						(*countData).windowStartTags[(*countData).windowNum * 2 + 1] = (payload << 1) | 0;
-						std::cout << (*countData).highWord << std::endl;
-						std::cout << payload << std::endl;
-					}
-					//If the slope is negative the window is closed so increment the window number and set the windowStatus to false & record high and low end words
-					else {
-						(*countData).windowStatus = false;
-						(*countData).windowEndTags[(*countData).windowNum * 2] = ((*countData).highWord << 1) | 1;
-						(*countData).windowEndTags[(*countData).windowNum * 2 + 1] = (payload << 1) | 0;
-						std::cout << (*countData).highWord << std::endl;
-						std::cout << payload << std::endl;
-						//Increment window number
-						(*countData).windowNum++;
-					}
-				}
-				//If the tags belongs to the clockline
-				else if (channelNum == *clockline - 1) {
-					if ((*countData).windowStatus) {
-						(*countData).clockTags[(*countData).windowNum].push_back((payload << 1) | highLow);
-					}
-				}
-				//Otherwise write the tags to the vector
-				else {
-					if ((*countData).windowStatus) {
-						(*countData).windowedTags[(*countData).windowNum].push_back((payload << 1) | highLow);
-					}
+	for (size_t g = 0; g < gates.size(); g++) {
+		uint8_t edges[2] = { gates[g].openEdge, gates[g].closeEdge };
+		int numEdges = gates[g].closeClocks != 0 ? 1 : 2;
+		for (int e = 0; e < numEdges; e++) {
+			//Tag channel 0 is stop 1, and EnableEdge has the rising edge first
+			config->EnableEdge[edgeChannel(edges[e]) + 1][edgeSlope(edges[e]) == 1 ? 0 : 1] = true;
+		}
+	}
+}
+
+//Settings the tagger is started with by configSetter
+void initLiveSettings(liveSettings *settings, const acquisitionOptions *options)
+{
+	settings->channelVect = options->channelVect;
+	settings->clockLine = options->clockLine;
+	settings->triggerLevels[0] = 1400;
+	settings->triggerLevels[1] = 1400;
+	for (int i = 2; i < 9; i++) {
+		settings->triggerLevels[i] = options->triggerLevel;
+	}
+	settings->triggerLevels[9] = 0;
+	for (int i = 0; i < 9; i++) {
+		settings->channelDelays[i] = 0;
+	}
+}
+
+//Take the running tagger from one set of live settings to the next without stopping the measurement
+void applyLiveSettings(TTMCntrl_c *taggerControl, TTMMeasConfig_t **taggerConfig, uint16_t triggerLevel, const std::vector<gateDefinition> &gates, const liveSettings *current, const liveSettings *next)
+{
+	if (next->channelVect != current->channelVect || next->clockLine != current->clockLine) {
+		//Only the enabled edges are taken from the config, the rest has to be valid but stays as it is
+		std::vector<uint16_t> channelVect = next->channelVect;
+		uint16_t clockLine = next->clockLine;
+		TTMMeasConfig_t *config = configSetter(&channelVect, &clockLine, &triggerLevel);
+		config->DataFormat = (*taggerConfig)->DataFormat;
+		config->DataTargetPort = (*taggerConfig)->DataTargetPort;
+		enableGateEdges(config, gates);
+		if (taggerControl->SetEnabledEdges(config) != FlexIO_Success) {
+			std::cout << "could not change the enabled edges" << std::endl;
+		}
+		delete *taggerConfig;
+		*taggerConfig = config;
+	}
+	uint32_t levelMask = 0;
+	int32_t triggerLevels[10];
+	for (int i = 0; i < 10; i++) {
+		triggerLevels[i] = next->triggerLevels[i];
+		if (next->triggerLevels[i] != current->triggerLevels[i]) {
+			levelMask |= 1 << i;
+		}
+	}
+	if (levelMask != 0 && taggerControl->SetTriggerLevel(levelMask, triggerLevels) != FlexIO_Success) {
+		std::cout << "could not change the trigger levels" << std::endl;
+	}
+	uint32_t delayMask = 0;
+	int channelDelays[9];
+	for (int i = 0; i < 9; i++) {
+		channelDelays[i] = next->channelDelays[i];
+		if (next->channelDelays[i] != current->channelDelays[i]) {
+			delayMask |= 1 << i;
+		}
+	}
+	if (delayMask != 0 && taggerControl->SetChannelDelay(delayMask, channelDelays) != FlexIO_Success) {
+		std::cout << "could not change the channel delays" << std::endl;
+	}
+}
+
+//Value of an optional --name=value argument, NULL if arg is a different option
+const char* optionValue(const char* arg, const char* name)
+{
+	size_t nameLength = strlen(name);
+	if (strncmp(arg, name, nameLength) == 0) {
+		return arg + nameLength;
+	}
+	return NULL;
+}
+
+//Dead times in ns, either one for every photon channel or stop:ns pairs separated by commas
+bool parseDeadTimes(const char* value, acquisitionOptions* options)
+{
+	std::stringstream ss(value);
+	std::string entry;
+	while (std::getline(ss, entry, ',')) {
+		size_t colon = entry.find(':');
+		double nanos = atof(entry.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+		//82.3045ps ticks
+		uint64_t ticks = (uint64_t)(nanos * 1000.0 / 82.3045 + 0.5);
+		if (colon == std::string::npos) {
+			//The gate and the clock line are never filtered
+			for (int channel = 1; channel < 8; channel++) {
+				if (channel != options->clockLine - 1) {
+					options->deadTimeTicks[channel] = ticks;
 				}
 			}
+			continue;
 		}
+		int stop = atoi(entry.c_str());
+		if (stop < 2 || stop > 8) {
+			std::cout << "dead times are for stop inputs 2 to 8" << std::endl;
+			return false;
+		}
+		options->deadTimeTicks[stop - 1] = ticks;
 	}
-	//Delete the tag buffer to clear up memory space on the heap
-	delete tagBuffer;
-	return 0;
+	return true;
+}
+
+//Edge of a gate as stop and slope, 1r for the rising edge of stop 1. False if it is not one
+bool parseGateEdge(const std::string &text, uint8_t *edge)
+{
+	int stop = atoi(text.c_str());
+	char slope = text.empty() ? ' ' : text[text.size() - 1];
+	if (stop < 1 || stop > 8 || (slope != 'r' && slope != 'f')) {
+		return false;
+	}
+	*edge = (uint8_t)((stop - 1) << 1 | (slope == 'r' ? 1 : 0));
+	return true;
 }
 
-//Write the collected tags in countData to file
-void tagsToHDF5(countData *cntData, std::string filename, std::string groupName, std::string datasetName, std::string startDataSetName, std::string endDataSetName, std::vector<uint16_t>* channelVect) {
-	std::cout << "writing..." << std::endl;
-		//First let's create a file with the given filename
-		H5::H5File file(&filename[0u], H5F_ACC_TRUNC);
-		//Then create a group for our tags
-		H5::Group group(file.createGroup(&groupName[0u]));
-		//Dimensions of each vector set in the loop below
-		hsize_t dims[1];
-		//Loop to write all the windowed tags to file
-		for (uint16_t i = 0; i < (*cntData).windowedTags.size(); i++) {
-			//Determine the total dataset name from the groupname, datasetName and loop iteration
-			std::string totDatasetName = groupName + '/' + datasetName + std::to_string(i);
-			//Set the length of the dataset to the same length as the current tag vector
-			dims[0] = (*cntData).windowedTags[i].size();
-			//Create a dataspace to hold our data (cards on the table I'm not sure what a dataspace is but this seems necessary)
-			H5::DataSpace dspace(1, dims);
-			//Create dataset
-			H5::DataSet dset(file.createDataSet(&totDatasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
-			//Write our data to the dataset
-			dset.write(&(*cntData).windowedTags[i][0], H5::PredType::NATIVE_UINT32);
-			(*cntData).windowedTags[i].clear();
-		}
-		std::cout << "channel tags written...";
-		//Loop to write all the clock tags to file
-		for (uint16_t i = 0; i < (*cntData).clockTags.size(); i++) {
-			//Determine the total dataset name from the groupname, datasetName and loop iteration
-			std::string totDatasetName = groupName + '/' + "ClockTags" + std::to_string(i);
-			//Set the length of the dataset to the same length as the current tag vector
-			dims[0] = (*cntData).clockTags[i].size();
-			//Create a dataspace to hold our data (cards on the table I'm not sure what a dataspace is but this seems necessary)
-			H5::DataSpace dspace(1, dims);
-			//Create dataset
-			H5::DataSet dset(file.createDataSet(&totDatasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
-			//Write our data to the dataset
-			dset.write(&(*cntData).clockTags[i][0], H5::PredType::NATIVE_UINT32);
-			(*cntData).clockTags[i].clear();
-		}
-		std::cout << "clock tags written...";
-		//And write the start tags to file too
-		std::string totDatasetName = groupName + '/' + startDataSetName;
-		dims[0] = (*cntData).windowStartTags.size();
-		H5::DataSpace dspace(1, dims);
-		H5::DataSet dset(file.createDataSet(&totDatasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
-		dset.write(&(*cntData).windowStartTags[0], H5::PredType::NATIVE_UINT32);
-		std::cout << "start tags written...";
-		//And end tags while we're at it
-		totDatasetName = groupName + '/' + endDataSetName;
-		dims[0] = (*cntData).windowEndTags.size();
-		dspace = H5::DataSpace(1, dims);
-		dset = H5::DataSet(file.createDataSet(&totDatasetName[0u], H5::PredType::NATIVE_UINT32, dspace));
-		dset.write(&(*cntData).windowEndTags[0], H5::PredType::NATIVE_UINT32);
-		std::cout << "end tags written...";
-		//And the channel list
-		groupName = "/Inform";
-		H5::Group ChannelListgroup(file.createGroup(&groupName[0u]));
-		totDatasetName = groupName + '/' + "ChannelList";
-		dims[0] = channelVect->size();
-		dspace = H5::DataSpace(1, dims);
-		dset = H5::DataSet(file.createDataSet(&totDatasetName[0u], H5::PredType::NATIVE_UINT16, dspace));
-		std::cout << "channel list written...";
-		dset.write(&(*channelVect)[0], H5::PredType::NATIVE_UINT16);
-		//Close all the HDF5 related crap to ensure memory gets freed
-		dset.close();
-		dspace.close();
-		group.close();
-		file.close();
-		ChannelListgroup.close();
+//Gates separated by commas, each an opening edge and either a closing edge or +N clock edges, e.g. 1r:1f,2r:+100
+bool parseGates(const char* value, acquisitionOptions* options)
+{
+	std::stringstream ss(value);
+	std::string entry;
+	while (std::getline(ss, entry, ',')) {
+		size_t colon = entry.find(':');
+		gateDefinition gate;
+		gate.closeEdge = 0;
+		gate.closeClocks = 0;
+		bool valid = colon != std::string::npos && parseGateEdge(entry.substr(0, colon), &gate.openEdge);
+		if (valid && entry[colon + 1] == '+') {
+			gate.closeClocks = atoi(entry.c_str() + colon + 2);
+			valid = gate.closeClocks != 0;
+		}
+		else if (valid) {
+			valid = parseGateEdge(entry.substr(colon + 1), &gate.closeEdge);
+		}
+		if (!valid) {
+			std::cout << "could not make a gate of " << entry << std::endl;
+			return false;
+		}
+		options->gates.push_back(gate);
 	}
+	return true;
+}
 
-int main(int argc, char* argv[])
+//Backpressure tiers separated by commas, each what to give up and how full (in percent) the queue or memory budget has
+//to be, e.g. counts:50,background:75,drop:90
+bool parseBackpressure(const char* value, acquisitionOptions* options)
 {
+	std::stringstream ss(value);
+	std::string entry;
+	while (std::getline(ss, entry, ',')) {
+		size_t colon = entry.find(':');
+		std::string action = entry.substr(0, colon);
+		pressureTier tier;
+		tier.percent = colon == std::string::npos ? 0 : atoi(entry.c_str() + colon + 1);
+		bool valid = tier.percent >= 1 && tier.percent <= 100;
+		if (action == "counts") {
+			tier.action = pressureCounts;
+		}
+		else if (action == "background") {
+			tier.action = pressureBackground;
+		}
+		else if (action == "drop") {
+			tier.action = pressureDrop;
+		}
+		else {
+			valid = false;
+		}
+		if (!valid) {
+			std::cout << "could not make a backpressure tier of " << entry << ", use counts|background|drop:percent" << std::endl;
+			return false;
+		}
+		options->backpressure.push_back(tier);
+	}
+	return true;
+}
+
+//Fill the run settings from the positional command line arguments and any trailing --name=value options
+bool parseOptions(int argc, char* argv[], acquisitionOptions* options)
+{
+	if (argc < 7) {
+		return false;
+	}
 	//Get time tagger IP from command line argument
-	in_addr_t taggerIP = IPV4ToDecimal(argv[1]);
+	options->taggerIP = IPV4ToDecimal(argv[1]);
 	//Get blackhole location from command line argument
-	char* blackhole = argv[2];
+	options->blackhole = argv[2];
 	//Get the number of windows from the command line argument
-	uint16_t numWindows = atoi(argv[3]);
+	options->numWindows = atoi(argv[3]);
 	//Get the channels to use
-	std::vector<uint16_t> channelVect = getChannels(argv[4]);
-	uint16_t clockLine = atoi(argv[5]);
+	options->channelVect = getChannels(argv[4]);
+	options->clockLine = atoi(argv[5]);
 	//And the trigger level for the APDs
-	uint16_t trigger_level = atoi(argv[6]);
+	options->triggerLevel = atoi(argv[6]);
+	//Defaults for the optional arguments
+	options->shotBoundary = shotRuleCount;
+	options->shotGapMillis = 0;
+	options->digitalIOMask = 0;
+	options->maxInFlightWindows = 64;
+	options->postWorkers = 0;
+	options->compressLevel = 0;
+	options->memoryBudget = 0;
+	options->spillPrefix = options->blackhole + ".spill";
+	options->metricsPort = 0;
+	options->shmRingBytes = 64 * 1024 * 1024;
+	options->statsEvery = 10;
+	options->odReferenceGate = 0;
+	options->ingest = ingestVendor;
+	options->dataFormat = TTFormat_IMode_EXT64_PACK;
+	options->dataPort = FlexIODataPort;
+	//Buffer size is 8MB
+	options->receiveBufferBytes = 8 * 1024 * 1024;
+	options->busyPollMicros = 0;
+	options->vendorControl = true;
+	options->captureRingBytes = 64 * 1024 * 1024;
+	options->benchmarkSeconds = 10;
+	options->daemonPort = 0;
+	options->gatedDecode = false;
+	options->countsOnly = false;
+	options->countBins = 1;
+	options->countBinTicks = 0;
+	for (int channel = 0; channel < 8; channel++) {
+		options->deadTimeTicks[channel] = 0;
+	}
+	options->deadTimeRetrigger = false;
+	options->coincWindowTicks = 0;
+	options->coincMin = 2;
+	options->coincMax = 128;
+	options->coincChannelMask = 0;
+	options->coincTags = false;
+	for (int i = 7; i < argc; i++) {
+		const char* value;
+		if ((value = optionValue(argv[i], "--shot-rule=")) != NULL) {
+			std::string rule = value;
+			if (rule == "count") {
+				options->shotBoundary = shotRuleCount;
+			}
+			else if (rule == "gap") {
+				options->shotBoundary = shotRuleGap;
+			}
+			else if (rule == "dio") {
+				options->shotBoundary = shotRuleDigitalIO;
+			}
+			else {
+				std::cout << "unknown shot rule " << rule << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--shot-gap-ms=")) != NULL) {
+			options->shotGapMillis = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--dio-mask=")) != NULL) {
+			options->digitalIOMask = (uint16_t)strtoul(value, NULL, 0);
+		}
+		else if ((value = optionValue(argv[i], "--max-in-flight=")) != NULL) {
+			options->maxInFlightWindows = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--memory-budget-mb=")) != NULL) {
+			options->memoryBudget = (uint64_t)atoi(value) * 1024 * 1024;
+		}
+		else if ((value = optionValue(argv[i], "--spill-prefix=")) != NULL) {
+			options->spillPrefix = value;
+		}
+		else if ((value = optionValue(argv[i], "--metrics-port=")) != NULL) {
+			options->metricsPort = (uint16_t)atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--shm-ring=")) != NULL) {
+			options->shmRingName = value;
+		}
+		else if ((value = optionValue(argv[i], "--data-format=")) != NULL) {
+			std::string format = value;
+			if (format == "pack") {
+				options->dataFormat = TTFormat_IMode_EXT64_PACK;
+			}
+			else if (format == "flat") {
+				options->dataFormat = TTFormat_IMode_EXT64_FLAT;
+			}
+			else if (format == "multi-pack") {
+				options->dataFormat = TTFormat_MultiIMode_EXT64_PACK;
+			}
+			else if (format == "multi-flat") {
+				options->dataFormat = TTFormat_MultiIMode_EXT64_FLAT;
+			}
+			else {
+				std::cout << "unknown data format " << format << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--publish=")) != NULL) {
+			options->publishAddress = value;
+			if (options->publishAddress.compare(0, 4, "tcp:") != 0 && options->publishAddress.compare(0, 5, "unix:") != 0) {
+				std::cout << "--publish takes tcp:port or unix:path" << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--shm-ring-mb=")) != NULL) {
+			options->shmRingBytes = (uint64_t)atoi(value) * 1024 * 1024;
+		}
+		else if ((value = optionValue(argv[i], "--ingest=")) != NULL) {
+			std::string ingest = value;
+			if (ingest == "vendor") {
+				options->ingest = ingestVendor;
+			}
+			else if (ingest == "recvmmsg" || ingest == "tpacket") {
+#if defined(__linux)
+				options->ingest = ingest == "recvmmsg" ? ingestRecvmmsg : ingestTpacket;
+#else
+				std::cout << "--ingest=" << ingest << " is only available on Linux" << std::endl;
+				return false;
+#endif
+			}
+			else {
+				std::cout << "unknown ingest backend " << ingest << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--data-port=")) != NULL) {
+			options->dataPort = (uint16_t)atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--rcvbuf-mb=")) != NULL) {
+			options->receiveBufferBytes = (uint32_t)atoi(value) * 1024 * 1024;
+		}
+		else if ((value = optionValue(argv[i], "--busy-poll-us=")) != NULL) {
+			options->busyPollMicros = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--capture-if=")) != NULL) {
+			options->captureInterface = value;
+		}
+		else if ((value = optionValue(argv[i], "--capture-ring-mb=")) != NULL) {
+			options->captureRingBytes = (uint32_t)atoi(value) * 1024 * 1024;
+		}
+		else if ((value = optionValue(argv[i], "--benchmark=")) != NULL) {
+			options->benchmarkName = value;
+			if (options->benchmarkName != "ingest" && options->benchmarkName != "coincidence" && options->benchmarkName != "write" && options->benchmarkName != "format" && options->benchmarkName != "vendor") {
+				std::cout << "unknown benchmark " << options->benchmarkName << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--benchmark-seconds=")) != NULL) {
+			options->benchmarkSeconds = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--control=")) != NULL) {
+			std::string control = value;
+			if (control == "vendor") {
+				options->vendorControl = true;
+			}
+			else if (control == "none") {
+				options->vendorControl = false;
+			}
+			else {
+				std::cout << "unknown control " << control << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--decode=")) != NULL) {
+			std::string decode = value;
+			if (decode == "all") {
+				options->gatedDecode = false;
+			}
+			else if (decode == "gated") {
+				options->gatedDecode = true;
+			}
+			else {
+				std::cout << "unknown decode mode " << decode << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--calibration=")) != NULL) {
+			options->calibrationFile = value;
+		}
+		else if ((value = optionValue(argv[i], "--dead-time-ns=")) != NULL) {
+			if (!parseDeadTimes(value, options)) {
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--dead-time-mode=")) != NULL) {
+			std::string mode = value;
+			if (mode == "fixed") {
+				options->deadTimeRetrigger = false;
+			}
+			else if (mode == "retrigger") {
+				options->deadTimeRetrigger = true;
+			}
+			else {
+				std::cout << "unknown dead time mode " << mode << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--output=")) != NULL) {
+			std::string output = value;
+			if (output == "tags") {
+				options->countsOnly = false;
+			}
+			else if (output == "counts") {
+				options->countsOnly = true;
+			}
+			else {
+				std::cout << "unknown output " << output << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--count-bins=")) != NULL) {
+			options->countBins = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--count-bin-ns=")) != NULL) {
+			//82.3045ps ticks
+			options->countBinTicks = (uint64_t)(atof(value) * 1000.0 / 82.3045 + 0.5);
+		}
+		else if ((value = optionValue(argv[i], "--coinc-window-ns=")) != NULL) {
+			//82.3045ps ticks
+			options->coincWindowTicks = (uint64_t)(atof(value) * 1000.0 / 82.3045 + 0.5);
+		}
+		else if ((value = optionValue(argv[i], "--coinc-min=")) != NULL) {
+			options->coincMin = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--coinc-max=")) != NULL) {
+			options->coincMax = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--coinc-channels=")) != NULL) {
+			std::vector<uint16_t> stops = getChannels(value);
+			for (size_t s = 0; s < stops.size(); s++) {
+				if (stops[s] < 2 || stops[s] > 8) {
+					std::cout << "coincidence channels are stop inputs 2 to 8" << std::endl;
+					return false;
+				}
+				options->coincChannelMask |= 1 << (stops[s] - 1);
+			}
+		}
+		else if ((value = optionValue(argv[i], "--coinc-output=")) != NULL) {
+			std::string output = value;
+			if (output == "counts") {
+				options->coincTags = false;
+			}
+			else if (output == "tags") {
+				options->coincTags = true;
+			}
+			else {
+				std::cout << "unknown coincidence output " << output << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--gates=")) != NULL) {
+			if (!parseGates(value, options)) {
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--backpressure=")) != NULL) {
+			if (!parseBackpressure(value, options)) {
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--workers=")) != NULL) {
+			options->postWorkers = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--compress=")) != NULL) {
+			options->compressLevel = atoi(value);
+			if (options->compressLevel < 0 || options->compressLevel > 9) {
+				std::cout << "--compress takes a zlib level from 0 to 9" << std::endl;
+				return false;
+			}
+		}
+		else if ((value = optionValue(argv[i], "--stats=")) != NULL) {
+			options->statsFile = value;
+		}
+		else if ((value = optionValue(argv[i], "--stats-key=")) != NULL) {
+			options->statsKey = value;
+		}
+		else if ((value = optionValue(argv[i], "--stats-every=")) != NULL) {
+			options->statsEvery = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--index=")) != NULL) {
+			options->indexFile = value;
+		}
+		else if ((value = optionValue(argv[i], "--od-reference-gate=")) != NULL) {
+			options->odReferenceGate = atoi(value);
+		}
+		else if ((value = optionValue(argv[i], "--daemon-port=")) != NULL) {
+			options->daemonPort = (uint16_t)atoi(value);
+		}
+		else {
+			std::cout << "unknown option " << argv[i] << std::endl;
+			return false;
+		}
+	}
+	if (options->shotBoundary == shotRuleGap && options->shotGapMillis == 0) {
+		options->shotGapMillis = 50;
+	}
+	if (options->shotBoundary == shotRuleDigitalIO && options->digitalIOMask == 0) {
+		std::cout << "--shot-rule=dio needs a --dio-mask" << std::endl;
+		return false;
+	}
+	if (options->countsOnly && (options->countBins == 0 || (options->countBins > 1 && options->countBinTicks == 0))) {
+		std::cout << "--output=counts needs at least one bin and a --count-bin-ns for more than one" << std::endl;
+		return false;
+	}
+	//Windows counted under backpressure are binned like counts only mode
+	for (size_t t = 0; t < options->backpressure.size(); t++) {
+		if (options->backpressure[t].action == pressureCounts && (options->countBins == 0 || (options->countBins > 1 && options->countBinTicks == 0))) {
+			std::cout << "--backpressure=counts needs at least one bin and a --count-bin-ns for more than one" << std::endl;
+			return false;
+		}
+	}
+	//Gated decoding only knows the gate on stop 1
+	if (options->gatedDecode && !(options->gates.empty() || (options->gates.size() == 1 && options->gates[0].openEdge == 1 && options->gates[0].closeEdge == 0 && options->gates[0].closeClocks == 0))) {
+		std::cout << "--decode=gated only works with the standard gate on stop 1" << std::endl;
+		return false;
+	}
+	//The gated decoder skips tags by their uncorrected times, so corrected tags near a gate edge would land on the
+	//wrong side of it
+	if (options->gatedDecode && !options->calibrationFile.empty()) {
+		std::cout << "--decode=gated cannot be used with --calibration" << std::endl;
+		return false;
+	}
+	if (options->coincMin == 0 || options->coincMax < options->coincMin) {
+		std::cout << "--coinc-min needs to be at least 1 and no more than --coinc-max" << std::endl;
+		return false;
+	}
+	//Coincidences are looked for on every photon channel unless told otherwise
+	if (options->coincChannelMask == 0) {
+		for (int channel = 1; channel < 8; channel++) {
+			if (channel != options->clockLine - 1) {
+				options->coincChannelMask |= 1 << channel;
+			}
+		}
+	}
+	if (options->odReferenceGate != 0 && options->odReferenceGate >= options->gates.size()) {
+		std::cout << "--od-reference-gate needs to be one of the --gates after the first" << std::endl;
+		return false;
+	}
+	if (options->ingest == ingestTpacket && options->captureInterface.empty()) {
+		std::cout << "--ingest=tpacket needs a --capture-if" << std::endl;
+		return false;
+	}
+	if (options->maxInFlightWindows == 0) {
+		options->maxInFlightWindows = 1;
+	}
+	return true;
+}
+
+//Check to see if the stopFile has been written to
+bool stopRequested()
+{
+	std::ifstream stopFile;
+	stopFile.open("stopFile.txt");
+	std::string stopLine;
+	stopFile >> stopLine;
+	return stopLine != "0";
+}
+
+//Start handing windows to a fresh writer thread, for a run with the given settings. With a pipeline the windows are
+//post-processed on its pool first and the writer takes them from processedWindows
+static void startRun(const acquisitionOptions *runOptions, windowManager *manager, windowQueue *closedWindows, windowPipeline *pipeline, windowQueue *processedWindows, tagWriter *writer, std::thread *writerThread)
+{
+	//The shared memory ring, the shot publisher, the statistics and the window index outlive the runs
+	sharedTagRing *ring = writer->ring;
+	shotPublisher *publisher = manager->publisher;
+	shotStatistics *stats = writer->stats;
+	windowIndex *index = writer->index;
+	initWindowManager(manager, runOptions, closedWindows);
+	initTagWriter(writer, runOptions, &manager->memory);
+	writer->ring = ring;
+	manager->publisher = publisher;
+	writer->stats = stats;
+	writer->index = index;
+	if (index != NULL) {
+		startIndexRun(index);
+	}
+	if (stats != NULL) {
+		//Each run is a configuration of its own unless told otherwise
+		std::string key = runOptions->statsKey;
+		if (key.empty()) {
+			size_t slash = runOptions->blackhole.find_last_of("/\\");
+			key = slash == std::string::npos ? runOptions->blackhole : runOptions->blackhole.substr(slash + 1);
+		}
+		setStatisticsKey(stats, key);
+	}
+	closedWindows->reopen();
+	windowQueue *toWrite = closedWindows;
+	if (pipeline != NULL) {
+		processedWindows->reopen();
+		startWindowPipeline(pipeline, closedWindows, processedWindows, runOptions->maxInFlightWindows);
+		toWrite = processedWindows;
+	}
+	*writerThread = std::thread(writerLoop, toWrite, writer);
+}
+
+//Hand the tags correctTagTimes is holding back to the windows, for when the shot or the run could end before another
+//packet brings them
+static void processHeldTags(edgeCorrections *corrections, tagColumns *block, windowManager *manager)
+{
+	if (corrections->held.times.empty()) {
+		return;
+	}
+	block->times.clear();
+	block->edges.clear();
+	releaseHeldTags(block, corrections);
+	recordTags(block);
+	processTagBlock(block, manager);
+}
+
+//Flush the shot in progress and let the pipeline and writer drain
+static void finishRun(const acquisitionOptions *runOptions, windowManager *manager, windowQueue *closedWindows, windowPipeline *pipeline, std::thread *writerThread)
+{
+	endShot(manager);
+	closedWindows->close();
+	if (pipeline != NULL) {
+		stopWindowPipeline(pipeline);
+	}
+	writerThread->join();
+	//Latency histograms of the run go to the console and next to its data, the next run starts from empty ones
+	dumpLatencies(std::cout, false);
+	std::ofstream latencyFile(runOptions->blackhole + ".latency.txt");
+	dumpLatencies(latencyFile, true);
+	resetLatencies();
+}
+
+int main(int argc, char* argv[])
+{
+	acquisitionOptions options;
+	if (!parseOptions(argc, argv, &options)) {
+		std::cout << "usage: timeTaggerODMeasurement taggerIP blackhole numWindows channels clockLine triggerLevel" << std::endl;
+		std::cout << "  [--shot-rule=count|gap|dio] [--shot-gap-ms=N] [--dio-mask=M] [--max-in-flight=N]" << std::endl;
+		std::cout << "  [--memory-budget-mb=N] [--spill-prefix=path] [--metrics-port=N] [--backpressure=counts|background|drop:percent,...]" << std::endl;
+		std::cout << "  [--shm-ring=name] [--shm-ring-mb=N] [--ingest=vendor|recvmmsg|tpacket] [--data-port=N] [--rcvbuf-mb=N]" << std::endl;
+		std::cout << "  [--busy-poll-us=N] [--capture-if=name] [--capture-ring-mb=N] [--control=vendor|none]" << std::endl;
+		std::cout << "  [--benchmark=ingest|coincidence|write|format|vendor] [--benchmark-seconds=N] [--daemon-port=N]" << std::endl;
+		std::cout << "  [--decode=all|gated] [--output=tags|counts] [--count-bins=N] [--count-bin-ns=W]" << std::endl;
+		std::cout << "  [--calibration=file] [--dead-time-ns=W|stop:W,...] [--dead-time-mode=fixed|retrigger]" << std::endl;
+		std::cout << "  [--gates=open:close|open:+clocks,...] [--workers=N] [--compress=level]" << std::endl;
+		std::cout << "  [--publish=tcp:port|unix:path] [--data-format=pack|flat|multi-pack|multi-flat]" << std::endl;
+		std::cout << "  [--stats=file] [--stats-key=tag] [--stats-every=N] [--od-reference-gate=N] [--index=file]" << std::endl;
+		std::cout << "  [--coinc-window-ns=W] [--coinc-min=N] [--coinc-max=N] [--coinc-channels=a,b] [--coinc-output=counts|tags]" << std::endl;
+		return 1;
+	}
+	//Cable delays are taken out straight after decoding, so windows are cut on corrected times
+	edgeCorrections corrections;
+	bool correctTimes = !options.calibrationFile.empty();
+	if (correctTimes) {
+		TTMPortCableOffset_t cableOffsets;
+		if (!loadCableOffsets(options.calibrationFile, &cableOffsets)) {
+			return 1;
+		}
+		setEdgeCorrections(&corrections, &cableOffsets);
+	}
+	//The coincidence benchmark runs on synthetic tags, so it is done before anything talks to the tagger
+	if (options.benchmarkName == "coincidence") {
+		coincidenceBenchmark(&options);
+		return 0;
+	}
+	if (options.benchmarkName == "write") {
+		writeBenchmark(&options);
+		return 0;
+	}
+	if (options.benchmarkName == "format") {
+		formatBenchmark(&options);
+		return 0;
+	}
+	if (options.benchmarkName == "vendor") {
+		vendorHelperBenchmark(&options);
+		return 0;
+	}
 	//All the classes we will need
 	TTMCntrl_c *taggerControl = new TTMCntrl_c;
-	TTMData_c *taggerDataConnection = new TTMData_c;
-	TTMMeasConfig_t *taggerConfig = new TTMMeasConfig_t;
-	bool dataAvailable = false;
-	countData countData;
-	countData.windowNum = 0;
-	countData.highWord = 0;
-	countData.windowStatus = false;
+	TTMMeasConfig_t *taggerConfig;
 	bool collectData = true;
-	countData.windowedTags.resize(numWindows);
-	countData.windowStartTags.resize(numWindows * 2);
-	countData.windowEndTags.resize(numWindows * 2);
-	countData.clockTags.resize(numWindows);
+	//Connect to the tagger, unless something else is looking after it
+	if (options.vendorControl) {
+		taggerControl->Connect(NULL, TTM8ApplCookie, options.taggerIP, FlexIOCntrlPort, INADDR_ANY, 0, 1000);
+	}
+	packetSource *source = openPacketSource(&options);
+	if (source == NULL) {
+		std::cout << "could not open the data port" << std::endl;
+		return 1;
+	}
+	//Closed windows go to the writer thread, memory is bounded by the windows in flight rather than numWindows
+	windowQueue closedWindows(options.maxInFlightWindows);
+	windowManager manager;
+	initWindowManager(&manager, &options, &closedWindows);
+	tagWriter writer;
+	initTagWriter(&writer, &options, &manager.memory);
+	//Encoding (and any other per window work) runs on a pool of its own, away from the decode loop and the writer
+	workPool *postPool = NULL;
+	windowPipeline *pipeline = NULL;
+	windowQueue processedWindows(options.maxInFlightWindows);
+	if (options.postWorkers != 0) {
+		postPool = new workPool(options.postWorkers);
+		pipeline = new windowPipeline;
+		initWindowPipeline(pipeline, postPool);
+		addEncodeStages(pipeline, options.compressLevel);
+	}
+	//Local analysis processes can follow the windows through shared memory
+	sharedTagRing ring;
+	if (!options.shmRingName.empty() && createSharedTagRing(&ring, options.shmRingName, options.shmRingBytes)) {
+		writer.ring = &ring;
+	}
+	//The sequencer hears about each shot as soon as it ends, without waiting on the file
+	shotPublisher publisher;
+	if (!options.publishAddress.empty() && startShotPublisher(&publisher, options.publishAddress)) {
+		manager.publisher = &publisher;
+	}
+	//Statistics gathered over shots, for watching the OD settle without reading every shot file back
+	shotStatistics stats;
+	if (!options.statsFile.empty()) {
+		initShotStatistics(&stats, &options);
+		writer.stats = &stats;
+	}
+	//Any window of any shot can be found again without walking the files
+	windowIndex index;
+	if (!options.indexFile.empty() && createWindowIndex(&index, options.indexFile)) {
+		writer.index = &index;
+	}
+	//A daemon stays connected and waits for runs to be started over its command port, otherwise the run starts now
+	acquisitionOptions runOptions = options;
+	std::thread writerThread;
+	bool runActive = options.daemonPort == 0;
+	if (runActive) {
+		startRun(&runOptions, &manager, &closedWindows, pipeline, &processedWindows, &writer, &writerThread);
+	}
+	if (options.metricsPort != 0) {
+		startMetricsServer(options.metricsPort, &closedWindows, pipeline != NULL ? &processedWindows : &closedWindows, &manager.memory);
+	}
+	decoderState decoder;
+	initDecoderState(&decoder);
+	tagColumns block;
+	//Afterpulses are dropped before windowing, with gated decoding the filter only sees the tags inside the gate
+	deadTimeFilter deadTime;
+	initDeadTimeFilter(&deadTime, options.deadTimeTicks, options.deadTimeRetrigger);
+	bool filterDeadTimes = false;
+	for (int channel = 0; channel < 8; channel++) {
+		filterDeadTimes = filterDeadTimes || options.deadTimeTicks[channel] != 0;
+	}
 
-	//Connect and configure the tagger
-	taggerControl->Connect(NULL, TTM8ApplCookie, taggerIP, FlexIOCntrlPort, INADDR_ANY, 0, 1000);
-	//Buffer size is 8MB
-	taggerDataConnection->Connect(taggerIP, FlexIODataPort, INADDR_ANY, 0, 8 * 1024 * 1024, INVALID_SOCKET);
-	taggerConfig = configSetter(&channelVect, &clockLine, &trigger_level);
-	taggerControl->ConfigMeasurement(taggerConfig);
-	//Start measurement
-	taggerControl->StartMeasurement(true);
-	Sleep(100);
-	//Check if data is available
-	taggerDataConnection->DataAvailable(&dataAvailable, 1000);
+	//Configure the tagger
+	taggerConfig = configSetter(&options.channelVect, &options.clockLine, &options.triggerLevel);
+	taggerConfig->DataFormat = options.dataFormat;
+	//The tagger sends to whichever port the receiver listens on
+	taggerConfig->DataTargetPort = options.dataPort;
+	enableGateEdges(taggerConfig, options.gates);
+	if (options.vendorControl) {
+		taggerControl->ConfigMeasurement(taggerConfig);
+		//Start measurement
+		taggerControl->StartMeasurement(true);
+	}
+	//What the tagger is running with now, changed between shots by set commands
+	liveSettings live;
+	initLiveSettings(&live, &options);
+	liveSettings pendingSettings;
+	bool settingsPending = false;
+	//The ingest benchmark receives and decodes for a while in place of the acquisition
+	if (options.benchmarkName == "ingest") {
+		ingestBenchmark(source, &options);
+		collectData = false;
+	}
+	//Sleep until packets arrive, the stop file is written or a gap shot is due, rather than on a fixed timeout
+	acquisitionEvents events;
+	bool eventsOpen = collectData && initAcquisitionEvents(&events, source->readySocket(), "stopFile.txt");
+	if (collectData && !eventsOpen) {
+		std::cout << "could not wait on the data socket" << std::endl;
+		collectData = false;
+	}
+	if (collectData && stopRequested()) {
+		collectData = false;
+	}
+	commandSlot commands;
+	bool takingCommands = collectData && options.daemonPort != 0 && startCommandServer(options.daemonPort, &commands, &events);
+	if (takingCommands) {
+		std::cout << "waiting for runs on port " << options.daemonPort << std::endl;
+	}
+	else if (options.daemonPort != 0) {
+		collectData = false;
+	}
 	//Process data until escape file is updated
 	while (collectData) {
-		//Loop while data is available
-		while (dataAvailable) {
-			TTMDataPacket_t *tagBuffer = new TTMDataPacket_t;
-			taggerDataConnection->FetchData(tagBuffer, 100);
-			processTags(tagBuffer, &countData, &clockLine);
-			taggerDataConnection->DataAvailable(&dataAvailable, 250);
-			//If we have acquired absorption, probe and background print the resulting counts to file
-			if (countData.windowNum == numWindows) {
-				tagsToHDF5(&countData, blackhole, "/Tags", "TagWindow", "StartTag", "EndTag", &channelVect);
-				countData.windowNum = 0;
-			}
-			//Check to see if the stopFile has been written to
-			std::ifstream stopFile;
-			stopFile.open("stopFile.txt");
-			std::string stopLine;
-			stopFile >> stopLine;
-			if (stopLine != "0") {
-				collectData = false;
-				break;
-			}
-		}
-		//If data isn't available we get kicked out of the above loop, we'll just keep checking if there is new data until the stopfile is updated
-		taggerDataConnection->DataAvailable(&dataAvailable, 250);
-		//If no data is available check the stop file and take a nap
-		if (!dataAvailable) {
-			//Check to see if the stopFile has been written to
-			std::ifstream stopFile;
-			stopFile.open("stopFile.txt");
-			std::string stopLine;
-			stopFile >> stopLine;
-			if (stopLine != "0") {
+		int fired;
+		if (options.busyPollMicros != 0) {
+			//Busy polling never sleeps, the other events are only peeked at between batches
+			fired = waitForEvents(&events, 0) | eventData;
+		}
+		else {
+			fired = waitForEvents(&events, runActive ? shotGapTimeout(&manager) : -1);
+		}
+		//Work through everything that is queued before sleeping again
+		if (fired & eventData) {
+			while (source->waitForData(0)) {
+				const TTMDataPacket_t *tagBuffer;
+				while ((tagBuffer = source->nextPacket()) != NULL) {
+					manager.packetReceived = stampNow();
+					recordPacket(tagBuffer);
+					if (options.gatedDecode) {
+						countMetric(metrics.tagsSkipped, decodeGatedTags(tagBuffer, &decoder, &block));
+					}
+					else {
+						decodeTags(tagBuffer, &decoder, &block);
+					}
+					if (correctTimes) {
+						correctTagTimes(&block, &corrections);
+					}
+					if (filterDeadTimes) {
+						countMetric(metrics.deadTimeRemoved, filterDeadTime(&block, &deadTime));
+					}
+					manager.packetDecoded = stampNow();
+					recordStage(&latencies.receiveToDecode, manager.packetReceived, manager.packetDecoded);
+					recordTags(&block);
+					//Between runs packets are still decoded so the time high word stays in step
+					if (runActive) {
+						processTagBlock(&block, &manager);
+						//Tags in this packet still belong to the shot, so the IO state is checked after them
+						if (correctTimes && digitalIOEndsShot(tagBuffer->Header.DigitalIOState, &manager)) {
+							processHeldTags(&corrections, &block, &manager);
+						}
+						checkDigitalIOState(tagBuffer->Header.DigitalIOState, &manager);
+					}
+				}
+			}
+		}
+		if (runActive) {
+			//Nothing more is queued, so the tags held back at the end of the last packet go in before the shot can end
+			if (correctTimes) {
+				processHeldTags(&corrections, &block, &manager);
+			}
+			checkShotGap(&manager);
+		}
+		//Commands are carried out between batches, a run started here takes the very next packet
+		runCommand command;
+		if ((fired & eventWake) && takingCommands && takeCommand(&commands, &command)) {
+			std::ostringstream reply;
+			if (command.kind == commandStart && runActive) {
+				reply << "error already running " << runOptions.blackhole;
+			}
+			else if (command.kind == commandStart) {
+				//Channels given with the start replace the live ones, the enabled edges change without stopping the measurement
+				if (!command.channelVect.empty()) {
+					liveSettings next = live;
+					next.channelVect = command.channelVect;
+					if (options.vendorControl) {
+						applyLiveSettings(taggerControl, &taggerConfig, options.triggerLevel, options.gates, &live, &next);
+					}
+					live = next;
+				}
+				runOptions = options;
+				runOptions.blackhole = command.blackhole;
+				if (command.numWindows != 0) {
+					runOptions.numWindows = command.numWindows;
+				}
+				runOptions.channelVect = live.channelVect;
+				runOptions.clockLine = live.clockLine;
+				//Tags held back between runs belong to no shot of this one
+				corrections.held.times.clear();
+				corrections.held.edges.clear();
+				startRun(&runOptions, &manager, &closedWindows, pipeline, &processedWindows, &writer, &writerThread);
+				runActive = true;
+				reply << "ok started " << runOptions.blackhole;
+			}
+			else if (command.kind == commandStop && runActive) {
+				if (correctTimes) {
+					processHeldTags(&corrections, &block, &manager);
+				}
+				finishRun(&runOptions, &manager, &closedWindows, pipeline, &writerThread);
+				runActive = false;
+				if (writer.stats != NULL) {
+					flushShotStatistics(writer.stats);
+				}
+				reply << "ok stopped " << runOptions.blackhole << " after " << writer.shotsWritten << " shots";
+			}
+			else if (command.kind == commandStop) {
+				reply << "error not running";
+			}
+			else if (command.kind == commandSet && settingsPending) {
+				reply << "error settings already waiting for the end of shot " << manager.shotNum;
+			}
+			else if (command.kind == commandSet) {
+				liveSettings next = live;
+				if (!command.channelVect.empty()) {
+					next.channelVect = command.channelVect;
+				}
+				if (command.clockLine != 0) {
+					next.clockLine = command.clockLine;
+				}
+				for (int i = 0; i < 10; i++) {
+					if (command.levelMask & (1 << i)) {
+						next.triggerLevels[i] = command.triggerLevels[i];
+					}
+				}
+				for (int i = 0; i < 9; i++) {
+					if (command.delayMask & (1 << i)) {
+						next.channelDelays[i] = command.channelDelays[i];
+					}
+				}
+				//Routing changes with the shot boundary, the tagger follows as soon as the decode loop has passed it
+				routingTable routing;
+				buildRoutingTable(&routing, next.channelVect, next.clockLine);
+				if (runActive && queueRouting(&manager, &routing)) {
+					pendingSettings = next;
+					settingsPending = true;
+					reply << "ok applying at the end of shot " << manager.shotNum;
+				}
+				else {
+					if (options.vendorControl) {
+						applyLiveSettings(taggerControl, &taggerConfig, options.triggerLevel, options.gates, &live, &next);
+					}
+					live = next;
+					reply << "ok applied";
+				}
+			}
+			else if (command.kind == commandStatus && runActive) {
+				reply << "ok running " << runOptions.blackhole << " shot " << manager.shotNum << " window " << manager.gates[0].windowNum;
+			}
+			else if (command.kind == commandStatus) {
+				reply << "ok idle";
+			}
+			else {
 				collectData = false;
-				break;
+				reply << "ok quitting";
+			}
+			answerCommand(&commands, reply.str());
+		}
+		if (settingsPending && !manager.routingPending) {
+			if (options.vendorControl) {
+				applyLiveSettings(taggerControl, &taggerConfig, options.triggerLevel, options.gates, &live, &pendingSettings);
+			}
+			live = pendingSettings;
+			settingsPending = false;
+		}
+		if ((fired & eventStopFile) && stopRequested()) {
+			collectData = false;
+		}
+	}
+	if (takingCommands) {
+		closeCommandSlot(&commands);
+		stopCommandServer();
+	}
+	if (options.vendorControl) {
+		//Stop measurement
+		taggerControl->StopMeasurement();
+		//Disconnect
+		taggerControl->Disconnect();
+	}
+	if (eventsOpen) {
+		closeAcquisitionEvents(&events);
+	}
+	source->disconnect();
+	if (runActive) {
+		if (correctTimes) {
+			processHeldTags(&corrections, &block, &manager);
+		}
+		finishRun(&runOptions, &manager, &closedWindows, pipeline, &writerThread);
+	}
+	if (writer.ring != NULL) {
+		closeSharedTagRing(writer.ring);
+	}
+	if (manager.publisher != NULL) {
+		stopShotPublisher(manager.publisher);
+	}
+	if (writer.stats != NULL) {
+		flushShotStatistics(writer.stats);
+	}
+	if (writer.index != NULL) {
+		closeWindowIndex(writer.index);
+	}
+	stopMetricsServer();
+	if (postPool != NULL) {
+		std::cout << "post-processing on " << postPool->workers() << " workers, " << postPool->steals() << " tasks stolen" << std::endl;
+		delete pipeline;
+		delete postPool;
+	}
+	if (filterDeadTimes) {
+		std::cout << "dead time removed";
+		for (int channel = 1; channel < 8; channel++) {
+			if (options.deadTimeTicks[channel] != 0) {
+				std::cout << " stop " << channel + 1 << ": " << deadTime.removed[channel];
 			}
-			Sleep(250);
 		}
+		std::cout << std::endl;
+	}
+	if (options.gatedDecode) {
+		uint64_t skipped = metrics.tagsSkipped.load();
+		uint64_t decoded = 0;
+		for (int channel = 0; channel < 8; channel++) {
+			decoded += metrics.tagsByChannel[channel].load();
+		}
+		std::cout << skipped << " of " << skipped + decoded << " tags skipped outside the gate";
+		if (skipped + decoded != 0) {
+			std::cout << " (" << 100.0 * skipped / (skipped + decoded) << "%)";
+		}
+		std::cout << std::endl;
 	}
-	//Stop measurement
-	taggerControl->StopMeasurement();
-	//Disconnect
-	taggerControl->Disconnect();
-	taggerDataConnection->Disconnect();
 	delete taggerConfig;
-	delete taggerDataConnection;
+	delete source;
 	delete taggerControl;
 
 	return 0;
 }
-
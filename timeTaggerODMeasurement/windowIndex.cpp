@@ -0,0 +1,249 @@
+// windowIndex.cpp : Sidecar index from (run, shot, gate, window) to the file, dataset and range the window is stored in
+//
+
+#include "stdafx.h"
+#include "windowIndex.h"
+#include "H5Cpp.h"
+#include <cstring>
+#include <iostream>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//Cut a file opened for update down to its first bytes
+static bool truncateFile(FILE *file, long bytes)
+{
+	fflush(file);
+#if defined(_WIN32)
+	return _chsize_s(_fileno(file), bytes) == 0;
+#else
+	return ftruncate(fileno(file), bytes) == 0;
+#endif
+}
+
+//Read the records of an index in order, handing each complete one to take. Returns the bytes of whole records read,
+//or 0 if the file is not an index
+template <typename recordFn>
+static long readIndexRecords(FILE *file, recordFn take)
+{
+	indexHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, windowIndexMagic, sizeof(header.magic)) != 0) {
+		return 0;
+	}
+	long valid = sizeof(header);
+	indexRecordHeader record;
+	std::vector<char> payload;
+	while (fread(&record, sizeof(record), 1, file) == 1) {
+		payload.resize(record.bytes);
+		if (record.bytes != 0 && fread(&payload[0], record.bytes, 1, file) != 1) {
+			break;
+		}
+		take(record, payload);
+		valid += (long)(sizeof(record) + record.bytes);
+	}
+	return valid;
+}
+
+bool createWindowIndex(windowIndex *index, const std::string &path)
+{
+	index->run = 0;
+	index->nextRun = 0;
+	index->nextFileNum = 0;
+	index->pending.clear();
+	index->file = fopen(path.c_str(), "r+b");
+	if (index->file != NULL) {
+		long valid = readIndexRecords(index->file, [index](const indexRecordHeader &record, const std::vector<char> &payload) {
+			if (record.kind == indexRecordFile) {
+				index->nextFileNum++;
+			}
+			else if (record.kind == indexRecordWindow && payload.size() == sizeof(windowIndexEntry)) {
+				const windowIndexEntry *entry = (const windowIndexEntry *)&payload[0];
+				if (entry->run >= index->nextRun) {
+					index->nextRun = entry->run + 1;
+				}
+			}
+		});
+		if (valid == 0) {
+			std::cout << path << " is not a window index" << std::endl;
+			fclose(index->file);
+			index->file = NULL;
+			return false;
+		}
+		//Anything torn off the end by a crash goes, a record appended after it would be read as part of it
+		if (!truncateFile(index->file, valid)) {
+			std::cout << "could not cut the torn end off the window index " << path << std::endl;
+			fclose(index->file);
+			index->file = NULL;
+			return false;
+		}
+		fseek(index->file, valid, SEEK_SET);
+		return true;
+	}
+	index->file = fopen(path.c_str(), "wb");
+	if (index->file == NULL) {
+		std::cout << "could not create the window index " << path << std::endl;
+		return false;
+	}
+	indexHeader header;
+	memcpy(header.magic, windowIndexMagic, sizeof(header.magic));
+	header.version = 1;
+	header.reserved = 0;
+	fwrite(&header, sizeof(header), 1, index->file);
+	fflush(index->file);
+	return true;
+}
+
+void startIndexRun(windowIndex *index)
+{
+	index->run = index->nextRun++;
+	index->pending.clear();
+}
+
+void indexWindowDataset(windowIndex *index, const tagWindow *window, indexStream stream, const std::string &dataset, uint64_t first, uint64_t count)
+{
+	windowIndexEntry entry;
+	//Names are kept whole or not at all, a cut one would point at some other dataset or none
+	if (dataset.size() >= sizeof(entry.dataset)) {
+		std::cout << dataset << " is too long a dataset name for the window index, window " << window->windowNum << " of gate " << window->gateNum << " in shot " << window->shotNum << " is not indexed" << std::endl;
+		return;
+	}
+	memset(&entry, 0, sizeof(entry));
+	entry.run = index->run;
+	entry.shot = (uint32_t)window->shotNum;
+	entry.gate = window->gateNum;
+	entry.window = window->windowNum;
+	entry.stream = stream;
+	entry.startTime = window->startTime;
+	entry.first = first;
+	entry.count = count;
+	memcpy(entry.dataset, dataset.c_str(), dataset.size());
+	index->pending.push_back(entry);
+}
+
+static void writeRecord(FILE *file, indexRecordKind kind, const void *payload, size_t bytes)
+{
+	indexRecordHeader record;
+	record.kind = kind;
+	record.bytes = (uint32_t)bytes;
+	fwrite(&record, sizeof(record), 1, file);
+	fwrite(payload, bytes, 1, file);
+}
+
+void commitIndexedShot(windowIndex *index, const std::string &filename)
+{
+	if (index->pending.empty()) {
+		return;
+	}
+	uint32_t fileNum = index->nextFileNum++;
+	std::vector<char> fileRecord(sizeof(fileNum) + filename.size());
+	memcpy(&fileRecord[0], &fileNum, sizeof(fileNum));
+	memcpy(&fileRecord[sizeof(fileNum)], filename.c_str(), filename.size());
+	writeRecord(index->file, indexRecordFile, &fileRecord[0], fileRecord.size());
+	for (size_t e = 0; e < index->pending.size(); e++) {
+		index->pending[e].fileNum = fileNum;
+		writeRecord(index->file, indexRecordWindow, &index->pending[e], sizeof(windowIndexEntry));
+	}
+	//Readers can look the shot up as soon as it is on disk
+	fflush(index->file);
+	index->pending.clear();
+}
+
+void closeWindowIndex(windowIndex *index)
+{
+	if (index->file != NULL) {
+		fclose(index->file);
+		index->file = NULL;
+	}
+}
+
+bool loadWindowIndex(indexedWindows *indexed, const std::string &path)
+{
+	indexed->files.clear();
+	indexed->entries.clear();
+	FILE *file = fopen(path.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
+	long valid = readIndexRecords(file, [indexed](const indexRecordHeader &record, const std::vector<char> &payload) {
+		if (record.kind == indexRecordFile && payload.size() >= sizeof(uint32_t)) {
+			uint32_t fileNum;
+			memcpy(&fileNum, &payload[0], sizeof(fileNum));
+			if (indexed->files.size() <= fileNum) {
+				indexed->files.resize(fileNum + 1);
+			}
+			indexed->files[fileNum].assign(&payload[sizeof(fileNum)], payload.size() - sizeof(fileNum));
+		}
+		else if (record.kind == indexRecordWindow && payload.size() == sizeof(windowIndexEntry)) {
+			const windowIndexEntry *entry = (const windowIndexEntry *)&payload[0];
+			windowKey key = { entry->run, entry->shot, entry->gate, entry->window, entry->stream };
+			indexed->entries[key] = *entry;
+		}
+	});
+	fclose(file);
+	return valid != 0;
+}
+
+const windowIndexEntry *findIndexedWindow(const indexedWindows *indexed, uint32_t run, uint32_t shot, uint32_t gate, uint32_t window, indexStream stream)
+{
+	windowKey key = { run, shot, gate, window, (uint32_t)stream };
+	std::map<windowKey, windowIndexEntry>::const_iterator found = indexed->entries.find(key);
+	return found == indexed->entries.end() ? NULL : &found->second;
+}
+
+//Read the range of an entry out of its dataset
+static void readEntryRange(const indexedWindows *indexed, const windowIndexEntry *entry, std::vector<uint32_t> *values)
+{
+	values->resize((size_t)entry->count);
+	if (entry->count == 0) {
+		return;
+	}
+	H5::H5File file(indexed->files[entry->fileNum], H5F_ACC_RDONLY);
+	H5::DataSet dset = file.openDataSet(entry->dataset);
+	//Counts live in a windows x rows x bins table, the entry's range is in elements of the flattened table
+	H5::DataSpace fileSpace = dset.getSpace();
+	int rank = fileSpace.getSimpleExtentNdims();
+	hsize_t dims[3] = { 0, 0, 0 };
+	fileSpace.getSimpleExtentDims(dims);
+	hsize_t inner = 1;
+	for (int d = 1; d < rank; d++) {
+		inner *= dims[d];
+	}
+	hsize_t offset[3] = { entry->first / inner, 0, 0 };
+	hsize_t count[3] = { entry->count / inner, dims[1], dims[2] };
+	fileSpace.selectHyperslab(H5S_SELECT_SET, count, offset);
+	hsize_t memDims[1] = { entry->count };
+	H5::DataSpace memSpace(1, memDims);
+	dset.read(&(*values)[0], H5::PredType::NATIVE_UINT32, memSpace, fileSpace);
+}
+
+void readIndexedTags(const indexedWindows *indexed, const windowIndexEntry *entry, int channel, tagColumns *tags)
+{
+	std::vector<uint32_t> words;
+	readEntryRange(indexed, entry, &words);
+	decoderState state;
+	initDecoderState(&state);
+	state.highWord = windowHighWord(entry->startTime);
+	tags->times.clear();
+	tags->edges.clear();
+	decodeStoredWords(words.data(), words.size(), &state, tags);
+	if (channel == allChannels) {
+		return;
+	}
+	size_t kept = 0;
+	for (size_t t = 0; t < tags->times.size(); t++) {
+		if (edgeChannel(tags->edges[t]) == channel) {
+			tags->times[kept] = tags->times[t];
+			tags->edges[kept] = tags->edges[t];
+			kept++;
+		}
+	}
+	tags->times.resize(kept);
+	tags->edges.resize(kept);
+}
+
+void readIndexedCounts(const indexedWindows *indexed, const windowIndexEntry *entry, std::vector<uint32_t> *counts)
+{
+	readEntryRange(indexed, entry, counts);
+}
@@ -0,0 +1,124 @@
+// windowIndex.h : Sidecar index from (run, shot, gate, window) to the file, dataset and range the window is stored in
+//
+// Layout: a 16 byte indexHeader followed by records, each an indexRecordHeader and its payload. A file record names a
+// shot file once and gives it a number, window records (a windowIndexEntry each) refer to files by that number. The
+// records of a shot are appended once its file has been renamed into place, so everything indexed can be opened. A
+// record torn by a crash is at the very end and is ignored on reading.
+//
+// Tags of all the channels of a window are interleaved in one dataset, so a window is looked up by its stream (tags,
+// clock tags, coincidence tags or counts) and the channel is picked out as its words are decoded.
+
+#pragma once
+
+#include "windowManager.h"
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+const char windowIndexMagic[8] = { 'T', 'T', 'M', 'W', 'I', 'D', 'X', '1' };
+
+struct indexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+enum indexRecordKind {
+	indexRecordFile = 1,
+	indexRecordWindow = 2
+};
+
+struct indexRecordHeader {
+	uint32_t kind;
+	//Bytes of payload after the header
+	uint32_t bytes;
+};
+
+//Which of the datasets of a window an entry points at
+enum indexStream {
+	indexTags,
+	indexClockTags,
+	indexCoincTags,
+	indexCounts
+};
+
+//Channel to pass to take every channel of a window
+const int allChannels = -1;
+
+struct windowIndexEntry {
+	uint32_t run;
+	uint32_t shot;
+	uint32_t gate;
+	uint32_t window;
+	uint32_t stream;
+	uint32_t fileNum;
+	//Start of the window, its packed tag words pick up from the high word of this
+	uint64_t startTime;
+	//Elements of the dataset the window takes up, the whole dataset for tags and a slab of the shot's table for counts
+	uint64_t first;
+	uint64_t count;
+	//Null terminated, windows of longer names are left out of the index
+	char dataset[64];
+};
+
+//Writer side, kept by the tag writer across runs
+struct windowIndex {
+	FILE *file;
+	//Run the shots written now belong to, and the one the next run gets
+	uint32_t run;
+	uint32_t nextRun;
+	uint32_t nextFileNum;
+	//Entries of the shot being written, held back until its file is in place
+	std::vector<windowIndexEntry> pending;
+};
+
+//Open the index for appending, creating it if need be. Runs are numbered on from the last one already in it
+bool createWindowIndex(windowIndex *index, const std::string &path);
+
+//Number the shots from now on as a new run
+void startIndexRun(windowIndex *index);
+
+//Record where a dataset of a window of the shot being written is stored. A name too long for windowIndexEntry is
+//reported and the dataset is not indexed
+void indexWindowDataset(windowIndex *index, const tagWindow *window, indexStream stream, const std::string &dataset, uint64_t first, uint64_t count);
+
+//The shot is in place as filename, append its entries to the index
+void commitIndexedShot(windowIndex *index, const std::string &filename);
+
+void closeWindowIndex(windowIndex *index);
+
+//Ordering of the entries for lookups
+struct windowKey {
+	uint32_t run;
+	uint32_t shot;
+	uint32_t gate;
+	uint32_t window;
+	uint32_t stream;
+	bool operator<(const windowKey &other) const {
+		if (run != other.run) return run < other.run;
+		if (shot != other.shot) return shot < other.shot;
+		if (gate != other.gate) return gate < other.gate;
+		if (window != other.window) return window < other.window;
+		return stream < other.stream;
+	}
+};
+
+//Reader side, the whole index held in memory
+struct indexedWindows {
+	std::vector<std::string> files;
+	std::map<windowKey, windowIndexEntry> entries;
+};
+
+//Read an index, false if it cannot be opened or is not an index
+bool loadWindowIndex(indexedWindows *indexed, const std::string &path);
+
+//Entry of a window, NULL if it is not in the index
+const windowIndexEntry *findIndexedWindow(const indexedWindows *indexed, uint32_t run, uint32_t shot, uint32_t gate, uint32_t window, indexStream stream);
+
+//Decode the tags of an entry straight from its dataset, keeping only the given tag channel unless it is allChannels.
+//Throws H5::Exception if the file or dataset cannot be read
+void readIndexedTags(const indexedWindows *indexed, const windowIndexEntry *entry, int channel, tagColumns *tags);
+
+//The counts (rows x bins) of a counts entry
+void readIndexedCounts(const indexedWindows *indexed, const windowIndexEntry *entry, std::vector<uint32_t> *counts);
@@ -0,0 +1,738 @@
+// windowManager.cpp : Streaming gate windows, each closed window is handed downstream as soon as it closes
+//
+
+#include "stdafx.h"
+#include "windowManager.h"
+#include "pipelineMetrics.h"
+#include "shotPublisher.h"
+#include <cstdio>
+#include <iostream>
+
+//Storage of one decoded tag, a time and an edge
+const uint64_t bytesPerTag = sizeof(uint64_t) + sizeof(uint8_t);
+
+//Spill files of long windows can pass 2GB
+#if defined(_WIN32)
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+windowQueue::windowQueue(size_t capacity) : maxWindows(capacity), closed(false)
+{
+}
+
+void windowQueue::push(tagWindow *window)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	notFull.wait(guard, [this] { return windows.size() < maxWindows || closed; });
+	windows.push_back(window);
+	notEmpty.notify_one();
+}
+
+tagWindow *windowQueue::pop()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	notEmpty.wait(guard, [this] { return !windows.empty() || closed; });
+	if (windows.empty()) {
+		return NULL;
+	}
+	tagWindow *window = windows.front();
+	windows.pop_front();
+	notFull.notify_one();
+	return window;
+}
+
+void windowQueue::close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	closed = true;
+	notEmpty.notify_all();
+	notFull.notify_all();
+}
+
+void windowQueue::reopen()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	closed = false;
+}
+
+size_t windowQueue::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return windows.size();
+}
+
+size_t windowQueue::capacity()
+{
+	return maxWindows;
+}
+
+static void resetShotTallies(gateStream *stream)
+{
+	for (int channel = 0; channel < 8; channel++) {
+		stream->shotPhotons[channel] = 0;
+	}
+	stream->windowPhotons.clear();
+	stream->shotCoincidences = 0;
+}
+
+void initWindowManager(windowManager *manager, const acquisitionOptions *options, windowQueue *downstream)
+{
+	manager->rule = options->shotBoundary;
+	manager->windowsPerShot = options->numWindows;
+	manager->shotGapMillis = options->shotGapMillis;
+	manager->digitalIOMask = options->digitalIOMask;
+	manager->countBins = options->countsOnly ? options->countBins : 0;
+	manager->countBinTicks = options->countBinTicks;
+	manager->countCoincidences = options->coincWindowTicks != 0;
+	manager->odReferenceGate = options->odReferenceGate;
+	std::vector<gateDefinition> gates = options->gates;
+	if (gates.empty()) {
+		gates.push_back(standardGate());
+	}
+	manager->gates.resize(gates.size());
+	for (size_t g = 0; g < gates.size(); g++) {
+		gateStream *stream = &manager->gates[g];
+		stream->gate = gates[g];
+		stream->openWindow = NULL;
+		stream->windowNum = 0;
+		stream->clockEdges = 0;
+		stream->addedTags = 0;
+		resetShotTallies(stream);
+		initCoincidenceCounter(&stream->coincidence, options->coincWindowTicks, options->coincMin, options->coincMax, options->coincChannelMask, options->coincTags);
+	}
+	buildRoutingTable(&manager->routing, options->channelVect, options->clockLine);
+	addGateRoutes(&manager->routing, gates);
+	manager->routingPending = false;
+	manager->shotNum = 0;
+	manager->lastGateEdge = std::chrono::steady_clock::now();
+	manager->digitalIOActive = false;
+	manager->unpairedEdges = 0;
+	manager->windowsCutShort = 0;
+	manager->backpressure = options->backpressure;
+	manager->pressureBins = options->countBins;
+	manager->droppingShot = false;
+	manager->windowsDegraded = 0;
+	manager->packetsLostBefore = metrics.packetsLost.load();
+	manager->publisher = NULL;
+	manager->downstream = downstream;
+	manager->memoryBudget = options->memoryBudget;
+	manager->spillPrefix = options->spillPrefix;
+	manager->memory.inFlightBytes = 0;
+	manager->memory.shotPeakBytes = 0;
+	manager->packetReceived = stampNow();
+	manager->packetDecoded = manager->packetReceived;
+	manager->lastPhotonReceived = manager->packetReceived;
+}
+
+void buildRoutingTable(routingTable *table, const std::vector<uint16_t> &channelVect, uint16_t clockLine)
+{
+	uint8_t unlisted = channelVect.empty() ? routeWindowed : routeDrop;
+	for (int edge = 0; edge < routedEdges; edge++) {
+		table->routes[edge] = unlisted;
+	}
+	//Stop inputs are numbered from 1 whereas tags number the channels from 0
+	for (size_t i = 0; i < channelVect.size(); i++) {
+		int channel = channelVect[i] - 1;
+		if (channel >= 0 && 2 * channel + 1 < routedEdges) {
+			table->routes[2 * channel] = routeWindowed;
+			table->routes[2 * channel + 1] = routeWindowed;
+		}
+	}
+	int clockChannel = clockLine - 1;
+	if (clockChannel >= 0 && 2 * clockChannel + 1 < routedEdges) {
+		table->routes[2 * clockChannel] = routeClock;
+		table->routes[2 * clockChannel + 1] = routeClock;
+	}
+	table->routes[0] = routeGate;
+	table->routes[1] = routeGate;
+	table->clockGates = false;
+	table->channelVect = channelVect;
+	//Counted channels follow the channel list, or all of them if there is none
+	table->numCountRows = 0;
+	for (int channel = 0; channel < 8; channel++) {
+		table->countRows[channel] = -1;
+		if (channelVect.empty() && channel != 0) {
+			table->countRows[channel] = (int8_t)table->numCountRows++;
+		}
+	}
+	for (size_t i = 0; i < channelVect.size(); i++) {
+		int channel = channelVect[i] - 1;
+		if (channel > 0 && channel < 8 && table->countRows[channel] < 0) {
+			table->countRows[channel] = (int8_t)table->numCountRows++;
+		}
+	}
+}
+
+void addGateRoutes(routingTable *table, const std::vector<gateDefinition> &gates)
+{
+	for (size_t g = 0; g < gates.size(); g++) {
+		uint8_t edges[2] = { gates[g].openEdge, gates[g].closeEdge };
+		//Only the opening edge matters for gates closed by a clock count
+		int numEdges = gates[g].closeClocks != 0 ? 1 : 2;
+		for (int e = 0; e < numEdges; e++) {
+			//Both edges of a gate channel are kept out of the windows, as for stop 1
+			int channel = edgeChannel(edges[e]);
+			if (2 * channel + 1 >= routedEdges) {
+				continue;
+			}
+			if (table->routes[2 * channel] == routeClock) {
+				table->clockGates = true;
+				continue;
+			}
+			table->routes[2 * channel] = routeGate;
+			table->routes[2 * channel + 1] = routeGate;
+		}
+		if (gates[g].closeClocks != 0) {
+			table->clockGates = true;
+		}
+	}
+}
+
+gateDefinition standardGate()
+{
+	gateDefinition gate;
+	gate.openEdge = 1;
+	gate.closeEdge = 0;
+	gate.closeClocks = 0;
+	return gate;
+}
+
+bool shotInProgress(const windowManager *manager)
+{
+	for (size_t g = 0; g < manager->gates.size(); g++) {
+		if (manager->gates[g].windowNum != 0 || manager->gates[g].openWindow != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+//Gates of the run, as given to addGateRoutes
+static std::vector<gateDefinition> gateDefinitions(const windowManager *manager)
+{
+	std::vector<gateDefinition> gates;
+	for (size_t g = 0; g < manager->gates.size(); g++) {
+		gates.push_back(manager->gates[g].gate);
+	}
+	return gates;
+}
+
+bool queueRouting(windowManager *manager, const routingTable *routing)
+{
+	routingTable gated = *routing;
+	addGateRoutes(&gated, gateDefinitions(manager));
+	if (!shotInProgress(manager)) {
+		manager->routing = gated;
+		manager->routingPending = false;
+		return false;
+	}
+	manager->pendingRouting = gated;
+	manager->routingPending = true;
+	return true;
+}
+
+//Shot boundary, tags from here on are routed with the queued table
+static void swapPendingRouting(windowManager *manager)
+{
+	if (manager->routingPending) {
+		manager->routing = manager->pendingRouting;
+		manager->routingPending = false;
+	}
+}
+
+static tagWindow *newWindow(windowManager *manager, uint32_t gateNum)
+{
+	tagWindow *window = new tagWindow;
+	countMetric(metrics.windowAllocations);
+	window->shotEnd = false;
+	window->shotNum = manager->shotNum;
+	window->gateNum = gateNum;
+	window->windowNum = manager->gates[gateNum].windowNum;
+	window->startTime = 0;
+	window->startEdge = 0;
+	window->endTime = 0;
+	window->endEdge = 0;
+	window->complete = false;
+	window->accountedBytes = 0;
+	window->columnCapacity = 0;
+	window->peakTagBytes = 0;
+	window->coincidences.groups = 0;
+	window->encoded = false;
+	window->compressed = false;
+	for (int channel = 0; channel < 8; channel++) {
+		window->photons[channel] = 0;
+	}
+	window->storage = storeFull;
+	window->packetsLost = 0;
+	window->spillFailed = false;
+	window->countBins = manager->countBins;
+	if (manager->countBins != 0) {
+		window->counts.assign(manager->routing.numCountRows * manager->countBins, 0);
+	}
+	return window;
+}
+
+//How full the closed window queue or the memory budget is, whichever is fuller, in percent
+static uint32_t pressurePercent(windowManager *manager)
+{
+	uint64_t percent = manager->downstream->size() * 100 / manager->downstream->capacity();
+	if (manager->memoryBudget != 0) {
+		uint64_t memoryPercent = manager->memory.inFlightBytes.load() * 100 / manager->memoryBudget;
+		percent = memoryPercent > percent ? memoryPercent : percent;
+	}
+	return (uint32_t)percent;
+}
+
+//Decide whether a shot starting now is dropped
+static void startShotUnderPressure(windowManager *manager)
+{
+	manager->droppingShot = false;
+	uint32_t pressure = pressurePercent(manager);
+	for (size_t t = 0; t < manager->backpressure.size(); t++) {
+		if (manager->backpressure[t].action == pressureDrop && pressure >= manager->backpressure[t].percent) {
+			manager->droppingShot = true;
+		}
+	}
+}
+
+//Give up what the tiers the pressure has reached say to on a newly opened window
+static void degradeWindow(windowManager *manager, tagWindow *window)
+{
+	uint8_t storage = storeFull;
+	if (manager->droppingShot) {
+		storage = storeDropped;
+	}
+	else {
+		uint32_t pressure = pressurePercent(manager);
+		for (size_t t = 0; t < manager->backpressure.size(); t++) {
+			const pressureTier *tier = &manager->backpressure[t];
+			if (pressure < tier->percent) {
+				continue;
+			}
+			//Windows already counted have nothing to gain from the counts tier
+			if (tier->action == pressureCounts && window->countBins == 0 && storage < storeCounts) {
+				storage = storeCounts;
+			}
+			else if ((tier->action == pressureBackground && window->gateNum != 0) || tier->action == pressureDrop) {
+				storage = storeTotals;
+			}
+		}
+	}
+	if (storage == storeFull) {
+		return;
+	}
+	window->storage = storage;
+	if (storage == storeCounts) {
+		window->countBins = manager->pressureBins;
+		window->counts.assign(manager->routing.numCountRows * window->countBins, 0);
+	}
+	if (storage != storeDropped) {
+		manager->windowsDegraded++;
+		countMetric(metrics.windowsDegraded);
+	}
+}
+
+//Count tags (and other storage) added to an open window against the budget and keep track of the peak for the shot
+static void accountTags(windowManager *manager, tagWindow *window, size_t numTags, uint64_t extraBytes)
+{
+	uint64_t bytes = numTags * bytesPerTag + extraBytes;
+	window->accountedBytes += bytes;
+	uint64_t inFlight = (manager->memory.inFlightBytes += bytes);
+	uint64_t peak = manager->memory.shotPeakBytes;
+	while (inFlight > peak && !manager->memory.shotPeakBytes.compare_exchange_weak(peak, inFlight)) {
+	}
+}
+
+//Hand the open window of a gate downstream, ownership passes to the queue
+static void closeWindow(windowManager *manager, gateStream *stream)
+{
+	tagWindow *window = stream->openWindow;
+	accountTags(manager, window, stream->addedTags, 0);
+	stream->addedTags = 0;
+	if (manager->countCoincidences) {
+		endCoincidenceGroup(&stream->coincidence, &window->coincidences);
+		accountTags(manager, window, window->coincidences.tags.times.size(), 0);
+		stream->shotCoincidences += window->coincidences.groups;
+	}
+	uint64_t windowPhotons = 0;
+	for (int channel = 0; channel < 8; channel++) {
+		stream->shotPhotons[channel] += window->photons[channel];
+		windowPhotons += window->photons[channel];
+	}
+	stream->windowPhotons.push_back(windowPhotons);
+	window->closeReceived = manager->lastPhotonReceived;
+	window->closed = stampNow();
+	stream->openWindow = NULL;
+	stream->windowNum++;
+	//Windows of a dropped shot are only there to keep the shot boundaries where they would have been
+	if (window->storage == storeDropped) {
+		releaseWindow(window, &manager->memory);
+		return;
+	}
+	if (window->complete) {
+		recordStage(&latencies.decodeToWindowClose, manager->packetDecoded, window->closed);
+	}
+	manager->downstream->push(window);
+	countMetric(metrics.windowsClosed);
+}
+
+//Add a photon to the counts of an open window, binned by its time since the gate opened
+static inline void countTag(windowManager *manager, tagWindow *window, uint8_t channel, uint64_t time)
+{
+	int row = manager->routing.countRows[channel & 7];
+	if (row < 0) {
+		return;
+	}
+	uint64_t bin = 0;
+	//Corrected times can put a tag a little before the gate edge that opened its window, it goes in the first bin
+	if (window->countBins > 1 && time > window->startTime) {
+		bin = (time - window->startTime) / manager->countBinTicks;
+		if (bin >= window->countBins) {
+			bin = window->countBins - 1;
+		}
+	}
+	window->counts[row * window->countBins + bin]++;
+}
+
+//Append the leading whole blocks of some tag columns to the spill file, false if any of it could not be written
+static bool writeSpillBlocks(const tagColumns *tags, FILE *spillFile)
+{
+	size_t numBlocks = tags->times.size() / spillBlockTags;
+	for (size_t b = 0; b < numBlocks; b++) {
+		if (fwrite(&tags->times[b * spillBlockTags], sizeof(uint64_t), spillBlockTags, spillFile) != spillBlockTags) {
+			return false;
+		}
+		if (fwrite(&tags->edges[b * spillBlockTags], sizeof(uint8_t), spillBlockTags, spillFile) != spillBlockTags) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//Record the leading whole blocks of some tag columns as spilled, once they are safely on disk, and drop them from memory
+static size_t spillColumns(tagWindow *window, tagColumns *tags, bool clock)
+{
+	size_t numBlocks = tags->times.size() / spillBlockTags;
+	for (size_t b = 0; b < numBlocks; b++) {
+		spilledBlock block;
+		//Blocks are appended back to back so the offset follows from the ones before
+		block.offset = 0;
+		if (!window->spilled.empty()) {
+			block.offset = window->spilled.back().offset + window->spilled.back().numTags * bytesPerTag;
+		}
+		block.numTags = (uint32_t)spillBlockTags;
+		block.clock = clock;
+		window->spilled.push_back(block);
+		countMetric(metrics.spilledBlocks);
+	}
+	size_t spilledTags = numBlocks * spillBlockTags;
+	tags->times.erase(tags->times.begin(), tags->times.begin() + spilledTags);
+	tags->edges.erase(tags->edges.begin(), tags->edges.begin() + spilledTags);
+	//Hand the memory back rather than keeping the capacity around
+	tags->times.shrink_to_fit();
+	tags->edges.shrink_to_fit();
+	return spilledTags;
+}
+
+//Move the completed blocks of an open window out to its spill file
+static void spillWindow(windowManager *manager, tagWindow *window)
+{
+	if (window->spillPath.empty()) {
+		window->spillPath = manager->spillPrefix + "." + std::to_string(window->shotNum) + "." + std::to_string(window->gateNum) + "." + std::to_string(window->windowNum);
+	}
+	FILE *spillFile = fopen(window->spillPath.c_str(), "ab");
+	bool written = spillFile != NULL;
+	written = written && writeSpillBlocks(&window->windowedTags, spillFile);
+	written = written && writeSpillBlocks(&window->clockTags, spillFile);
+	//Blocks are only on disk once the file is closed without error
+	if (spillFile != NULL && fclose(spillFile) != 0) {
+		written = false;
+	}
+	if (!written) {
+		//The tags stay in memory, and the window is not spilled again as whatever did get written throws the offsets
+		//of later blocks out
+		std::cout << "could not spill window " << window->windowNum << " of gate " << window->gateNum << " in shot " << window->shotNum << " to " << window->spillPath << ", its tags stay in memory" << std::endl;
+		window->spillFailed = true;
+		countMetric(metrics.spillFailures);
+		return;
+	}
+	size_t spilledTags = spillColumns(window, &window->windowedTags, false);
+	spilledTags += spillColumns(window, &window->clockTags, true);
+	uint64_t bytes = spilledTags * bytesPerTag;
+	window->accountedBytes -= bytes;
+	manager->memory.inFlightBytes -= bytes;
+}
+
+//Open and close the window of one gate on a gate or clock edge. Closing goes first, so a gate opening and closing on
+//the same edge cuts windows back to back
+static void gateEdge(windowManager *manager, uint32_t gateNum, uint64_t time, uint8_t edge, bool clockTick)
+{
+	gateStream *stream = &manager->gates[gateNum];
+	bool closes;
+	if (stream->gate.closeClocks != 0) {
+		closes = clockTick && stream->openWindow != NULL && ++stream->clockEdges >= stream->gate.closeClocks;
+	}
+	else {
+		closes = edge == stream->gate.closeEdge;
+	}
+	bool opens = edge == stream->gate.openEdge;
+	if (!closes && !opens) {
+		return;
+	}
+	manager->lastGateEdge = std::chrono::steady_clock::now();
+	if (closes) {
+		if (stream->openWindow != NULL) {
+			stream->openWindow->endTime = time;
+			stream->openWindow->endEdge = edge;
+			stream->openWindow->complete = true;
+			manager->lastPhotonReceived = manager->packetReceived;
+			closeWindow(manager, stream);
+			if (gateNum == 0 && manager->rule == shotRuleCount && stream->windowNum >= manager->windowsPerShot) {
+				endShot(manager);
+			}
+		}
+		else if (!opens) {
+			manager->unpairedEdges++;
+			countMetric(metrics.unpairedEdges);
+		}
+	}
+	if (opens) {
+		if (stream->openWindow != NULL) {
+			//A gate opening on the clock line sees the ticks inside its windows as well, those are not missing edges
+			if (!clockTick) {
+				manager->unpairedEdges++;
+				countMetric(metrics.unpairedEdges);
+			}
+			return;
+		}
+		if (!manager->backpressure.empty() && !shotInProgress(manager)) {
+			startShotUnderPressure(manager);
+		}
+		stream->openWindow = newWindow(manager, gateNum);
+		stream->openWindow->startTime = time;
+		stream->openWindow->startEdge = edge;
+		stream->clockEdges = 0;
+		if (!manager->backpressure.empty()) {
+			degradeWindow(manager, stream->openWindow);
+		}
+		if (!stream->openWindow->counts.empty()) {
+			accountTags(manager, stream->openWindow, 0, stream->openWindow->counts.size() * sizeof(uint32_t));
+		}
+	}
+}
+
+//Add a windowed or clock tag to the open window of a gate. Coincidences and count bins are worked out here rather than
+//on the post-processing pool, a compare or an increment per tag, so neither tags nor shot summaries wait on the pool
+static inline void addTag(windowManager *manager, gateStream *stream, uint64_t time, uint8_t edge, uint8_t route)
+{
+	tagWindow *window = stream->openWindow;
+	if (route == routeWindowed) {
+		window->photons[edgeChannel(edge)]++;
+		if (window->storage >= storeTotals) {
+			return;
+		}
+		if (manager->countCoincidences) {
+			addCoincidenceTag(&stream->coincidence, time, edge, &window->coincidences);
+		}
+		if (window->countBins != 0) {
+			countTag(manager, window, edgeChannel(edge), time);
+		}
+		else {
+			window->windowedTags.times.push_back(time);
+			window->windowedTags.edges.push_back(edge);
+			stream->addedTags++;
+		}
+	}
+	else if (window->countBins == 0 && window->storage == storeFull) {
+		window->clockTags.times.push_back(time);
+		window->clockTags.edges.push_back(edge);
+		stream->addedTags++;
+	}
+}
+
+void processTagBlock(const tagColumns *block, windowManager *manager)
+{
+	size_t numTags = block->times.size();
+	uint32_t numGates = (uint32_t)manager->gates.size();
+	for (size_t i = 0; i < numTags; i++) {
+		uint8_t edge = block->edges[i];
+		uint8_t route = manager->routing.routes[edge & (routedEdges - 1)];
+		//Gate edges open and close windows, clock edges as well when some gate counts them or opens on them
+		if (route == routeGate || (route == routeClock && manager->routing.clockGates)) {
+			bool clockTick = route == routeClock && edgeSlope(edge) == 1;
+			for (uint32_t g = 0; g < numGates; g++) {
+				gateEdge(manager, g, block->times[i], edge, clockTick);
+			}
+		}
+		if (route == routeGate || route == routeDrop) {
+			continue;
+		}
+		//A tag goes to every window it falls in, decoded once
+		for (uint32_t g = 0; g < numGates; g++) {
+			if (manager->gates[g].openWindow != NULL) {
+				addTag(manager, &manager->gates[g], block->times[i], edge, route);
+			}
+		}
+	}
+	for (uint32_t g = 0; g < numGates; g++) {
+		gateStream *stream = &manager->gates[g];
+		if (stream->openWindow == NULL) {
+			continue;
+		}
+		if (stream->addedTags != 0) {
+			manager->lastPhotonReceived = manager->packetReceived;
+		}
+		accountTags(manager, stream->openWindow, stream->addedTags, 0);
+		stream->addedTags = 0;
+		size_t capacity = stream->openWindow->windowedTags.times.capacity() + stream->openWindow->clockTags.times.capacity();
+		if (capacity > stream->openWindow->columnCapacity) {
+			countMetric(metrics.columnGrowths);
+		}
+		stream->openWindow->columnCapacity = capacity;
+		//Oversized windows go to disk a block at a time once we are over budget
+		if (manager->memoryBudget != 0 && manager->memory.inFlightBytes > manager->memoryBudget) {
+			bool spillable = !stream->openWindow->spillFailed;
+			if (spillable && (stream->openWindow->windowedTags.times.size() >= spillBlockTags || stream->openWindow->clockTags.times.size() >= spillBlockTags)) {
+				spillWindow(manager, stream->openWindow);
+			}
+		}
+	}
+}
+
+bool digitalIOEndsShot(uint16_t digitalIOState, const windowManager *manager)
+{
+	//Shot is over once the IO line drops
+	return manager->rule == shotRuleDigitalIO && manager->digitalIOActive && (digitalIOState & manager->digitalIOMask) == 0;
+}
+
+void checkDigitalIOState(uint16_t digitalIOState, windowManager *manager)
+{
+	if (manager->rule != shotRuleDigitalIO) {
+		return;
+	}
+	if (digitalIOEndsShot(digitalIOState, manager)) {
+		endShot(manager);
+	}
+	manager->digitalIOActive = (digitalIOState & manager->digitalIOMask) != 0;
+}
+
+void checkShotGap(windowManager *manager)
+{
+	if (manager->shotGapMillis == 0) {
+		return;
+	}
+	if (!shotInProgress(manager)) {
+		return;
+	}
+	std::chrono::steady_clock::duration quiet = std::chrono::steady_clock::now() - manager->lastGateEdge;
+	if (quiet >= std::chrono::milliseconds(manager->shotGapMillis)) {
+		endShot(manager);
+	}
+}
+
+int shotGapTimeout(const windowManager *manager)
+{
+	if (manager->shotGapMillis == 0 || !shotInProgress(manager)) {
+		return -1;
+	}
+	std::chrono::steady_clock::time_point deadline = manager->lastGateEdge + std::chrono::milliseconds(manager->shotGapMillis);
+	int64_t millis = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+	//Round up so we never wake just before the deadline and go straight back to sleep
+	return millis < 0 ? 0 : (int)millis + 1;
+}
+
+void endShot(windowManager *manager)
+{
+	uint32_t windowsInShot = 0;
+	for (size_t g = 0; g < manager->gates.size(); g++) {
+		gateStream *stream = &manager->gates[g];
+		//A window still open here lost its closing edge, pass on what we have and mark it
+		if (stream->openWindow != NULL) {
+			tagWindow *window = stream->openWindow;
+			window->endTime = window->startTime;
+			if (!window->windowedTags.times.empty() && window->windowedTags.times.back() > window->endTime) {
+				window->endTime = window->windowedTags.times.back();
+			}
+			if (!window->clockTags.times.empty() && window->clockTags.times.back() > window->endTime) {
+				window->endTime = window->clockTags.times.back();
+			}
+			closeWindow(manager, stream);
+			manager->windowsCutShort++;
+		}
+		windowsInShot += stream->windowNum;
+	}
+	if (windowsInShot == 0) {
+		swapPendingRouting(manager);
+		return;
+	}
+	tagWindow *marker = newWindow(manager, 0);
+	marker->shotEnd = true;
+	marker->channelVect = manager->routing.channelVect;
+	marker->complete = true;
+	marker->closeReceived = manager->lastPhotonReceived;
+	marker->closed = stampNow();
+	//Next shot starts counting its peak from what is still in flight
+	marker->peakTagBytes = manager->memory.shotPeakBytes.exchange(manager->memory.inFlightBytes);
+	//Whatever was given up goes in the shot file, so nothing is lost without a trace
+	marker->storage = manager->droppingShot ? storeDropped : storeFull;
+	uint64_t packetsLost = metrics.packetsLost.load();
+	marker->packetsLost = packetsLost - manager->packetsLostBefore;
+	manager->packetsLostBefore = packetsLost;
+	manager->downstream->push(marker);
+	countMetric(metrics.shotsClosed);
+	std::cout << "shot " << manager->shotNum << " closed with " << manager->gates[0].windowNum << " windows";
+	for (size_t g = 1; g < manager->gates.size(); g++) {
+		std::cout << (g == 1 ? " (" : ", ") << manager->gates[g].windowNum << " on gate " << g << (g + 1 == manager->gates.size() ? ")" : "");
+	}
+	if (manager->unpairedEdges != 0) {
+		std::cout << " (" << manager->unpairedEdges << " unpaired gate edges)";
+	}
+	if (manager->droppingShot) {
+		std::cout << ", dropped under backpressure";
+		countMetric(metrics.shotsDropped);
+	}
+	else if (manager->windowsDegraded != 0) {
+		std::cout << ", " << manager->windowsDegraded << " windows degraded under backpressure";
+	}
+	std::cout << std::endl;
+	//The summary goes out now, the shot file is only complete once the writer catches up
+	if (manager->publisher != NULL) {
+		publishShot(manager->publisher, manager);
+	}
+	manager->shotNum++;
+	for (size_t g = 0; g < manager->gates.size(); g++) {
+		manager->gates[g].windowNum = 0;
+		resetShotTallies(&manager->gates[g]);
+	}
+	manager->unpairedEdges = 0;
+	manager->windowsCutShort = 0;
+	manager->droppingShot = false;
+	manager->windowsDegraded = 0;
+	swapPendingRouting(manager);
+}
+
+void releaseWindow(tagWindow *window, tagMemory *memory)
+{
+	memory->inFlightBytes -= window->accountedBytes;
+	if (!window->spillPath.empty()) {
+		std::remove(window->spillPath.c_str());
+	}
+	delete window;
+}
+
+bool readSpilledBlock(const tagWindow *window, const spilledBlock *block, tagColumns *tags)
+{
+	FILE *spillFile = fopen(window->spillPath.c_str(), "rb");
+	if (spillFile == NULL) {
+		return false;
+	}
+	tags->times.resize(block->numTags);
+	tags->edges.resize(block->numTags);
+	bool ok = fseek64(spillFile, block->offset, SEEK_SET) == 0;
+	ok = ok && fread(&tags->times[0], sizeof(uint64_t), block->numTags, spillFile) == block->numTags;
+	ok = ok && fread(&tags->edges[0], sizeof(uint8_t), block->numTags, spillFile) == block->numTags;
+	fclose(spillFile);
+	return ok;
+}
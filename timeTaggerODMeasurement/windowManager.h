@@ -0,0 +1,253 @@
+// windowManager.h : Streaming gate windows, each closed window is handed downstream as soon as it closes
+//
+
+#pragma once
+
+#include "acquisitionOptions.h"
+#include "tagDecoder.h"
+#include "coincidenceCounter.h"
+#include "chunkCompression.h"
+#include "latencyHistogram.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+//Tags are spilled in whole blocks of this many tags
+const size_t spillBlockTags = 65536;
+
+//A block of tags moved out to a window's spill file, times first then edges
+struct spilledBlock {
+	uint64_t offset;
+	uint32_t numTags;
+	bool clock;
+};
+
+//Where the tags of an edge (channel << 1 | slope) go
+enum tagRoute {
+	routeDrop,
+	routeGate,
+	routeWindowed,
+	routeClock
+};
+
+const int routedEdges = 32;
+
+struct routingTable {
+	uint8_t routes[routedEdges];
+	//Stop inputs routed to the windowed tags, recorded with each shot
+	std::vector<uint16_t> channelVect;
+	//Row of each channel in the counts of a window, -1 for channels that are not counted
+	int8_t countRows[8];
+	uint32_t numCountRows;
+	//Set when some gate opens or closes on the clock line, so clock tags have to be shown to the gates
+	bool clockGates;
+};
+
+//What is kept of a window, less than the run was set up for when backpressure sets in
+enum windowStorage {
+	storeFull,
+	//Photon counts per channel and bin in place of the tags
+	storeCounts,
+	//Only the photon totals per channel
+	storeTotals,
+	//Nothing, the window's shot is being dropped. Markers of dropped shots carry this too
+	storeDropped
+};
+
+//A single gate window, or a marker ending the current shot
+struct tagWindow {
+	//Markers carry no tags, windowNum then holds the number of windows of the first gate in the shot
+	bool shotEnd;
+	uint64_t shotNum;
+	//Gate the window was cut by, numbered in the order the gates were given
+	uint32_t gateNum;
+	uint32_t windowNum;
+	uint64_t startTime;
+	uint8_t startEdge;
+	uint64_t endTime;
+	uint8_t endEdge;
+	//False if the shot ended before the closing gate edge turned up
+	bool complete;
+	tagColumns windowedTags;
+	tagColumns clockTags;
+	//Blocks spilled to disk come before the tags still held in memory
+	std::string spillPath;
+	std::vector<spilledBlock> spilled;
+	//Spilling failed (disk full or the like), the window keeps the rest of its tags in memory
+	bool spillFailed;
+	//Bytes counted against the memory budget for this window
+	uint64_t accountedBytes;
+	//Capacity of the tag columns when last looked at, for counting their growth
+	size_t columnCapacity;
+	//Markers carry the peak in-flight tag storage seen during the shot
+	uint64_t peakTagBytes;
+	//Markers carry the stop inputs the shot was routed with
+	std::vector<uint16_t> channelVect;
+	//Photons of each tag channel in the window, whether the tags are kept or only counted
+	uint32_t photons[8];
+	//windowStorage
+	uint8_t storage;
+	//Markers carry the packets lost during the shot
+	uint64_t packetsLost;
+	//In counts only mode (or under backpressure) the photons per counted channel (rows, in channel list order) and bin
+	//replace the tags, countBins is 0 while the tags are kept
+	uint32_t countBins;
+	std::vector<uint32_t> counts;
+	//Coincidences among the windowed tags, with the tags taking part if they are kept
+	coincidenceResult coincidences;
+	//Packed words of the windowed, clock and coincidence tags once encoded by the post-processing stages, the writer
+	//packs the tags itself while encoded is false
+	bool encoded;
+	std::vector<uint32_t> windowedWords;
+	std::vector<uint32_t> clockWords;
+	std::vector<uint32_t> coincidenceWords;
+	//The same words deflated chunk by chunk when compressed output is on, empty when the writer has to compress them
+	bool compressed;
+	std::vector<compressedChunk> windowedChunks;
+	std::vector<compressedChunk> clockChunks;
+	std::vector<compressedChunk> coincidenceChunks;
+	//Fetch of the packet holding the closing edge, for markers the packet holding the last photon of the shot
+	stageStamp closeReceived;
+	//Hand-over to the writer
+	stageStamp closed;
+};
+
+//Tag storage held by open and queued windows, updated by both the decode loop and the writer
+struct tagMemory {
+	std::atomic<uint64_t> inFlightBytes;
+	std::atomic<uint64_t> shotPeakBytes;
+};
+
+//Bounded hand-over of closed windows from the decode loop to the writer, the queue owns the windows it holds
+class windowQueue {
+public:
+	windowQueue(size_t capacity);
+	//Blocks while the queue is full
+	void push(tagWindow *window);
+	//Blocks while the queue is empty, returns NULL once the queue is closed and drained
+	tagWindow *pop();
+	void close();
+	//Take windows again once a closed queue has been drained, for the next run of the daemon
+	void reopen();
+	size_t size();
+	size_t capacity();
+private:
+	std::mutex lock;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::deque<tagWindow*> windows;
+	size_t maxWindows;
+	bool closed;
+};
+
+//Windows of a single gate
+struct gateStream {
+	gateDefinition gate;
+	//Window currently being filled, NULL while the gate is closed
+	tagWindow *openWindow;
+	uint32_t windowNum;
+	//Rising clock edges since the window opened, for gates closed by a clock count
+	uint32_t clockEdges;
+	//Tags added to the open window not yet counted against the memory budget
+	size_t addedTags;
+	coincidenceCounter coincidence;
+	//Tallies of the shot in progress for its summary, photons per tag channel, the photon total of each closed window
+	//and coincidences
+	uint64_t shotPhotons[8];
+	std::vector<uint64_t> windowPhotons;
+	uint64_t shotCoincidences;
+};
+
+struct shotPublisher;
+
+struct windowManager {
+	shotRule rule;
+	uint32_t windowsPerShot;
+	uint32_t shotGapMillis;
+	uint16_t digitalIOMask;
+	//Bins of the photon counts kept in place of the tags, 0 to keep the tags
+	uint32_t countBins;
+	uint64_t countBinTicks;
+	//Coincidences are counted on the windowed tags while a window is open, groups never span two windows
+	bool countCoincidences;
+	//Gate the OD of each window of the first gate is taken against in the shot summary, 0 for none
+	uint32_t odReferenceGate;
+	routingTable routing;
+	//Table to swap in once the shot in progress ends
+	routingTable pendingRouting;
+	bool routingPending;
+	std::vector<gateStream> gates;
+	uint64_t shotNum;
+	std::chrono::steady_clock::time_point lastGateEdge;
+	bool digitalIOActive;
+	//Gate edges that did not pair up (open while open, close while closed)
+	uint64_t unpairedEdges;
+	//Windows still open when their shot ended
+	uint32_t windowsCutShort;
+	//Backpressure tiers and the bins windows are counted in when the counts tier is taken
+	std::vector<pressureTier> backpressure;
+	uint32_t pressureBins;
+	//Set at the start of a shot taken under the drop tier, its windows are let go as they close
+	bool droppingShot;
+	//Windows of the shot in progress kept with less than the run was set up for
+	uint32_t windowsDegraded;
+	//Lost packet count when the shot in progress started
+	uint64_t packetsLostBefore;
+	//Sent a summary of every shot as it ends, NULL for none
+	shotPublisher *publisher;
+	windowQueue *downstream;
+	uint64_t memoryBudget;
+	std::string spillPrefix;
+	tagMemory memory;
+	//Stamps of the packet being processed, set by the decode loop
+	stageStamp packetReceived;
+	stageStamp packetDecoded;
+	//Fetch of the latest packet that contributed to the current shot
+	stageStamp lastPhotonReceived;
+};
+
+void initWindowManager(windowManager *manager, const acquisitionOptions *options, windowQueue *downstream);
+
+//Gate on channel 0, the clock line (a stop input, 1..8) to the clock tags and the given stop inputs windowed. With no
+//stop inputs given every other channel is windowed
+void buildRoutingTable(routingTable *table, const std::vector<uint16_t> &channelVect, uint16_t clockLine);
+
+//Route the edges of the gate channels to the gates, edges of the clock line stay clock tags. Done by the manager on every
+//table it takes, so tables can be built without knowing the gates
+void addGateRoutes(routingTable *table, const std::vector<gateDefinition> &gates);
+
+//The single gate on stop 1 used when no gates are given
+gateDefinition standardGate();
+
+//True from the first window of a shot (of any gate) until it ends
+bool shotInProgress(const windowManager *manager);
+
+//Route tags with a new table from the next shot on, or straight away between shots. True if the swap is waiting on the
+//shot in progress, routingPending is cleared once it has happened
+bool queueRouting(windowManager *manager, const routingTable *routing);
+
+//Route a block of decoded tags into windows
+void processTagBlock(const tagColumns *block, windowManager *manager);
+
+//Apply the digital IO shot rule using the state from a packet header
+void checkDigitalIOState(uint16_t digitalIOState, windowManager *manager);
+
+//Whether checkDigitalIOState would end the shot on this state
+bool digitalIOEndsShot(uint16_t digitalIOState, const windowManager *manager);
+
+//End the shot if the gate has been quiet for longer than the gap timeout
+void checkShotGap(windowManager *manager);
+
+//Milliseconds until checkShotGap could next end the shot, -1 if no shot is waiting on the gap timeout
+int shotGapTimeout(const windowManager *manager);
+
+//Close any open window and send the shot end marker downstream
+void endShot(windowManager *manager);
+
+//Free a window once written, returning its tag storage to the budget
+void releaseWindow(tagWindow *window, tagMemory *memory);
+
+//Read a spilled block back in
+bool readSpilledBlock(const tagWindow *window, const spilledBlock *block, tagColumns *tags);
@@ -0,0 +1,177 @@
+// windowPipeline.cpp : Post-processing of closed windows on a work stealing pool, handed on to the writer in shot order
+//
+
+#include "stdafx.h"
+#include "windowPipeline.h"
+
+//Stages of one window, shared by its tasks and freed with the last of them
+struct windowJob {
+	windowPipeline *pipeline;
+	tagWindow *window;
+	uint64_t seq;
+	//Stages each stage is still waiting on, and the stages not yet done
+	std::unique_ptr<std::atomic<size_t>[]> waitingOn;
+	std::atomic<size_t> stagesLeft;
+};
+
+void initWindowPipeline(windowPipeline *pipeline, workPool *pool)
+{
+	pipeline->pool = pool;
+	pipeline->input = NULL;
+	pipeline->output = NULL;
+	pipeline->inFlight = 0;
+	pipeline->maxInFlight = 1;
+	pipeline->nextSeq = 0;
+	pipeline->nextRelease = 0;
+}
+
+size_t addWindowStage(windowPipeline *pipeline, const std::string &name, std::function<void(tagWindow *)> run, const std::vector<size_t> &after)
+{
+	windowStage stage;
+	stage.name = name;
+	stage.run = run;
+	//Stages can only come after ones registered before them, so the graph has no cycles
+	for (size_t i = 0; i < after.size(); i++) {
+		if (after[i] < pipeline->stages.size()) {
+			stage.after.push_back(after[i]);
+		}
+	}
+	pipeline->stages.push_back(stage);
+	return pipeline->stages.size() - 1;
+}
+
+void addEncodeStages(windowPipeline *pipeline, int compressLevel)
+{
+	std::vector<size_t> encodes;
+	//Windows with spilled blocks are left to the writer, which reads them back in order
+	encodes.push_back(addWindowStage(pipeline, "encode windowed tags", [](tagWindow *window) {
+		if (window->spilled.empty()) {
+			encodeWindowColumns(&window->windowedTags, window->startTime, &window->windowedWords);
+		}
+	}, std::vector<size_t>()));
+	encodes.push_back(addWindowStage(pipeline, "encode clock tags", [](tagWindow *window) {
+		if (window->spilled.empty()) {
+			encodeWindowColumns(&window->clockTags, window->startTime, &window->clockWords);
+		}
+	}, std::vector<size_t>()));
+	encodes.push_back(addWindowStage(pipeline, "encode coincidence tags", [](tagWindow *window) {
+		encodeWindowColumns(&window->coincidences.tags, window->startTime, &window->coincidenceWords);
+	}, std::vector<size_t>()));
+	std::vector<size_t> last = encodes;
+	if (compressLevel != 0) {
+		//Each set of words is deflated as soon as it is packed, alongside the packing of the others
+		last.clear();
+		last.push_back(addWindowStage(pipeline, "compress windowed tags", [compressLevel](tagWindow *window) {
+			compressWords(window->windowedWords, compressLevel, &window->windowedChunks);
+		}, std::vector<size_t>(1, encodes[0])));
+		last.push_back(addWindowStage(pipeline, "compress clock tags", [compressLevel](tagWindow *window) {
+			compressWords(window->clockWords, compressLevel, &window->clockChunks);
+		}, std::vector<size_t>(1, encodes[1])));
+		last.push_back(addWindowStage(pipeline, "compress coincidence tags", [compressLevel](tagWindow *window) {
+			compressWords(window->coincidenceWords, compressLevel, &window->coincidenceChunks);
+		}, std::vector<size_t>(1, encodes[2])));
+	}
+	addWindowStage(pipeline, "mark encoded", [compressLevel](tagWindow *window) {
+		window->encoded = window->spilled.empty();
+		window->compressed = window->encoded && compressLevel != 0;
+	}, last);
+}
+
+//Hand on every finished window that is next in line
+static void finishWindow(windowPipeline *pipeline, uint64_t seq, tagWindow *window)
+{
+	std::lock_guard<std::mutex> guard(pipeline->lock);
+	pipeline->finished[seq] = window;
+	while (!pipeline->finished.empty() && pipeline->finished.begin()->first == pipeline->nextRelease) {
+		//Pushed under the lock so windows reach the output in order
+		pipeline->output->push(pipeline->finished.begin()->second);
+		pipeline->finished.erase(pipeline->finished.begin());
+		pipeline->nextRelease++;
+		pipeline->inFlight--;
+	}
+	pipeline->released.notify_all();
+}
+
+static void runStage(std::shared_ptr<windowJob> job, size_t stage);
+
+static void submitStage(std::shared_ptr<windowJob> job, size_t stage)
+{
+	job->pipeline->pool->submit([job, stage] { runStage(job, stage); });
+}
+
+static void runStage(std::shared_ptr<windowJob> job, size_t stage)
+{
+	windowPipeline *pipeline = job->pipeline;
+	pipeline->stages[stage].run(job->window);
+	//Later stages waiting on this one go once it was the last they needed
+	for (size_t s = stage + 1; s < pipeline->stages.size(); s++) {
+		const std::vector<size_t> &after = pipeline->stages[s].after;
+		for (size_t i = 0; i < after.size(); i++) {
+			if (after[i] == stage && --job->waitingOn[s] == 0) {
+				submitStage(job, s);
+			}
+		}
+	}
+	if (--job->stagesLeft == 0) {
+		finishWindow(pipeline, job->seq, job->window);
+	}
+}
+
+static void dispatchLoop(windowPipeline *pipeline)
+{
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(pipeline->lock);
+			pipeline->released.wait(guard, [pipeline] { return pipeline->inFlight < pipeline->maxInFlight; });
+		}
+		tagWindow *window = pipeline->input->pop();
+		if (window == NULL) {
+			break;
+		}
+		uint64_t seq;
+		{
+			std::lock_guard<std::mutex> guard(pipeline->lock);
+			seq = pipeline->nextSeq++;
+			pipeline->inFlight++;
+		}
+		//Shot end markers have nothing to process but still keep their place
+		if (window->shotEnd || pipeline->stages.empty()) {
+			finishWindow(pipeline, seq, window);
+			continue;
+		}
+		std::shared_ptr<windowJob> job = std::make_shared<windowJob>();
+		job->pipeline = pipeline;
+		job->window = window;
+		job->seq = seq;
+		job->waitingOn.reset(new std::atomic<size_t>[pipeline->stages.size()]);
+		job->stagesLeft = pipeline->stages.size();
+		for (size_t s = 0; s < pipeline->stages.size(); s++) {
+			job->waitingOn[s] = pipeline->stages[s].after.size();
+		}
+		for (size_t s = 0; s < pipeline->stages.size(); s++) {
+			if (pipeline->stages[s].after.empty()) {
+				submitStage(job, s);
+			}
+		}
+	}
+	std::unique_lock<std::mutex> guard(pipeline->lock);
+	pipeline->released.wait(guard, [pipeline] { return pipeline->inFlight == 0; });
+	pipeline->output->close();
+}
+
+void startWindowPipeline(windowPipeline *pipeline, windowQueue *input, windowQueue *output, size_t maxInFlight)
+{
+	pipeline->input = input;
+	pipeline->output = output;
+	pipeline->inFlight = 0;
+	pipeline->maxInFlight = maxInFlight != 0 ? maxInFlight : 1;
+	pipeline->finished.clear();
+	pipeline->nextSeq = 0;
+	pipeline->nextRelease = 0;
+	pipeline->dispatcher = std::thread(dispatchLoop, pipeline);
+}
+
+void stopWindowPipeline(windowPipeline *pipeline)
+{
+	pipeline->dispatcher.join();
+}
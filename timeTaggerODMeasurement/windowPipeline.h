@@ -0,0 +1,54 @@
+// windowPipeline.h : Post-processing of closed windows on a work stealing pool, handed on to the writer in shot order
+//
+
+#pragma once
+
+#include "windowManager.h"
+#include "workPool.h"
+#include <map>
+#include <string>
+
+//One step of the work done on each window. A stage runs once the stages it comes after are done, stages that do not
+//depend on each other run side by side
+struct windowStage {
+	std::string name;
+	std::function<void(tagWindow *)> run;
+	std::vector<size_t> after;
+};
+
+struct windowPipeline {
+	std::vector<windowStage> stages;
+	workPool *pool;
+	//Closed windows from the window manager and the processed ones for the writer, in the same order
+	windowQueue *input;
+	windowQueue *output;
+	std::thread dispatcher;
+	//Windows taken from the input but not yet handed on, at most maxInFlight
+	std::mutex lock;
+	std::condition_variable released;
+	size_t inFlight;
+	size_t maxInFlight;
+	//Finished windows waiting on an earlier one, by their place in the input
+	std::map<uint64_t, tagWindow *> finished;
+	uint64_t nextSeq;
+	uint64_t nextRelease;
+};
+
+//Windows are processed on the given pool, which can be shared with other work
+void initWindowPipeline(windowPipeline *pipeline, workPool *pool);
+
+//Register a stage to run on every window (not on shot end markers), returns its index for later stages to come after
+size_t addWindowStage(windowPipeline *pipeline, const std::string &name, std::function<void(tagWindow *)> run, const std::vector<size_t> &after);
+
+//The stages every run has, encoding the tags of each window to the words the writer stores. With a compression level
+//(1..9) each set of words is then deflated in chunks, for the writer to store with direct chunk writes.
+//Coincidences and count bins are not stages, they stay on the decode thread as the tags arrive (see addTag): counts
+//only and degraded windows never hold their tags to bin later, and the shot summary published as the shot ends needs
+//the coincidences before the pool would have got to the last windows
+void addEncodeStages(windowPipeline *pipeline, int compressLevel);
+
+//Take windows from input until it is closed and drained, output is closed once the last one has been handed on
+void startWindowPipeline(windowPipeline *pipeline, windowQueue *input, windowQueue *output, size_t maxInFlight);
+
+//Wait for the input to be drained and everything handed on, the input has to have been closed
+void stopWindowPipeline(windowPipeline *pipeline);
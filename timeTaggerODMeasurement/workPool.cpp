@@ -0,0 +1,107 @@
+// workPool.cpp : Work stealing thread pool for the post-processing of closed windows
+//
+
+#include "stdafx.h"
+#include "workPool.h"
+
+//Pool and queue of the worker running on this thread, NULL off the pool
+static thread_local workPool *currentPool = NULL;
+static thread_local unsigned currentWorker = 0;
+
+workPool::workPool(unsigned numWorkers) : queued(0), stolen(0), nextQueue(0), stopping(false)
+{
+	if (numWorkers == 0) {
+		numWorkers = 1;
+	}
+	for (unsigned i = 0; i < numWorkers; i++) {
+		queues.push_back(std::unique_ptr<workerQueue>(new workerQueue));
+	}
+	for (unsigned i = 0; i < numWorkers; i++) {
+		threads.push_back(std::thread(&workPool::workerLoop, this, i));
+	}
+}
+
+workPool::~workPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void workPool::submit(std::function<void()> task)
+{
+	//Tasks from outside the pool are dealt round the workers
+	unsigned index = currentPool == this ? currentWorker : nextQueue++ % (unsigned)queues.size();
+	{
+		std::lock_guard<std::mutex> guard(queues[index]->lock);
+		queues[index]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		queued++;
+	}
+	wake.notify_one();
+}
+
+unsigned workPool::workers()
+{
+	return (unsigned)threads.size();
+}
+
+uint64_t workPool::steals()
+{
+	return stolen.load(std::memory_order_relaxed);
+}
+
+bool workPool::takeTask(unsigned index, std::function<void()> *task)
+{
+	{
+		workerQueue *own = queues[index].get();
+		std::lock_guard<std::mutex> guard(own->lock);
+		if (!own->tasks.empty()) {
+			*task = std::move(own->tasks.back());
+			own->tasks.pop_back();
+			return true;
+		}
+	}
+	for (size_t i = 1; i < queues.size(); i++) {
+		workerQueue *victim = queues[(index + i) % queues.size()].get();
+		std::lock_guard<std::mutex> guard(victim->lock);
+		if (!victim->tasks.empty()) {
+			*task = std::move(victim->tasks.front());
+			victim->tasks.pop_front();
+			stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void workPool::workerLoop(unsigned index)
+{
+	currentPool = this;
+	currentWorker = index;
+	std::function<void()> task;
+	for (;;) {
+		{
+			//Claim a task before looking for it so a worker never sleeps while something is queued
+			std::unique_lock<std::mutex> guard(sleepLock);
+			wake.wait(guard, [this] { return queued != 0 || stopping; });
+			if (queued == 0) {
+				return;
+			}
+			queued--;
+		}
+		//The claimed task is on some queue, though another worker may pick it before we get there and leave us theirs
+		while (!takeTask(index, &task)) {
+			std::this_thread::yield();
+		}
+		task();
+		task = nullptr;
+	}
+}
@@ -0,0 +1,44 @@
+// workPool.h : Work stealing thread pool for the post-processing of closed windows
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Each worker runs the tasks it queued itself newest first and steals the oldest tasks of the others once it runs dry,
+//so a window's follow-on stages stay on the core that has its tags in cache while idle workers take whole windows
+class workPool {
+public:
+	workPool(unsigned numWorkers);
+	//Runs every task still queued before the workers stop
+	~workPool();
+	//Queue a task, on the calling worker's own queue when called from a task
+	void submit(std::function<void()> task);
+	unsigned workers();
+	//Tasks taken from another worker's queue so far
+	uint64_t steals();
+private:
+	struct workerQueue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+	void workerLoop(unsigned index);
+	//Own queue from the back, then the others from the front. False if there was nothing anywhere
+	bool takeTask(unsigned index, std::function<void()> *task);
+	std::vector<std::unique_ptr<workerQueue>> queues;
+	std::vector<std::thread> threads;
+	//Workers sleep on this while nothing is queued
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<uint64_t> queued;
+	std::atomic<uint64_t> stolen;
+	std::atomic<unsigned> nextQueue;
+	bool stopping;
+};
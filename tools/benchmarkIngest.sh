@@ -0,0 +1,31 @@
+#!/bin/bash
+# benchmarkIngest.sh : Compare the native ingest backends over loopback with the packet simulator
+#
+# Usage: benchmarkIngest.sh acquisitionBinary simulatorBinary [windows] [tagsPerWindow] [packetsPerSecond]
+# The tpacket backend needs CAP_NET_RAW (run as root). The vendor TTMData_c path needs a real tagger, run it with
+# --benchmark=ingest --ingest=vendor against the hardware and compare with the lines printed here.
+
+acquisition=$1
+simulator=$2
+windows=${3:-20000}
+tags=${4:-2000}
+rate=${5:-0}
+port=15502
+work=$(mktemp -d)
+cd "$work" || exit 1
+echo 0 > stopFile.txt
+
+for ingest in recvmmsg tpacket; do
+	extra=""
+	if [ "$ingest" = "tpacket" ]; then
+		extra="--capture-if=lo"
+	fi
+	"$acquisition" 127.0.0.1 "$work/bench.h5" 100 2,3 4 100 --control=none --ingest=$ingest --data-port=$port $extra --benchmark=ingest --benchmark-seconds=60 > "$ingest.log" 2>&1 &
+	receiver=$!
+	sleep 1
+	"$simulator" 127.0.0.1 $port "$windows" "$tags" "$rate" 2,3 > /dev/null
+	wait $receiver
+	echo "== $ingest"
+	grep -E "^(packets|tags|throughput|cpu)" "$ingest.log"
+done
+rm -rf "$work"
@@ -0,0 +1,133 @@
+// packetSimulator.cpp : Stand-in for the tagger, sends synthetic TTFormat_IMode_EXT64_PACK data packets over UDP
+//
+// Each gate window is a rising gate edge, photons on the given channels, clock ticks and a falling gate edge, so the
+// acquisition can be run with --control=none against loopback without hardware. Linux only.
+//   g++ -std=c++14 -O2 -I../timeTaggerODMeasurement -idirafter ../include packetSimulator.cpp -o packetSimulator
+// Usage: packetSimulator host port windows tagsPerWindow [packetsPerSecond] [photonChannels] [clockChannel]
+
+#include "TTMLib.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+//Tags per packet, the tagger fills packets up to about 8KB
+const size_t wordsPerPacket = 2000;
+
+struct simulator {
+	int socket;
+	sockaddr_in target;
+	TTMDataPacket_t packet;
+	size_t numWords;
+	uint16_t packetCnt;
+	uint32_t highWord;
+	uint64_t packetsSent;
+	std::chrono::nanoseconds packetInterval;
+	std::chrono::steady_clock::time_point nextSend;
+};
+
+static void sendPacket(simulator *sim)
+{
+	if (sim->numWords == 0) {
+		return;
+	}
+	//Header goes out in network byte order, the tags in little endian as asked for by UseLittleEndianByteOrder
+	TTMDataHeader_t *header = &sim->packet.Header;
+	memset(header, 0, sizeof(TTMDataHeader_t));
+	header->TTMPacketMagicA = TTMCookieA;
+	header->TTMPacketMagicB = TTMCookieB;
+	header->TTMDataMagicA = DataCookieA;
+	header->TTMDataMagicB = DataCookieB;
+	header->PacketVersion = htons(PacketVersionCookie);
+	header->PacketCnt = htons(sim->packetCnt++);
+	header->DataFormat = TTFormat_IMode_EXT64_PACK;
+	header->DataSize = htons((uint16_t)(sim->numWords * sizeof(TimetagI64Pack)));
+	if (sim->packetInterval.count() != 0) {
+		std::this_thread::sleep_until(sim->nextSend);
+		sim->nextSend += sim->packetInterval;
+	}
+	sendto(sim->socket, (const char *)header, sizeof(TTMDataHeader_t) + sim->numWords * sizeof(TimetagI64Pack), 0, (sockaddr *)&sim->target, sizeof(sim->target));
+	sim->numWords = 0;
+	sim->packetsSent++;
+}
+
+static void addWord(simulator *sim, uint32_t payload, uint32_t highLow)
+{
+	sim->packet.Data.TimetagI64Pack[sim->numWords].Payload = payload;
+	sim->packet.Data.TimetagI64Pack[sim->numWords].HighLow = highLow;
+	sim->numWords++;
+	if (sim->numWords == wordsPerPacket) {
+		sendPacket(sim);
+	}
+}
+
+//Tag channels count from 0, the gate is channel 0
+static void addTag(simulator *sim, uint64_t time, uint8_t channel, uint8_t slope)
+{
+	uint32_t high = (uint32_t)(time >> 27) & 0x7FFFFFFF;
+	if (high != sim->highWord) {
+		sim->highWord = high;
+		addWord(sim, high, 1);
+	}
+	addWord(sim, ((uint32_t)((channel << 1) | slope) << 27) | (uint32_t)(time & 0x7FFFFFF), 0);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5) {
+		std::cout << "usage: packetSimulator host port windows tagsPerWindow [packetsPerSecond] [photonChannels] [clockChannel]" << std::endl;
+		return 1;
+	}
+	simulator sim;
+	sim.socket = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&sim.target, 0, sizeof(sim.target));
+	sim.target.sin_family = AF_INET;
+	sim.target.sin_addr.s_addr = inet_addr(argv[1]);
+	sim.target.sin_port = htons((uint16_t)atoi(argv[2]));
+	uint64_t windows = strtoull(argv[3], NULL, 10);
+	uint64_t tagsPerWindow = strtoull(argv[4], NULL, 10);
+	double packetsPerSecond = argc > 5 ? atof(argv[5]) : 0;
+	std::vector<uint8_t> photonChannels;
+	std::stringstream channels(argc > 6 ? argv[6] : "1");
+	int channel;
+	while (channels >> channel) {
+		photonChannels.push_back((uint8_t)channel);
+		if (channels.peek() == ',') {
+			channels.ignore();
+		}
+	}
+	int clockChannel = argc > 7 ? atoi(argv[7]) : -1;
+	sim.numWords = 0;
+	sim.packetCnt = 0;
+	sim.highWord = 0xFFFFFFFF;
+	sim.packetsSent = 0;
+	sim.packetInterval = std::chrono::nanoseconds(packetsPerSecond > 0 ? (int64_t)(1e9 / packetsPerSecond) : 0);
+	sim.nextSend = std::chrono::steady_clock::now();
+	uint64_t time = 1000;
+	uint64_t random = 88172645463325252ull;
+	for (uint64_t w = 0; w < windows; w++) {
+		addTag(&sim, time, 0, 1);
+		for (uint64_t t = 0; t < tagsPerWindow; t++) {
+			//xorshift for the photon spacing and channel
+			random ^= random << 13;
+			random ^= random >> 7;
+			random ^= random << 17;
+			time += 1 + random % 2000;
+			if (clockChannel >= 0 && t % 16 == 0) {
+				addTag(&sim, time, (uint8_t)clockChannel, 1);
+				time++;
+			}
+			addTag(&sim, time, photonChannels[random % photonChannels.size()], 1);
+		}
+		time += 100;
+		addTag(&sim, time, 0, 0);
+		time += 10000;
+	}
+	sendPacket(&sim);
+	std::cout << sim.packetsSent << " packets sent" << std::endl;
+	return 0;
+}
@@ -0,0 +1,56 @@
+// shmRingReader.cpp : Reference reader for the shared memory window ring, prints a line per window
+//
+// Build next to the acquisition on Linux with
+//   g++ -std=c++14 -O2 -I../timeTaggerODMeasurement shmRingReader.cpp -o shmRingReader -lrt
+// or on Windows as a console project with ..\timeTaggerODMeasurement on the include path.
+// Usage: shmRingReader ringName [channel]
+
+#include "sharedTagRing.h"
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "usage: shmRingReader ringName [channel]" << std::endl;
+		return 1;
+	}
+	int channel = argc > 2 ? atoi(argv[2]) : -1;
+	sharedTagRingReader reader;
+	//The acquisition may not have created the ring yet
+	while (!reader.open(argv[1])) {
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+	ringWindowView view;
+	uint64_t laps = 0;
+	for (;;) {
+		if (!reader.waitNext(&view, 1000)) {
+			continue;
+		}
+		if (view.header.flags & ringRecordShotEnd) {
+			std::cout << "shot " << view.header.shotNum << " ended after " << view.header.windowNum << " windows" << std::endl;
+			continue;
+		}
+		//Work straight on the shared columns, here counting the tags on one channel (edges hold channel << 1 | slope)
+		uint64_t counted = 0;
+		for (uint64_t i = 0; i < view.header.numWindowed; i++) {
+			if (channel < 0 || (view.windowedEdges[i] >> 1) == channel) {
+				counted++;
+			}
+		}
+		//Only trust the result if the writer did not come round and overwrite the window meanwhile
+		if (!reader.valid(&view)) {
+			std::cout << "window " << view.header.windowNum << " of shot " << view.header.shotNum << " overwritten while reading" << std::endl;
+			continue;
+		}
+		if (reader.lapCount() != laps) {
+			laps = reader.lapCount();
+			std::cout << "fell behind the writer, skipped ahead (" << laps << " times so far)" << std::endl;
+		}
+		std::cout << "shot " << view.header.shotNum << " window " << view.header.windowNum << " seq " << view.header.seq << ": " << counted << " tags, " << view.header.numClock << " clock tags, " << (view.header.endTime - view.header.startTime) << " ticks long";
+		if (view.header.flags & ringRecordIncomplete) {
+			std::cout << " (incomplete)";
+		}
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,148 @@
+# shmRingReader.py : Python reader for the shared memory window ring, see timeTaggerODMeasurement/sharedTagRing.h
+#
+# Columns come back as numpy views straight onto the shared memory (plain lists if numpy is missing), so check
+# reader.valid(window) once done with them; False means the acquisition overwrote the window meanwhile.
+# Usage: python shmRingReader.py ringName
+
+import mmap
+import os
+import struct
+import sys
+import time
+
+try:
+	import numpy
+except ImportError:
+	numpy = None
+
+#Column types, as struct codes when numpy is missing
+UINT64 = numpy.uint64 if numpy is not None else "Q"
+UINT8 = numpy.uint8 if numpy is not None else "B"
+
+RING_MAGIC = 0x524D5454
+RING_VERSION = 1
+RECORD_WINDOW = 1
+RECORD_SHOT_END = 2
+RECORD_PADDING = 4
+RECORD_INCOMPLETE = 8
+
+#Offsets into the ring header
+HEADER_LAYOUT = struct.Struct("<IIQQ")
+CLAIM_POS = 64
+COMMIT_POS = 128
+LAST_RECORD_POS = 136
+#seq, recordBytes, shotNum, windowNum, flags, startTime, endTime, numWindowed, numClock
+RECORD_LAYOUT = struct.Struct("<QQQIIQQQQ")
+
+
+class RingWindow(object):
+	def __init__(self, pos, fields):
+		self.pos = pos
+		(self.seq, self.recordBytes, self.shotNum, self.windowNum, self.flags,
+			self.startTime, self.endTime, self.numWindowed, self.numClock) = fields
+		self.windowedTimes = None
+		self.windowedEdges = None
+		self.clockTimes = None
+		self.clockEdges = None
+
+	def isShotEnd(self):
+		return (self.flags & RECORD_SHOT_END) != 0
+
+	def isComplete(self):
+		return (self.flags & RECORD_INCOMPLETE) == 0
+
+
+class SharedTagRingReader(object):
+	def __init__(self, name):
+		if os.name == "nt":
+			#Named mappings can only be opened with the size given, which the header tells us
+			probe = mmap.mmap(-1, 256, tagname="Local\\" + name, access=mmap.ACCESS_READ)
+			size = 256 + struct.unpack_from("<Q", probe, 8)[0]
+			probe.close()
+			self.memory = mmap.mmap(-1, size, tagname="Local\\" + name, access=mmap.ACCESS_READ)
+		else:
+			with open("/dev/shm/" + name, "rb") as ringFile:
+				self.memory = mmap.mmap(ringFile.fileno(), 0, access=mmap.ACCESS_READ)
+		magic, version, self.dataBytes, self.headerBytes = HEADER_LAYOUT.unpack_from(self.memory, 0)
+		if magic != RING_MAGIC or version != RING_VERSION:
+			raise ValueError("%s is not a tag window ring" % name)
+		self.lapped = 0
+		#Start with the next window published
+		self.readPos = self._load(COMMIT_POS)
+
+	def _load(self, offset):
+		return struct.unpack_from("<Q", self.memory, offset)[0]
+
+	def _stillThere(self, pos):
+		return self._load(CLAIM_POS) <= pos + self.dataBytes
+
+	def _column(self, offset, dtype, count):
+		if numpy is not None:
+			return numpy.frombuffer(self.memory, dtype=dtype, count=count, offset=offset)
+		return list(struct.unpack_from("<%d%s" % (count, dtype), self.memory, offset))
+
+	def next(self):
+		"""Next window or shot end record, None if nothing new has been committed"""
+		while True:
+			if self.readPos >= self._load(COMMIT_POS):
+				return None
+			if not self._stillThere(self.readPos):
+				#The writer went round the ring past us, pick up from the newest record
+				self.lapped += 1
+				self.readPos = self._load(LAST_RECORD_POS)
+				continue
+			offset = self.readPos % self.dataBytes
+			if self.dataBytes - offset < RECORD_LAYOUT.size:
+				self.readPos += self.dataBytes - offset
+				continue
+			start = self.headerBytes + offset
+			window = RingWindow(self.readPos, RECORD_LAYOUT.unpack_from(self.memory, start))
+			if not self._stillThere(self.readPos) or window.recordBytes == 0:
+				continue
+			self.readPos += window.recordBytes
+			if window.flags & RECORD_PADDING:
+				continue
+			columns = start + RECORD_LAYOUT.size
+			window.windowedTimes = self._column(columns, UINT64, window.numWindowed)
+			columns += 8 * window.numWindowed
+			window.clockTimes = self._column(columns, UINT64, window.numClock)
+			columns += 8 * window.numClock
+			window.windowedEdges = self._column(columns, UINT8, window.numWindowed)
+			columns += window.numWindowed
+			window.clockEdges = self._column(columns, UINT8, window.numClock)
+			return window
+
+	def waitNext(self, timeoutSeconds):
+		deadline = time.time() + timeoutSeconds
+		while True:
+			window = self.next()
+			if window is not None or time.time() >= deadline:
+				return window
+			time.sleep(0.0005)
+
+	def valid(self, window):
+		"""False if the writer overwrote the window while it was being used"""
+		return self._stillThere(window.pos)
+
+
+if __name__ == "__main__":
+	if len(sys.argv) < 2:
+		print("usage: python shmRingReader.py ringName")
+		sys.exit(1)
+	reader = SharedTagRingReader(sys.argv[1])
+	while True:
+		window = reader.waitNext(1.0)
+		if window is None:
+			continue
+		if window.isShotEnd():
+			print("shot %d ended after %d windows" % (window.shotNum, window.windowNum))
+			continue
+		#Edges hold channel << 1 | slope
+		if numpy is not None:
+			perChannel = numpy.bincount(window.windowedEdges >> 1, minlength=8)
+		else:
+			perChannel = [sum(1 for edge in window.windowedEdges if edge >> 1 == c) for c in range(8)]
+		if not reader.valid(window):
+			print("window %d of shot %d overwritten while reading" % (window.windowNum, window.shotNum))
+			continue
+		print("shot %d window %d seq %d: tags per channel %s, %d clock tags" % (window.shotNum, window.windowNum, window.seq, list(perChannel), window.numClock))